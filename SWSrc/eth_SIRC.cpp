@@ -43,26 +43,49 @@
 //Does not apply to waitDone (has own explicit timeout).
 #define MAXRETRIES 3
 
-//Number of milliseconds we will wait between valid write acks before declaring 
-// that an outstanding write packet has not been successful.
+//Longest number of milliseconds we will wait for the ack of a write packet before declaring 
+// that it has not been successful and retransmitting it (just that one).
 //Notice, the entire write does not have to be completed in this time, but we should
-// not have to wait more than N milliseconds before we see the first ack, nor more than
-// N milliseconds between acks.
+// not have to wait more than N milliseconds for the ack of any one packet.
+//The actual timeout follows the measured round trip time to the FPGA (see MINRETRANSMITTIMEOUT),
+// this is only the ceiling, and we never give up on a packet before one of its retransmissions
+// has waited this long.
 //This number should not be reduced below 1000.
 //Applies to sendWrite and sendParamRegisterWrite
-//Also applies during write phase of sendWriteAndRun
+//Also applies during write phase of sendWriteAndRun (as a fixed timeout)
 #define WRITETIMEOUT 2000
 
-//Number of milliseconds we will wait between valid read responses before declaring 
-// that an outstanding read request has not been successful.
+//Longest number of milliseconds we will wait for the first response to a read request (or between
+// valid read responses) before declaring that it has not been successful and retransmitting it.
 //Notice, the entire read does not have to be completed in this time, but we should
 // not have to wait more than N milliseconds before we see the first response, nor more than
 // N milliseconds between responses.
+//As for WRITETIMEOUT, the actual timeout follows the measured round trip time, this is the ceiling.
 //This number should not be reduced below 1000.
 //Applies to sendRead and sendParamRegisterRead
-//Also applies during readback phase of sendWriteAndRun
+//Also applies during readback phase of sendWriteAndRun (as a fixed timeout)
 #define READTIMEOUT 2000
 
+//Shortest retransmit timeout, in milliseconds.
+//The retransmit timeout is computed from the smoothed round trip time and its variance,
+// the same way TCP does it (RFC 6298), and doubled each time the same packet is resent.
+//Until we have measured a round trip, WRITETIMEOUT and READTIMEOUT are used as-is.
+//Waits and timeouts are only as precise as the system timer tick (10-16 msec), there is
+// no point going much below that.
+#define MINRETRANSMITTIMEOUT 20
+
+//Longest number of milliseconds between polls of the run register in waitDone.
+//We poll right away, then back off exponentially from MINDONEPOLLINTERVAL to this.
+//In between polls we listen for the done notification the FPGA pushes (if it can),
+// so the wait ends as soon as the FPGA is done either way.
+#define MINDONEPOLLINTERVAL 1
+#define MAXDONEPOLLINTERVAL 100
+
+//Number of milliseconds we will wait for the answer to a jumbo frame request.
+//FPGAs that do not know about jumbo frames never answer, so keep this short.
+//The request is retried MAXRETRIES times, same as any other command.
+#define NEGOTIATETIMEOUT 250
+
 //******These are constants that can be used to tune the performance of the API
 //This is the number of packets we queue up on the completion port.
 //Raising this number can reduce dropped packets and improve receive bandwidth, at the expense of a 
@@ -78,26 +101,117 @@
 //	larger memory footprint for the API.
 //Note that the underlying packet interface might put a cap on this.
 //This number should be smaller than NUMOUTSTANDINGREADS
+//This is only the upper limit, the window we actually use adapts to the losses we see (see INITIALWRITEWINDOW).
 #define NUMOUTSTANDINGWRITES 250
 
+//This is the number of writes we send out before we have seen any of them acknowledged.
+//From there the write window grows by one packet per ack until the first loss (slow start),
+// then by one packet per window's worth of acks.  Every time a write has to be resent the
+// window is cut in half, but never below MINWRITEWINDOW.
+//This way we settle at the largest window that the FPGA, and any switch in between,
+// can take without dropping packets.
+#define INITIALWRITEWINDOW 16
+#define MINWRITEWINDOW 2
+
+//Define this to spread writes evenly over the round trip time, rather than sending a
+// whole window back to back.  It costs some CPU (we spin between packets) but helps
+// when the FPGA or the switch has little buffering.
+//#define PACEWRITES
+
+//Define this to ask again for a piece of a read as soon as a later piece of the same request
+// comes back, rather than waiting for the retransmit timer.  The FPGA sends the responses to
+// a request in order, so whatever it skipped got lost (see READREORDERCHUNKS).
+#define FASTREADRETRANSMIT
+
+//Multi-queue NICs, bonded links and software switches can deliver packets out of order.
+//A piece of a read only counts as lost once the request has sent back READREORDERCHUNKS
+// pieces past it, and once every request has sent back its last response we still wait
+// READREORDERDELAY msec for stragglers before asking again.
+//Late and duplicate responses are always accepted (duplicates are dropped).
+#define READREORDERCHUNKS 3
+#define READREORDERDELAY 1
+
+//Define this to ask the FPGA at reset time whether it takes transaction IDs (see TAGLENGTH).
+//If it does, writes and register writes are acked in the background: sendWrite and
+// sendParamRegisterWrite return once the data is on the wire, and the acks are collected
+// while the calls that follow go ahead.  Reads overlap with the writes still in flight,
+// anything that depends on the writes having landed (register reads of the same register,
+// run, wait, write & run, jobs and reset) waits for their acks first.
+//A write that is never acked fails whichever call is running when it runs out of retries.
+//FPGAs that do not know about transaction IDs never answer, which costs MAXRETRIES times
+// NEGOTIATETIMEOUT at every reset, hence not on by default.
+//#define TRANSACTIONIDS
+
+//Several ETH_SIRC objects (one per FPGA) can share one NIC.  The NIC is then opened once,
+// with one set of receives, and the frames are handed to each object by source MAC address
+// by whichever object happens to be waiting on the NIC, rather than every object opening
+// the NIC and filtering out (and dropping) everybody else's frames.
+//Not on by default because the NIC's MAC address can no longer be changed per object.
+//#define SHARENIC
+
+//Keep a copy of what we wrote to the FPGA input buffer, and have sendWrite only send the
+// bytes that differ from it.  Callers that write the same configuration before every run
+// then cost no round trips at all.
+//Only correct if nothing but us changes the input buffer, or whoever does calls
+// invalidateInputShadow, hence not on by default.
+//#define SHADOWINPUT
+
+//Clean runs shorter than this between two dirty ones are sent along, rather than paying
+// for another packet (and another wait for acks).
+#define SHADOWMERGEGAP 64
+
+//Keep a copy of the values we wrote to the parameter registers.  Writing a register with
+// the value it has already is then skipped, and reading a register gives back the value we
+// wrote last without going to the FPGA.
+//Only correct for registers the FPGA does not change itself.  Those have to be marked with
+// setParamRegisterVolatile, hence not on by default.
+//#define SHADOWREGISTERS
+
+//How many microseconds the NIC driver polls for a response before it puts us to sleep.
+//Register round trips are then a matter of microseconds rather than a thread wakeup, at
+// the expense of burning a CPU while we wait.  Zero (the default) sleeps right away.
+//Note that the underlying packet interface might not be able to do this.
+#define RECEIVESPIN 0
+
+//How many received packets we take off the NIC (and hand back to it) at a time while
+// collecting write acks and read responses.
+#define RECEIVEBATCH 32
+
 //******
 //******Other (internal) constants.
 //******
 
 //******These are constants that should only be changed if the network protocol changes
-//(ie we want to support jumbo frames and have updated the hardware-side API controller
-//to accomodate that. Recompilation will be required, or new APIs in PacketDriver.
-//This is the maximum packet size (entire packet including header)
-#define MAXPACKETSIZE 1514
+//This is the maximum packet size (entire packet including header) that every FPGA supports.
+//If both our NIC and the FPGA can do jumbo frames, we agree on a larger size at reset time
+// (see negotiateFrameSize).
+//NB: Past 1500 bytes of payload the length field of the header looks like an ethertype
+// to everybody else, so jumbo frames really want a direct link to the FPGA.
+#define MAXPACKETSIZE MAX_STANDARD_FRAME_SIZE
 
-//This is the maximum packet payload size (entire packet minus header)
-//Should be between 10 and 1500 for normal packets
-#define MAXPACKETDATASIZE (MAXPACKETSIZE-14)
+//This is the maximum packet payload size (entire packet minus header) for a given frame size
+//Should be between 10 and 1500 for normal packets, up to 9000 for jumbo frames
+#define MAXPACKETDATASIZE(_frame_) ((_frame_)-14)
 
 //This should be the maximum packet data size minus 9 for the write command, start address and length
-#define MAXWRITESIZE (MAXPACKETDATASIZE - 9)
+#define MAXWRITESIZE(_frame_) (MAXPACKETDATASIZE(_frame_) - 9)
 //This should be the maximum packet data size minus 5 for the read command and start address
-#define MAXREADSIZE (MAXPACKETDATASIZE - 5)
+#define MAXREADSIZE(_frame_) (MAXPACKETDATASIZE(_frame_) - 5)
+
+//A command sent with a transaction ID is wrapped in a 'T' command byte + 2 byte ID, and
+// the FPGA sends back its response(s) in the same envelope.
+#define TAGLENGTH 3
+
+//Most registers we read or write with a single batch command (the count is one byte)
+#define MAXPARAMBATCH 255
+
+//Payload length of a batch write command (and its ack), and of a batch read command
+//The response to a batch read is as long as a batch write
+#define PARAMWRITEBATCHLENGTH(_count_) (2 + 5 * (_count_))
+#define PARAMREADBATCHLENGTH(_count_) (2 + (_count_))
+
+//Smallest size of the ring of outstanding requests (must be a power of 2)
+#define MINREQUESTRINGSIZE 64
 
 #ifdef DEBUG
 #define PRINTF(x) printf x
@@ -121,9 +235,46 @@
 //FPGA_ID: 6 byte array containing the MAC adddress of the destination FPGA
 //Return with an error code if anything goes wrong.
 SIRC_DLL_LINKAGE ETH_SIRC::ETH_SIRC(uint8_t *FPGA_ID, uint32_t driverVersion, wchar_t *nicName){
+	//No I/O thread yet, so this goes to the shared error code (see setLastError)
+	ioThread = NULL;
+	ioThreadId = 0;
+	ioThreadError = 0;
 	setLastError(0);
+	requestRing = NULL;
+	backgroundRing = NULL;
+	backgroundHead = backgroundTail = 0;
+	backgroundTransmits = 0;
+	backgroundLow = backgroundHigh = 0;
+	memset(backgroundRegisters, 0, sizeof(backgroundRegisters));
+	useTransactionIds = false;
+	batchRegistersKnown = false;
+	useBatchRegisters = false;
+	writeTemplateLength = 0;
+	memset(registerKnown, 0, sizeof(registerKnown));
+	memset(registerVolatile, 0, sizeof(registerVolatile));
+	registerVolatile[255 / 32] |= 1u << (255 & 31);
+
+	//The I/O thread is only started by the first asynchronous request
+	InitializeCriticalSection(&ioLock);
+	InitializeCriticalSection(&asyncLock);
+	ioOwner = 0;
+	ioDepth = 0;
+	asyncSubmitted = NULL;
+	asyncHead = NULL;
+	asyncWakeup = NULL;
+	if(FPGA_ID == NULL){
+		PacketDriver = NULL;
+		PRINTF(("Invalid destination MAC address given!\n"));
+		setLastError(INVALIDFPGAMACADDRESS);
+		return;
+	}
+
 	//Make connection to NIC driver
+#ifdef SHARENIC
+    PacketDriver = OpenSharedPacketDriver(nicName,driverVersion,FPGA_ID,false);
+#else
     PacketDriver = OpenPacketDriver(nicName,driverVersion,false);
+#endif
     if (!PacketDriver) {
         setLastError(FAILDRIVERPRESENT);
 		return;
@@ -131,6 +282,12 @@ SIRC_DLL_LINKAGE ETH_SIRC::ETH_SIRC(uint8_t *FPGA_ID, uint32_t driverVersion, wc
 
     //See what MAC address we have
 	PacketDriver->GetMacAddress(ethHeader.My_MACAddress);
+
+	//Low-latency receives, if the driver can do them
+	if(RECEIVESPIN != 0 && !PacketDriver->SetReceiveSpin(RECEIVESPIN)){
+		LogIt("sirc:nospin");
+		printf("Warning: the packet driver cannot spin for receives, RECEIVESPIN has no effect.\n");
+	}
 #if 0
     cout << "source MAC: " 
          << hex << setw(2) << setfill('0') 
@@ -156,24 +313,69 @@ SIRC_DLL_LINKAGE ETH_SIRC::ETH_SIRC(uint8_t *FPGA_ID, uint32_t driverVersion, wc
     if (maxOutstandingWrites == 0)
         maxOutstandingWrites = NUMOUTSTANDINGWRITES;
 
+    //See how big a frame the NIC can take.
+    //We use standard frames until the FPGA agrees to something larger.
+    if (!PacketDriver->GetMaxFrameSize(&nicFrameSize))
+        nicFrameSize = MAXPACKETSIZE;
+    maxPacketSize = MAXPACKETSIZE;
+
     writeTimeout       = WRITETIMEOUT;
     readTimeout        = READTIMEOUT;
     maxRetries         = MAXRETRIES;
     maxInputDataBytes  = MAXINPUTDATABYTEADDRESS;
     maxOutputDataBytes = MAXOUTPUTDATABYTEADDRESS;
 
-	if(FPGA_ID == NULL){
-		PRINTF(("Invalid destination MAC address given!\n"));
-		setLastError(INVALIDFPGAMACADDRESS);
-		return;
-	}
-
 	memcpy(ethHeader.FPGA_MACAddress, FPGA_ID, 6);
 
 	outstandingTransmits = 0;
     currentPacket = NULL;
     currentBuffer = NULL;
 
+    //One timer per outstanding packet, plus a few stale ones waiting to be weeded out
+    timerSequence = 0;
+
+    //No round trip measured yet
+    LARGE_INTEGER frequency;
+    QueryPerformanceFrequency(&frequency);
+    counterFrequency = frequency.QuadPart;
+    haveRoundTrip = false;
+    smoothedRoundTrip = 0;
+    roundTripVariance = 0;
+    retransmitTimers.reserve(maxOutstandingReads + maxOutstandingWrites);
+    timerSlots.reserve(maxOutstandingReads + maxOutstandingWrites);
+    freeTimerSlots.reserve(maxOutstandingReads + maxOutstandingWrites);
+
+    //Start slow, the window opens up as the acks come back
+    writeWindow = min((uint32_t)INITIALWRITEWINDOW, maxOutstandingWrites);
+    writeWindowThreshold = maxOutstandingWrites;
+    writeWindowAcks = 0;
+    writeWindowRecovery = 0;
+    resentSequence = 0;
+    lastWriteTransmit = 0;
+
+    //The scoreboard ring is sized for a full window of writes, with room to spare
+    // for acks that come back out of order.  It only grows if that is not enough.
+    for (ringSize = MINREQUESTRINGSIZE; ringSize < 2 * maxOutstandingWrites; ringSize *= 2)
+        ;
+    requestRing = new (std::nothrow) REQUEST[ringSize];
+    if (!requestRing){
+        setLastError(FAILMEMALLOC);
+        return;
+    }
+    ringHead = ringTail = ringIter = 0;
+    readChunkCount = 0;
+
+    //Same for the requests acked in the background, but these are indexed by transaction ID
+    // so there is no room to grow past 64K.
+    for (backgroundSize = MINREQUESTRINGSIZE; backgroundSize < 2 * maxOutstandingWrites && backgroundSize < 0x10000; backgroundSize *= 2)
+        ;
+    backgroundRing = new (std::nothrow) PACKET *[backgroundSize];
+    if (!backgroundRing){
+        setLastError(FAILMEMALLOC);
+        return;
+    }
+    memset(backgroundRing, 0, backgroundSize * sizeof(PACKET *));
+
 #ifdef DEBUG
 	writeResends = 0;
 	readResends = 0;
@@ -181,6 +383,14 @@ SIRC_DLL_LINKAGE ETH_SIRC::ETH_SIRC(uint8_t *FPGA_ID, uint32_t driverVersion, wc
 	paramReadResends = 0;
 	resetResends = 0;
 	writeAndRunResends = 0;
+	writeWindowStalls = 0;
+	writeWindowCuts = 0;
+	jobFallbacks = 0;
+	readFastResends = 0;
+	backgroundResends = 0;
+	shadowBytesSkipped = 0;
+	registerWritesSkipped = 0;
+	registerReadsSkipped = 0;
 #endif
 
 	//Queue up a bunch of receives
@@ -209,14 +419,53 @@ ETH_SIRC::~ETH_SIRC(){
 	PRINTF(("Param Reg Write Resends = %d\n", paramWriteResends));
 	PRINTF(("Param Reg Read Resends = %d\n", paramReadResends));
 	PRINTF(("Write and Run Resends = %d\n", writeAndRunResends));
+	PRINTF(("Write Window Stalls = %d\n", writeWindowStalls));
+	PRINTF(("Smoothed Round Trip = %u usec (variance %u usec)\n", smoothedRoundTrip, roundTripVariance));
+	PRINTF(("Write Window = %u (cut %d times)\n", writeWindow, writeWindowCuts));
+	PRINTF(("Job Fallbacks = %d\n", jobFallbacks));
+	PRINTF(("Read Fast Resends = %d\n", readFastResends));
+	PRINTF(("Background Resends = %d\n", backgroundResends));
+	PRINTF(("Shadow Bytes Skipped = %d\n", shadowBytesSkipped));
+	PRINTF(("Register Writes Skipped = %d\n", registerWritesSkipped));
+	PRINTF(("Register Reads Skipped = %d\n", registerReadsSkipped));
+
+    //Let the I/O thread finish what was queued, then stop it.
+    //The exit request lives here, so stopping cannot run out of memory.
+    if (ioThread){
+        ASYNC_REQUEST exitRequest;
+        memset(&exitRequest, 0, sizeof(exitRequest));
+        exitRequest.op = ASYNC_EXIT;
+        queueAsyncRequest(&exitRequest);
+        WaitForSingleObject(ioThread, INFINITE);
+        CloseHandle(ioThread);
+        CloseHandle(asyncWakeup);
+    }
+
+    //Give the writes still in flight a chance to land
+    if (backgroundTransmits > 0)
+        (void) waitForBackgroundAcks(0);
+    DeleteCriticalSection(&asyncLock);
+    DeleteCriticalSection(&ioLock);
 
     delete PacketDriver;
+    delete [] requestRing;
+    delete [] backgroundRing;
 }
 
 //Dynamic parameters
 //Retrieve the active set of parameters and limits for this instance
 BOOL ETH_SIRC::getParameters(SIRC::PARAMETERS *outParameters, uint32_t maxOutLength)
 {
+	//Once the I/O thread is running it does the work, see forwardToIoThread
+	if(forwardToIoThread()){
+		ASYNC_REQUEST *request = newAsyncRequest(ASYNC_GETPARAMETERS);
+		if(!request)
+			return false;
+		request->out = outParameters;
+		request->length = maxOutLength;
+		return runOnIoThread(queueAsyncRequest(request));
+	}
+    IO_GUARD guard(this);
     SIRC::PARAMETERS params;
 
     params.myVersion            = SIRC_PARAMETERS_CURRENT_VERSION;
@@ -242,6 +491,16 @@ BOOL ETH_SIRC::getParameters(SIRC::PARAMETERS *outParameters, uint32_t maxOutLen
 //Modify the active set of parameters and limits for this instance
 BOOL ETH_SIRC::setParameters(const SIRC::PARAMETERS *inParameters, uint32_t length)
 {
+	//Once the I/O thread is running it does the work, see forwardToIoThread
+	if(forwardToIoThread()){
+		ASYNC_REQUEST *request = newAsyncRequest(ASYNC_SETPARAMETERS);
+		if(!request)
+			return false;
+		request->in = inParameters;
+		request->length = length;
+		return runOnIoThread(queueAsyncRequest(request));
+	}
+    IO_GUARD guard(this);
     //Sometimes you got to know what you are doing.
     if ((length < sizeof(*inParameters)) ||
         (inParameters->myVersion < SIRC_PARAMETERS_CURRENT_VERSION)){
@@ -270,6 +529,8 @@ BOOL ETH_SIRC::setParameters(const SIRC::PARAMETERS *inParameters, uint32_t leng
         setLastError(INVALIDLENGTH);
         return false;
     }
+    writeWindow = min(writeWindow, maxOutstandingWrites);
+    writeWindowThreshold = min(writeWindowThreshold, maxOutstandingWrites);
 
     
     maxInputDataBytes    = inParameters->maxInputDataBytes;
@@ -312,17 +573,20 @@ BOOL ETH_SIRC::setParameters(const SIRC::PARAMETERS *inParameters, uint32_t leng
 //Return true if write is successful.
 //If write fails for any reason, return false w/error code
 BOOL ETH_SIRC::sendWrite(uint32_t  startAddress, uint32_t length, uint8_t *buffer){
+	//Once the I/O thread is running it does the work, see forwardToIoThread
+	if(forwardToIoThread())
+		return runOnIoThread(sendWriteAsync(startAddress, length, buffer));
+	IO_GUARD guard(this);
 	//This function breaks the write request into packet-appropriate write commands.
-	//These write commands are sent in blocks of maxOutstandingWrites.
+	//These write commands are sent through a sliding window of writeWindow packets
+	// (at most maxOutstandingWrites), which grows and shrinks with the losses we see.
 	//Each write command is acknowledged when it has been received by the FPGA.
-	//After sending out maxOutstandingWrites write commands, we check to see which,
-	// if any commands have been acknowledged.  If they are not acknowledged in a 
-	// timely manner, we resend the write command.
-	//If any command is not acknowledged after MAXRETRIES attempts, we will
+	//Once the window is full, every ack we get back frees up a slot and the next
+	// write command goes out right away, so the link does not go idle between blocks.
+	//Every write command has its own retransmit timer.  If a command is not acknowledged
+	// in a timely manner, we resend just that write command.
+	//If any command is not acknowledged after MAXRETRIES resends, we will
 	// return false.
-	uint32_t currLength;
-	uint32_t numRetries;
-	
     LogIt("sirc:sw %u %u",startAddress, length);
 
 	setLastError(0);
@@ -342,15 +606,58 @@ BOOL ETH_SIRC::sendWrite(uint32_t  startAddress, uint32_t length, uint8_t *buffe
 		return false;
 	}
 
+#ifdef SHADOWINPUT
+	//Only send what the FPGA does not have already
+	return sendWriteThroughShadow(startAddress, length, buffer);
+#else
+	return sendWriteNow(startAddress, length, buffer);
+#endif
+}
+
+//Send a (checked) block of data to the input buffer on the FPGA, see sendWrite.
+//Return true if write is successful.
+//If write fails for any reason, return false w/error code
+BOOL ETH_SIRC::sendWriteNow(uint32_t  startAddress, uint32_t length, uint8_t *buffer){
+	uint32_t currLength;
+	BOOL flush;
+
+	//With transaction IDs we do not wait for the acks here
+	if(useTransactionIds)
+		return sendBackgroundWrite(startAddress, length, buffer);
+
 	while(length > 0){
 		//Break this write into MAXWRITESIZE sized chunks or smaller
-		if(length > MAXWRITESIZE)
-			currLength = MAXWRITESIZE;
+		if(length > MAXWRITESIZE(maxPacketSize))
+			currLength = MAXWRITESIZE(maxPacketSize);
 		else
 			currLength = length;
 
-		if(!createWriteRequestBackAndTransmit(startAddress, currLength, buffer,
-                                              currLength == length)){
+		//If the window is full, wait until (at least) one ack frees up a slot.
+		//The window might shrink while we wait, hence the loop.
+		//Callers that do not want to block here can use sendWriteAsync instead.
+		while(outstandingTransmits >= (int)writeWindow){
+			//Whatever is queued up goes out first
+			if(!postWriteBatch())
+				return bailOut(0);
+			DEBUG_ONLY(writeWindowStalls++;);
+			if(!waitForWriteAcks(writeWindow - 1))
+				return false;
+		}
+
+		//Post the queued up packets with the last packet, and with any packet that fills
+		// the window since we are about to block waiting for acks.
+		flush = (currLength == length) || (outstandingTransmits + 1 >= (int)writeWindow);
+#ifdef PACEWRITES
+		//Paced packets go out one at a time
+		paceWrite();
+		flush = true;
+#endif
+		if(!createWriteRequestBack(startAddress, currLength, buffer)){
+			//If we could not even build it, something is very wrong.
+            return bailOut(0);
+		}
+		writeBatch.push_back(currentPacket);
+		if(flush && !postWriteBatch()){
 			//If the send errored out, something is very wrong.
             return bailOut(0);
 		}
@@ -359,48 +666,160 @@ BOOL ETH_SIRC::sendWrite(uint32_t  startAddress, uint32_t length, uint8_t *buffe
 		buffer += currLength;
 		startAddress += currLength;
 		length -= currLength;
-
-		//See if we have too many outstanding messages (or if we are done transmitting).
-		//If so, we should scoreboard and check off any write acks we got back
-		//A better way to do this would have an independent thread take care of the
-		// scoreboarding, but synchronization might be very difficult
-		if(outstandingTransmits >= (int)maxOutstandingWrites || length == 0){
-			//Try to check writes off the scoreboard & resend outstanding packets up to N times
-			numRetries = 0;
-			for(;;){
-				//Try to receive acks for the outstanding writes
-				if(receiveWriteAcks())
-					//We got all of the acks back, so break out of the for(;;) and go to the next block of writes
-					break;
-
-                //Verify that receiveWriteAcks did not return false due to some error
-                // rather then just not getting back all of the acks we expected.
-                MAYBE_BAILOUT();
-
-                //Not all of the writes' acks came back, so re-send any outstanding writes that are still left outstanding
-                //However, don't resend anything if that was the last time around.
-                if(numRetries++ >= maxRetries){
-                    //We have resent too many times
-                    PRINTF(("Write resent too many times without acknowledgement!\n"));
-                    return bailOut(FAILWRITEACK);
-                }
-                else{
-                    LogIt("sirc::sw.retries %u",numRetries);
-                    if (!resendOutstandingPackets(INVALIDWRITETRANSMIT DEBUG_ONLY_2ARGS("Write",&writeResends))) {
-                        return false;
-                    }
-                }
-			}
-		}
 	}
 
+	//Everything is on the wire, now wait for the rest of the window to drain.
+	if(!waitForWriteAcks(0))
+		return false;
+
 	//Make sure that there are no outstanding packets
 	setLastError(0);
-	assert(outstandingPackets.empty());
+	assert(ringHead == ringTail);
 	assert(outstandingTransmits == 0);
 	return true;
 }
 
+//Send only the parts of a (checked) block of data that the FPGA does not have already,
+// as far as the input shadow knows.
+//Return true if write is successful.
+//If write fails for any reason, return false w/error code
+BOOL ETH_SIRC::sendWriteThroughShadow(uint32_t startAddress, uint32_t length, uint8_t *buffer){
+	uint32_t offset = 0;
+	uint32_t dirtyLength;
+
+	//(Re)size the shadow, nothing is known at first
+	if(inputShadow.size() != maxInputDataBytes){
+		inputShadow.assign(maxInputDataBytes, 0);
+		inputShadowValid.assign((maxInputDataBytes + 31) / 32, 0);
+	}
+
+	while(findDirtyRange(startAddress, length, buffer, &offset, &dirtyLength)){
+		//Until the write is acked we cannot tell what the FPGA has
+		invalidateShadowRange(startAddress + offset, dirtyLength);
+
+		if(!sendWriteNow(startAddress + offset, dirtyLength, buffer + offset))
+			return false;
+
+		updateInputShadow(startAddress + offset, dirtyLength, buffer + offset);
+		offset += dirtyLength;
+	}
+
+	setLastError(0);
+	return true;
+}
+
+//Find the next range of buffer, at or past *offset, that differs from the input shadow.
+//Clean runs shorter than SHADOWMERGEGAP are made part of the range.
+//Return true with the range in *offset and *dirtyLength, false if the rest is clean.
+BOOL ETH_SIRC::findDirtyRange(uint32_t startAddress, uint32_t length, const uint8_t *buffer,
+							  uint32_t *offset, uint32_t *dirtyLength){
+	uint32_t i = *offset;
+	uint32_t lastDirty;
+	uint32_t address;
+
+	//Skip what the FPGA has already
+	for(; i < length; i++){
+		address = startAddress + i;
+		if(!isShadowKnown(address) || inputShadow[address] != buffer[i])
+			break;
+	}
+	DEBUG_ONLY(shadowBytesSkipped += i - *offset;);
+	if(i == length){
+		*offset = length;
+		return false;
+	}
+
+	//Extend the range until the clean run gets long enough
+	*offset = i;
+	lastDirty = i;
+	for(i++; i < length && i - lastDirty < SHADOWMERGEGAP; i++){
+		address = startAddress + i;
+		if(!isShadowKnown(address) || inputShadow[address] != buffer[i])
+			lastDirty = i;
+	}
+
+	*dirtyLength = lastDirty + 1 - *offset;
+	return true;
+}
+
+//The FPGA now has buffer at startAddress.
+void ETH_SIRC::updateInputShadow(uint32_t startAddress, uint32_t length, const uint8_t *buffer){
+	memcpy(&inputShadow[startAddress], buffer, length);
+	for(uint32_t address = startAddress; address < startAddress + length; address++)
+		inputShadowValid[address >> 5] |= 1u << (address & 31);
+}
+
+//We no longer know what the FPGA has at startAddress.
+void ETH_SIRC::invalidateShadowRange(uint32_t startAddress, uint32_t length){
+	uint32_t endAddress;
+
+	if(inputShadow.empty() || startAddress >= inputShadow.size())
+		return;
+	endAddress = (uint32_t)min((size_t)startAddress + length, inputShadow.size());
+
+	for(uint32_t address = startAddress; address < endAddress; address++)
+		inputShadowValid[address >> 5] &= ~(1u << (address & 31));
+}
+
+//Forget what we know of the contents of the FPGA input buffer, see SHADOWINPUT.
+void ETH_SIRC::invalidateInputShadow(uint32_t startAddress, uint32_t length){
+	//Once the I/O thread is running it does the work, see forwardToIoThread
+	if(forwardToIoThread()){
+		runOnIoThread(ASYNC_INVALIDATESHADOW, startAddress, length);
+		return;
+	}
+	IO_GUARD guard(this);
+	invalidateShadowRange(startAddress, length);
+}
+
+//Tell us whether the FPGA changes a parameter register, see SHADOWREGISTERS.
+void ETH_SIRC::setParamRegisterVolatile(uint8_t regNumber, BOOL isVolatile){
+	//Once the I/O thread is running it does the work, see forwardToIoThread
+	if(forwardToIoThread()){
+		runOnIoThread(ASYNC_SETVOLATILE, regNumber, isVolatile);
+		return;
+	}
+	IO_GUARD guard(this);
+	//The execution signal always is
+	if(regNumber == 255)
+		return;
+	forgetRegister(regNumber);
+	if(isVolatile)
+		registerVolatile[regNumber >> 5] |= 1u << (regNumber & 31);
+	else
+		registerVolatile[regNumber >> 5] &= ~(1u << (regNumber & 31));
+}
+
+//Do we know what the FPGA has in this register?
+//If so return true, and the value in *value.
+//Not while a background write to it is still waiting for its ack.
+inline BOOL ETH_SIRC::isRegisterKnown(uint8_t regNumber, uint32_t *value){
+#ifdef SHADOWREGISTERS
+	if(backgroundRegisters[regNumber] != 0)
+		return false;
+	if(registerKnown[regNumber >> 5] & (1u << (regNumber & 31))){
+		*value = registerShadow[regNumber];
+		return true;
+	}
+#endif
+	return false;
+}
+
+//The FPGA now has value in this register (unless it is volatile).
+inline void ETH_SIRC::rememberRegister(uint8_t regNumber, uint32_t value){
+#ifdef SHADOWREGISTERS
+	if(registerVolatile[regNumber >> 5] & (1u << (regNumber & 31)))
+		return;
+	registerShadow[regNumber] = value;
+	registerKnown[regNumber >> 5] |= 1u << (regNumber & 31);
+#endif
+}
+
+//We no longer know what the FPGA has in this register.
+inline void ETH_SIRC::forgetRegister(uint8_t regNumber){
+	registerKnown[regNumber >> 5] &= ~(1u << (regNumber & 31));
+}
+
 //Read a block of data from the output buffer of the FPGA
 // startAddress: local address on FPGA output buffer to begin reading from
 // length: # of bytes to read
@@ -408,19 +827,54 @@ BOOL ETH_SIRC::sendWrite(uint32_t  startAddress, uint32_t length, uint8_t *buffe
 //Return true if read is successful.
 //If read fails for any reason, return false w/ error code
 BOOL ETH_SIRC::sendRead(uint32_t startAddress, uint32_t length, uint8_t *buffer){
+	//Once the I/O thread is running it does the work, see forwardToIoThread
+	if(forwardToIoThread())
+		return runOnIoThread(sendReadAsync(startAddress, length, buffer));
+	if(!buffer){
+		setLastError(INVALIDBUFFER);
+		return false;
+	}
+
+	return sendReadToSink(startAddress, length, copyToBuffer, buffer);
+}
+
+//Default sink, copy the data where it belongs in the buffer given to sendRead
+void ETH_SIRC::copyToBuffer(void *context, uint32_t offset, const uint8_t *data, uint32_t length){
+	memcpy((uint8_t *)context + offset, data, length);
+}
+
+//Read a block of data from the output buffer of the FPGA, handing each read response
+// to the sink straight out of the receive packet.
+// startAddress: local address on FPGA output buffer to begin reading from
+// length: # of bytes to read
+// sink: called with each piece of data as it arrives
+// context: passed along to sink
+//Return true if read is successful.
+//If read fails for any reason, return false w/ error code
+BOOL ETH_SIRC::sendReadToSink(uint32_t startAddress, uint32_t length, READ_SINK sink, void *context){
+	//Once the I/O thread is running it does the work, see forwardToIoThread
+	if(forwardToIoThread()){
+		ASYNC_REQUEST *request = newAsyncRequest(ASYNC_READTOSINK);
+		if(!request)
+			return false;
+		request->address = startAddress;
+		request->length = length;
+		request->sink = sink;
+		request->out = context;
+		return runOnIoThread(queueAsyncRequest(request));
+	}
+	IO_GUARD guard(this);
 	//This function sends this read request to the FPGA.
 	//The FPGA responds by breaking up the read request into packet-appropriate responses.
 	//If we receive all of the parts back from the read request, we directly return true.
-	//If not, we keep track of the parts we missed and re-send requests for those parts.
+	//If not, the bitmap tells us which parts we missed and we re-send requests for those parts.
 	//If we need to resend any part of the initial read request more than MAXRETRIES times,
 	// we will return false.
-	uint32_t numRetries;
-
     LogIt("sirc:sr %u %u",startAddress, length);
 
 	setLastError(0);
 
-	if(!buffer){
+	if(!sink){
 		setLastError(INVALIDBUFFER);
 		return false;
 	}
@@ -436,19 +890,20 @@ BOOL ETH_SIRC::sendRead(uint32_t startAddress, uint32_t length, uint8_t *buffer)
 	}
 
 	//Send the read request
+	startReadReassembly(startAddress, length);
 	if(!createReadRequestBackAndTransmit(startAddress, length)){
+		readChunkCount = 0;
 		return false;
 	}
 
 	//Now that we've sent out the read request, try to get back some responses.
-	numRetries = 0;
 	for(;;){
 		//Try to get back all of the read responses associated with the current outstanding
 		// read requests.  The first time through we will only have 1 request on the queue.
 		// However, for subsequent retries, this may be larger than 1.
 		//If we don't get back all of the reads we want, we will have all of the necessary resends
 		// sitting in the outstanding packet queue.
-		if(receiveReadResponses(startAddress, buffer))
+		if(receiveReadResponses(sink, context))
 			//All of the reads came back, so we are done
             break;
 
@@ -456,26 +911,16 @@ BOOL ETH_SIRC::sendRead(uint32_t startAddress, uint32_t length, uint8_t *buffer)
         // rather then just not getting back all of the read responses we expected.
         MAYBE_BAILOUT();
 
-        //Not all of the read replies came back, so we should send all of the packets on the outstanding list
-        // unless that was the last chance we had
-        if(numRetries++ >= maxRetries){
-            //We have resent too many times
-            PRINTF(("Read resent too many times without response!\n"));
-            return bailOut(FAILREADACK);
-        }
-        else{
-            //Transmit/re-transmit the packets in the outstanding list.
-            LogIt("sirc::sr.retries %u",numRetries);
-            if (!resendOutstandingPackets(INVALIDREADTRANSMIT DEBUG_ONLY_2ARGS("Read",&readResends))) {
-                return false;
-            }
+        //Transmit the requests for any missing pieces and re-transmit the requests that timed out,
+        // unless they have already been resent too many times.
+        if (!resendExpiredPackets(INVALIDREADTRANSMIT, FAILREADACK DEBUG_ONLY_2ARGS("Read",&readResends))) {
+            return false;
         }
 	}
 
+	readChunkCount = 0;
 	setLastError(0);
-	assert(outstandingPackets.empty());
-	assert(outstandingReadStartAddresses.empty());
-	assert(outstandingReadLengths.empty());
+	assert(ringHead == ringTail);
 	assert(outstandingTransmits == 0);
 	return true;
 }
@@ -487,8 +932,10 @@ BOOL ETH_SIRC::sendRead(uint32_t startAddress, uint32_t length, uint8_t *buffer)
 //If write fails for any reason, returns false.
 // Check error code with getLastError()
 BOOL ETH_SIRC::sendParamRegisterWrite(uint8_t regNumber, uint32_t value){
-	uint32_t numRetries;
-	
+	//Once the I/O thread is running it does the work, see forwardToIoThread
+	if(forwardToIoThread())
+		return runOnIoThread(sendParamRegisterWriteAsync(regNumber, value));
+	IO_GUARD guard(this);
 	setLastError(0);
 
 	if(!(regNumber < 255)){
@@ -496,13 +943,27 @@ BOOL ETH_SIRC::sendParamRegisterWrite(uint8_t regNumber, uint32_t value){
 		return false;
 	}
 
+	//The FPGA might have that value already
+	uint32_t knownValue;
+	if(isRegisterKnown(regNumber, &knownValue) && knownValue == value){
+		DEBUG_ONLY(registerWritesSkipped++;);
+		return true;
+	}
+
+	//Until the write is acked we cannot tell what the FPGA has
+	forgetRegister(regNumber);
+
+	//With transaction IDs we do not wait for the ack here, the value is remembered
+	// once it comes (see checkBackgroundAck)
+	if(useTransactionIds)
+		return sendBackgroundParamRegisterWrite(regNumber, value);
+
 	if(!createParamWriteRequestBackAndTransmit(regNumber, value)){
 		//If the send errored out, something is very wrong.
         return bailOut(getLastError());
 	}
 
 	//Try to check the write off.  Resend up to N times
-	numRetries = 0;
 	for(;;){
 		//Try to receive param write acks for the outstanding param write
 		if(receiveParamWriteAck())
@@ -513,25 +974,18 @@ BOOL ETH_SIRC::sendParamRegisterWrite(uint8_t regNumber, uint32_t value){
         // rather then just not getting back the ack we expected.
         MAYBE_BAILOUT();
 
-        //The param write ack didn't come back, so re-send the outstanding packet
-        //However, don't resend anything if that was the last time around.
-        if(numRetries++ >= maxRetries){
-            //We have resent too many times
-            PRINTF(("Param reg write resent too many times without acknowledgement!\n"));
-            return bailOut(FAILWRITEACK);
-        }
-        else{
-            LogIt("sirc::pw.retries %u",numRetries);
-            //NB: this is the same as iterating over the outstanding because there's just one.
-            if (!resendOutstandingPackets(INVALIDPARAMWRITETRANSMIT DEBUG_ONLY_2ARGS("ParamWrite",&paramWriteResends))) {
-                return false;
-            }
+        //The param write ack didn't come back in time, so re-send the outstanding packet
+        //However, don't resend anything if it has been resent too many times already.
+        //NB: this is the same as iterating over the outstanding because there's just one.
+        if (!resendExpiredPackets(INVALIDPARAMWRITETRANSMIT, FAILWRITEACK DEBUG_ONLY_2ARGS("ParamWrite",&paramWriteResends))) {
+            return false;
         }
 	}
 
+	rememberRegister(regNumber, value);
 	setLastError(0);
 	//Make sure that there are no outstanding packets
-	assert(outstandingPackets.empty());
+	assert(ringHead == ringTail);
 	assert(outstandingTransmits == 0);
 	return true;
 }
@@ -543,8 +997,10 @@ BOOL ETH_SIRC::sendParamRegisterWrite(uint8_t regNumber, uint32_t value){
 //If read fails for any reason, returns false.
 // Check error code with getLastError().
 BOOL ETH_SIRC::sendParamRegisterRead(uint8_t regNumber, uint32_t *value){
-	uint32_t numRetries;
-	
+	//Once the I/O thread is running it does the work, see forwardToIoThread
+	if(forwardToIoThread())
+		return runOnIoThread(sendParamRegisterReadAsync(regNumber, value));
+	IO_GUARD guard(this);
 	setLastError(0);
 
 	if(!(regNumber < 255)){
@@ -552,13 +1008,22 @@ BOOL ETH_SIRC::sendParamRegisterRead(uint8_t regNumber, uint32_t *value){
 		return false;
 	}
 
-	if(!createParamReadRequestBackAndTransmit(regNumber)){
+	//No need to ask if nobody but us changes it
+	if(isRegisterKnown(regNumber, value)){
+		DEBUG_ONLY(registerReadsSkipped++;);
+		return true;
+	}
+
+	//A write to this register still in flight has to land first
+	if(backgroundRegisters[regNumber] && !waitForBackgroundAcks(0))
+		return false;
+
+	if(!createParamReadRequestBackAndTransmit(regNumber, retransmitTimeout(readTimeout), readTimeout)){
 		//If the send errored out, something is very wrong.
         return bailOut(getLastError());
 	}
 
 	//Try to check the read off.  Resend up to N times
-	numRetries = 0;
 	for(;;){
 		//Try to receive param read response for the outstanding param read
 		if(receiveParamReadResponse(value, readTimeout))
@@ -569,25 +1034,256 @@ BOOL ETH_SIRC::sendParamRegisterRead(uint8_t regNumber, uint32_t *value){
         // rather then just not getting back the ack we expected.
         MAYBE_BAILOUT();
 
-        //The param read response didn't come back, so re-send the outstanding packet
-        //However, don't resend anything if that was the last time around.
-        if(numRetries++ >= maxRetries){
-            //We have resent too many times
-            PRINTF(("Param reg read resent too many times without acknowledgement!\n"));
-            return bailOut(FAILREADACK);
-        }
-        else{
-            LogIt("sirc::pr.retries %u",numRetries);
-            //NB: this is the same as iterating over the outstanding because there's just one.
-            if (!resendOutstandingPackets(INVALIDPARAMREADTRANSMIT DEBUG_ONLY_2ARGS("ParamRead",&paramReadResends))) {
-                return false;
-            }
+        //The param read response didn't come back in time, so re-send the outstanding packet
+        //However, don't resend anything if it has been resent too many times already.
+        //NB: this is the same as iterating over the outstanding because there's just one.
+        if (!resendExpiredPackets(INVALIDPARAMREADTRANSMIT, FAILREADACK DEBUG_ONLY_2ARGS("ParamRead",&paramReadResends))) {
+            return false;
         }
 	}
 
 	setLastError(0);
 	//Make sure that there are no outstanding packets
-	assert(outstandingPackets.empty());
+	assert(ringHead == ringTail);
+	assert(outstandingTransmits == 0);
+	return true;
+}
+
+//Send several 32-bit values from the PC to the parameter register file on the FPGA
+// count: # of registers to write
+// regNumbers: registers to which values should be sent (each between 0 and 254)
+// values: values to be written, values[i] goes to register regNumbers[i]
+//Up to MAXPARAMBATCH registers go out in one 'K' command, with a single ack.
+//The first batch only waits NEGOTIATETIMEOUT for the ack.  If none comes but the registers
+// go through one at a time, the FPGA does not know the batch commands and from then on
+// gets every batch one register at a time.
+//Return true if all writes are successful.
+//If any write fails for any reason, return false w/error code
+BOOL ETH_SIRC::sendParamRegisterWriteBatch(uint32_t count, const uint8_t *regNumbers, const uint32_t *values){
+	//Once the I/O thread is running it does the work, see forwardToIoThread
+	if(forwardToIoThread()){
+		ASYNC_REQUEST *request = newAsyncRequest(ASYNC_PARAMWRITEBATCH);
+		if(!request)
+			return false;
+		request->length = count;
+		request->regNumbers = regNumbers;
+		request->values = values;
+		return runOnIoThread(queueAsyncRequest(request));
+	}
+	IO_GUARD guard(this);
+	uint32_t currCount;
+	uint32_t knownValue;
+	BOOL probing;
+	std::vector <uint8_t> dirtyNumbers;
+	std::vector <uint32_t> dirtyValues;
+
+	setLastError(0);
+
+	if(!regNumbers || !values){
+		setLastError(INVALIDBUFFER);
+		return false;
+	}
+
+	for(uint32_t i = 0; i < count; i++){
+		if(!(regNumbers[i] < 255)){
+			setLastError(INVALIDADDRESS);
+			return false;
+		}
+	}
+
+	//Leave out the registers that have that value already.
+	//Until the writes are acked we cannot tell what the FPGA has in the others.
+	for(uint32_t i = 0; i < count; i++){
+		if(isRegisterKnown(regNumbers[i], &knownValue) && knownValue == values[i]){
+			DEBUG_ONLY(registerWritesSkipped++;);
+			continue;
+		}
+		forgetRegister(regNumbers[i]);
+		dirtyNumbers.push_back(regNumbers[i]);
+		dirtyValues.push_back(values[i]);
+	}
+	if(dirtyNumbers.empty())
+		return true;
+	count = (uint32_t)dirtyNumbers.size();
+	regNumbers = &dirtyNumbers[0];
+	values = &dirtyValues[0];
+
+	//Everything written so far has to be in place first
+	if(!waitForBackgroundAcks(0))
+		return false;
+
+	while(count > 0){
+		currCount = min(count, (uint32_t)MAXPARAMBATCH);
+
+		if(batchRegistersKnown && !useBatchRegisters)
+			return SIRC::sendParamRegisterWriteBatch(count, regNumbers, values);
+		probing = !batchRegistersKnown;
+
+		if(!createParamWriteBatchRequestBackAndTransmit(currCount, regNumbers, values,
+														(probing) ? NEGOTIATETIMEOUT : retransmitTimeout(writeTimeout),
+														(probing) ? 0 : writeTimeout)){
+			//If the send errored out, something is very wrong.
+			return bailOut(getLastError());
+		}
+
+		//Try to check the write off.  Resend up to N times
+		for(;;){
+			if(receiveParamWriteBatchAck())
+				break;
+
+			//Verify that receiveParamWriteBatchAck did not return false due to some error
+			// rather then just not getting back the ack we expected.
+			MAYBE_BAILOUT();
+
+			//The ack didn't come back in time, so re-send the outstanding packet
+			if (!resendExpiredPackets(INVALIDPARAMWRITETRANSMIT, (probing) ? 0 : FAILWRITEACK DEBUG_ONLY_2ARGS("ParamWriteBatch",&paramWriteResends))) {
+				if(!probing)
+					return false;
+				MAYBE_BAILOUT();
+
+				//Does the FPGA answer at all?
+				if(!SIRC::sendParamRegisterWriteBatch(count, regNumbers, values))
+					return false;
+				PRINTF(("No answer to batch register write, using single writes\n"));
+				batchRegistersKnown = true;
+				useBatchRegisters = false;
+				return true;
+			}
+		}
+		batchRegistersKnown = true;
+		useBatchRegisters = true;
+
+		//In order, the last write to a register wins
+		for(uint32_t i = 0; i < currCount; i++)
+			rememberRegister(regNumbers[i], values[i]);
+
+		regNumbers += currCount;
+		values += currCount;
+		count -= currCount;
+	}
+
+	setLastError(0);
+	//Make sure that there are no outstanding packets
+	assert(ringHead == ringTail);
+	assert(outstandingTransmits == 0);
+	return true;
+}
+
+//Read several 32-bit values from the parameter register file on the FPGA back to the PC
+// count: # of registers to read
+// regNumbers: registers which should be read (each between 0 and 254)
+// values: values received from FPGA, values[i] comes from register regNumbers[i]
+//Up to MAXPARAMBATCH registers are read with one 'Y' command and come back in one response.
+//FPGAs that do not know the batch commands get the registers read one at a time,
+// see sendParamRegisterWriteBatch.
+//Return true if all reads are successful.
+//If any read fails for any reason, return false w/error code
+BOOL ETH_SIRC::sendParamRegisterReadBatch(uint32_t count, const uint8_t *regNumbers, uint32_t *values){
+	//Once the I/O thread is running it does the work, see forwardToIoThread
+	if(forwardToIoThread()){
+		ASYNC_REQUEST *request = newAsyncRequest(ASYNC_PARAMREADBATCH);
+		if(!request)
+			return false;
+		request->length = count;
+		request->regNumbers = regNumbers;
+		request->valueP = values;
+		return runOnIoThread(queueAsyncRequest(request));
+	}
+	IO_GUARD guard(this);
+	uint32_t currCount;
+	BOOL probing;
+	std::vector <uint8_t> unknownNumbers;
+	std::vector <uint32_t> unknownValues;
+	std::vector <uint32_t> unknownIndices;
+
+	setLastError(0);
+
+	if(!regNumbers || !values){
+		setLastError(INVALIDBUFFER);
+		return false;
+	}
+
+	for(uint32_t i = 0; i < count; i++){
+		if(!(regNumbers[i] < 255)){
+			setLastError(INVALIDADDRESS);
+			return false;
+		}
+	}
+
+	//Only ask for the registers we do not know.  If that is some of them, they are read
+	// as a batch of their own and put in place.
+	for(uint32_t i = 0; i < count; i++){
+		if(isRegisterKnown(regNumbers[i], &values[i])){
+			DEBUG_ONLY(registerReadsSkipped++;);
+			continue;
+		}
+		unknownNumbers.push_back(regNumbers[i]);
+		unknownIndices.push_back(i);
+	}
+	if(unknownNumbers.empty())
+		return true;
+	if(unknownNumbers.size() < count){
+		unknownValues.resize(unknownNumbers.size());
+		if(!sendParamRegisterReadBatch((uint32_t)unknownNumbers.size(), &unknownNumbers[0], &unknownValues[0]))
+			return false;
+		for(uint32_t i = 0; i < unknownIndices.size(); i++)
+			values[unknownIndices[i]] = unknownValues[i];
+		return true;
+	}
+
+	//Everything written so far has to be in place first
+	if(!waitForBackgroundAcks(0))
+		return false;
+
+	while(count > 0){
+		currCount = min(count, (uint32_t)MAXPARAMBATCH);
+
+		if(batchRegistersKnown && !useBatchRegisters)
+			return SIRC::sendParamRegisterReadBatch(count, regNumbers, values);
+		probing = !batchRegistersKnown;
+
+		if(!createParamReadBatchRequestBackAndTransmit(currCount, regNumbers,
+													   (probing) ? NEGOTIATETIMEOUT : retransmitTimeout(readTimeout),
+													   (probing) ? 0 : readTimeout)){
+			//If the send errored out, something is very wrong.
+			return bailOut(getLastError());
+		}
+
+		//Try to check the read off.  Resend up to N times
+		for(;;){
+			if(receiveParamReadBatchResponse(values))
+				break;
+
+			//Verify that receiveParamReadBatchResponse did not return false due to some error
+			// rather then just not getting back the response we expected.
+			MAYBE_BAILOUT();
+
+			//The response didn't come back in time, so re-send the outstanding packet
+			if (!resendExpiredPackets(INVALIDPARAMREADTRANSMIT, (probing) ? 0 : FAILREADACK DEBUG_ONLY_2ARGS("ParamReadBatch",&paramReadResends))) {
+				if(!probing)
+					return false;
+				MAYBE_BAILOUT();
+
+				//Does the FPGA answer at all?
+				if(!SIRC::sendParamRegisterReadBatch(count, regNumbers, values))
+					return false;
+				PRINTF(("No answer to batch register read, using single reads\n"));
+				batchRegistersKnown = true;
+				useBatchRegisters = false;
+				return true;
+			}
+		}
+		batchRegistersKnown = true;
+		useBatchRegisters = true;
+
+		regNumbers += currCount;
+		values += currCount;
+		count -= currCount;
+	}
+
+	setLastError(0);
+	//Make sure that there are no outstanding packets
+	assert(ringHead == ringTail);
 	assert(outstandingTransmits == 0);
 	return true;
 }
@@ -597,17 +1293,22 @@ BOOL ETH_SIRC::sendParamRegisterRead(uint8_t regNumber, uint32_t *value){
 //If signal is not raised for any reason, returns false.
 // Check error code with getLastError()
 BOOL ETH_SIRC::sendRun(){
-	uint32_t numRetries;
-	
+	//Once the I/O thread is running it does the work, see forwardToIoThread
+	if(forwardToIoThread())
+		return runOnIoThread(sendRunAsync());
+	IO_GUARD guard(this);
 	setLastError(0);
 
+	//Everything written so far has to be in place first
+	if(!waitForBackgroundAcks(0))
+		return false;
+
 	if(!createParamWriteRequestBackAndTransmit(255, 1)){
 		//If the send errored out, something is very wrong.
         return bailOut(getLastError());
 	}
 
 	//Try to check the write off.  Resend up to N times
-	numRetries = 0;
 	for(;;){
 		//Try to receive param write acks for the outstanding param write
 		if(receiveParamWriteAck())
@@ -618,25 +1319,17 @@ BOOL ETH_SIRC::sendRun(){
         // rather then just not getting back the ack we expected.
         MAYBE_BAILOUT();
 
-        //The param write ack didn't come back, so re-send the outstanding packet
-        //However, don't resend anything if that was the last time around.
-        if(numRetries++ >= maxRetries){
-            //We have resent too many times
-            PRINTF(("Run signal resent too many times without acknowledgement!\n"));
-            return bailOut(FAILWRITEACK);
-        }
-        else{
-            LogIt("sirc::r.retries %u",numRetries);
-            //NB: this is the same as iterating over the outstanding because there's just one.
-            if (!resendOutstandingPackets(INVALIDPARAMWRITETRANSMIT DEBUG_ONLY_2ARGS("Run",&paramWriteResends))) {
-                return false;
-            }
+        //The param write ack didn't come back in time, so re-send the outstanding packet
+        //However, don't resend anything if it has been resent too many times already.
+        //NB: this is the same as iterating over the outstanding because there's just one.
+        if (!resendExpiredPackets(INVALIDPARAMWRITETRANSMIT, FAILWRITEACK DEBUG_ONLY_2ARGS("Run",&paramWriteResends))) {
+            return false;
         }
 	}
 
 	setLastError(0);
 	//Make sure that there are no outstanding packets
-	assert(outstandingPackets.empty());
+	assert(ringHead == ringTail);
 	assert(outstandingTransmits == 0);
 	return true;
 }
@@ -647,23 +1340,40 @@ BOOL ETH_SIRC::sendRun(){
 //If function fails for any reason, returns false.
 // Check error code with getLastError().
 BOOL ETH_SIRC::waitDone(uint32_t maxWaitTimeInMsec){
+	//Once the I/O thread is running it does the work, see forwardToIoThread
+	if(forwardToIoThread())
+		return runOnIoThread(waitDoneAsync(maxWaitTimeInMsec));
+	IO_GUARD guard(this);
 	uint32_t value;
+	uint32_t startTime = GetTickCount();
+	uint32_t elapsed = 0;
+	uint32_t timeout;
+	uint32_t pollInterval = MINDONEPOLLINTERVAL;
 
 	setLastError(0);
 
+	//Everything written so far has to be in place first
+	if(!waitForBackgroundAcks(0))
+		return false;
+
 	for(;;){
+		//The last poll still gets a fair chance to be answered
+		timeout = (elapsed < maxWaitTimeInMsec) ? maxWaitTimeInMsec - elapsed : 0;
+		timeout = max(timeout, retransmitTimeout(readTimeout));
+
 		//Send out the read
-		if(!createParamReadRequestBackAndTransmit(255)){
+		//Some FPGAs only answer once they are done, so no round trip timing here
+		if(!createParamReadRequestBackAndTransmit(255, timeout, 0)){
 			//If the send errored out, something is very wrong.
             return bailOut(getLastError());
 		}
 
 		//Try to get the read back
-		if(!receiveParamReadResponse(&value, maxWaitTimeInMsec)){
-			//If receiveParamReadResponse timed out, replace the
-			// error code with FAILWAITACK
+		if(!receiveParamReadResponse(&value, timeout)){
+			//If receiveParamReadResponse timed out, use the
+			// error code FAILWAITACK
             int8_t err = getLastError();
-			if(err == FAILREADACK){
+			if(err == 0){
                 //The param read response didn't come back in time, so error out
 				PRINTF(("Wait done response didn't come back in time!\n"));
 				err = FAILWAITACK;
@@ -678,10 +1388,23 @@ BOOL ETH_SIRC::waitDone(uint32_t maxWaitTimeInMsec){
             setLastError(0);
 
             //Make sure that there are no outstanding packets
-            assert(outstandingPackets.empty());
+            assert(ringHead == ringTail);
             assert(outstandingTransmits == 0);
             return true;
         }
+
+        //Still running.  Out of time?
+        elapsed = GetTickCount() - startTime;
+        if(elapsed >= maxWaitTimeInMsec)
+            break;
+
+        //Sit quietly until the FPGA tells us it is done, or until the next poll.
+        //Either way we go back and read the run register.
+        (void) receiveDoneNotification(min(pollInterval, maxWaitTimeInMsec - elapsed));
+        MAYBE_BAILOUT();
+        pollInterval = min(2 * pollInterval, (uint32_t)MAXDONEPOLLINTERVAL);
+
+        elapsed = GetTickCount() - startTime;
 	}
 
 	setLastError(FAILDONE);
@@ -694,17 +1417,30 @@ BOOL ETH_SIRC::waitDone(uint32_t maxWaitTimeInMsec){
 //If the reset command is refused for any reason, returns false.
 // Check error code with getLastError()
 BOOL ETH_SIRC::sendReset(){
-	uint32_t numRetries;
-	
+	//Once the I/O thread is running it does the work, see forwardToIoThread
+	if(forwardToIoThread()){
+		ASYNC_REQUEST *request = newAsyncRequest(ASYNC_RESET);
+		if(!request)
+			return false;
+		return runOnIoThread(queueAsyncRequest(request));
+	}
+	IO_GUARD guard(this);
 	setLastError(0);
 
+	//Everything written so far has to be in place first
+	if(!waitForBackgroundAcks(0))
+		return false;
+
+	//Who knows what the user circuit does on reset
+	invalidateShadowRange(0, maxInputDataBytes);
+	memset(registerKnown, 0, sizeof(registerKnown));
+
 	if(!createResetRequestAndTransmit()){
 		//If the send errored out, something is very wrong.
         return bailOut(getLastError());
 	}
 
 	//Try to check the reset off.  Resend up to N times
-	numRetries = 0;
 	for(;;){
 		//Try to receive reset acknowledge
 		if(receiveResetAck())
@@ -715,29 +1451,113 @@ BOOL ETH_SIRC::sendReset(){
         // rather then just not getting back the ack we expected.
         MAYBE_BAILOUT();
 
-        //The reset response didn't come back, so re-send the outstanding packet
-        //However, don't resend anything if that was the last time around.
-        if(numRetries++ >= maxRetries){
-            //We have resent too many times
-            PRINTF(("Reset resent too many times without acknowledgement!\n"));
-            return bailOut(FAILRESETACK);
-        }
-        else{
-            LogIt("sirc::R.retries %u",numRetries);
-            //NB: this is the same as iterating over the outstanding because there's just one.
-            if (!resendOutstandingPackets(INVALIDRESETTRANSMIT DEBUG_ONLY_2ARGS("Reset",&resetResends))) {
-                return false;
-            }
+        //The reset response didn't come back in time, so re-send the outstanding packet
+        //However, don't resend anything if it has been resent too many times already.
+        //NB: this is the same as iterating over the outstanding because there's just one.
+        if (!resendExpiredPackets(INVALIDRESETTRANSMIT, FAILRESETACK DEBUG_ONLY_2ARGS("Reset",&resetResends))) {
+            return false;
         }
 	}
 
+	//The reset also put the FPGA back to standard frames, see if we can do better.
+	if(!negotiateFrameSize()){
+		return false;
+	}
+
+	//Same for transaction IDs
+	if(!negotiateTransactionIds()){
+		return false;
+	}
+
 	setLastError(0);
 	//Make sure that there are no outstanding packets
-	assert(outstandingPackets.empty());
+	assert(ringHead == ringTail);
 	assert(outstandingTransmits == 0);
 	return true;
 }
 
+//Agree with the FPGA on the largest frame we will use.
+//We propose the largest frame our NIC can take, the FPGA answers with the largest
+// one it is willing to use (no larger than ours).
+//FPGAs that do not know about jumbo frames ignore the request. If we get no answer
+// we quietly stay with standard frames, this is not an error.
+//Returns false w/error code only if something is very wrong.
+BOOL ETH_SIRC::negotiateFrameSize(){
+	uint32_t frameSize;
+
+	//Until told otherwise, standard frames only.
+	maxPacketSize = MAXPACKETSIZE;
+
+	//Nothing to talk about?
+	if(nicFrameSize <= MAXPACKETSIZE)
+		return true;
+
+	if(!createFrameSizeRequestAndTransmit(nicFrameSize)){
+		//If the send errored out, something is very wrong.
+        return bailOut(getLastError());
+	}
+
+	for(;;){
+		//Try to receive the FPGA's answer
+		if(receiveFrameSizeResponse(&frameSize, NEGOTIATETIMEOUT))
+			break;
+
+        //Verify that receiveFrameSizeResponse did not return false due to some error
+        // rather then just not getting back the answer we expected.
+        MAYBE_BAILOUT();
+
+        //Re-send the request a few times, then give up without complaining.
+        if (!resendExpiredPackets(INVALIDFRAMESIZETRANSMIT, 0 DEBUG_ONLY_2ARGS("FrameSize",&resetResends))) {
+            MAYBE_BAILOUT();
+            PRINTF(("No answer to frame size request, using standard frames\n"));
+            return true;
+        }
+	}
+
+	//Take whatever the FPGA is comfortable with, within reason.
+	if(frameSize > MAXPACKETSIZE && frameSize <= nicFrameSize)
+		maxPacketSize = frameSize;
+	PRINTF(("Using %u byte frames\n", maxPacketSize));
+	return true;
+}
+
+//Ask the FPGA whether it takes transaction IDs (only if built with TRANSACTIONIDS).
+//FPGAs that do not know about them ignore the request. If we get no answer we quietly
+// keep waiting for every ack before moving on, this is not an error.
+//Returns false w/error code only if something is very wrong.
+BOOL ETH_SIRC::negotiateTransactionIds(){
+	//Until told otherwise, no transaction IDs.
+	useTransactionIds = false;
+
+#ifdef TRANSACTIONIDS
+	if(!createTransactionIdRequestAndTransmit()){
+		//If the send errored out, something is very wrong.
+        return bailOut(getLastError());
+	}
+
+	for(;;){
+		//Try to receive the FPGA's answer
+		if(receiveTransactionIdResponse(NEGOTIATETIMEOUT))
+			break;
+
+        //Verify that receiveTransactionIdResponse did not return false due to some error
+        // rather then just not getting back the answer we expected.
+        MAYBE_BAILOUT();
+
+        //Re-send the request a few times, then give up without complaining.
+        if (!resendExpiredPackets(INVALIDTRANSACTIONIDTRANSMIT, 0 DEBUG_ONLY_2ARGS("TransactionId",&resetResends))) {
+            MAYBE_BAILOUT();
+            PRINTF(("No answer to transaction ID request, not using them\n"));
+            return true;
+        }
+	}
+
+	useTransactionIds = true;
+	PRINTF(("Using transaction IDs\n"));
+#endif
+	return true;
+}
+
 
 //Send a block of data to the FPGA, raise the execution signal, wait for the execution
 // signal to be lowered, then read back up to values of results
@@ -766,6 +1586,10 @@ BOOL ETH_SIRC::sendReset(){
 BOOL ETH_SIRC::sendWriteAndRun(uint32_t startAddress, uint32_t inLength, uint8_t *inData, 
 							  uint32_t maxWaitTimeInMsec, uint8_t *outData, uint32_t maxOutLength, 
 							  uint32_t *outputLength){
+	//Once the I/O thread is running it does the work, see forwardToIoThread
+	if(forwardToIoThread())
+		return runOnIoThread(sendWriteAndRunAsync(startAddress, inLength, inData, maxWaitTimeInMsec, outData, maxOutLength, outputLength));
+	IO_GUARD guard(this);
 	uint32_t numPackets;
 	uint32_t currLength;
 	uint32_t numRetries;
@@ -786,6 +1610,9 @@ BOOL ETH_SIRC::sendWriteAndRun(uint32_t startAddress, uint32_t inLength, uint8_t
 		return false;
 	}
 
+	//The input might be written any number of times, and the run changes things.
+	invalidateShadowRange(startAddress, inLength);
+
 	//Check the output parameters
 	if(!outData){
 		setLastError(INVALIDBUFFER);
@@ -796,24 +1623,25 @@ BOOL ETH_SIRC::sendWriteAndRun(uint32_t startAddress, uint32_t inLength, uint8_t
 		return false;
 	}
 
-	//Try to send the data to the FPGA
-	//First break the write request into packet-appropriate write commands.
-	//The first N are sent using the normal write command, the last one is sent using the
-	// write and execute command.
-	//Determine how many packets are we going to need to send.
-	//This division will round down to the next integer
-	numPackets = inLength / MAXWRITESIZE;
-	if(inLength % MAXWRITESIZE == 0){
-		//If the length of the input buffer fits exactly into N packets, let's send 1 less
-		numPackets--;
-	}
-	currLength = numPackets * MAXWRITESIZE;
-
 	//There are 3 phases to this function: write initial data to FPGA, send last write & run packet,
 	// wait for data to come back.
 	//Aside from the normal, unrecoverable problems that can occur (invalid parameters,
 	// memory allocation fail, etc), there are four types of "recoverable" errors that can happen.
 	for (numRetries = 0; numRetries < maxRetries;){
+		//Try to send the data to the FPGA
+		//First break the write request into packet-appropriate write commands.
+		//The first N are sent using the normal write command, the last one is sent using the
+		// write and execute command.
+		//Determine how many packets are we going to need to send.
+		//This is in the loop because a retry resets the FPGA, which might change the frame size.
+		//This division will round down to the next integer
+		numPackets = inLength / MAXWRITESIZE(maxPacketSize);
+		if(inLength % MAXWRITESIZE(maxPacketSize) == 0){
+			//If the length of the input buffer fits exactly into N packets, let's send 1 less
+			numPackets--;
+		}
+		currLength = numPackets * MAXWRITESIZE(maxPacketSize);
+
 		//Write the initial part of the data to the FPGA
 		//We want all of the initial writes to be send and acknowledged before we send the write & run command.
 		//This is in the while() loop because we don't know if the execution is destructive.
@@ -828,6 +1656,11 @@ BOOL ETH_SIRC::sendWriteAndRun(uint32_t startAddress, uint32_t inLength, uint8_t
 			}
 		}
 
+		//Make sure every write so far has been acked, sendWrite might have left them in flight.
+		if(!waitForBackgroundAcks(0)){
+			return false;
+		}
+
 		//Now we want to send the last packet out via a write & run command.
 		if(!createWriteAndRunRequestBackAndTransmit(startAddress + currLength, inLength - currLength, inData + currLength)){
 			//If the send errored out, something is very wrong.
@@ -867,41 +1700,44 @@ BOOL ETH_SIRC::sendWriteAndRun(uint32_t startAddress, uint32_t inLength, uint8_t
         if(getLastError() == FAILWRITEANDRUNREADACK){
             //Error #4: We missed some response.
             //		The receiveWriteAndRunAcks function has already set outputLength to the total length of the response and
-            //		filled in requests for the missing part into outstandingPackets, outstandingReadStartAddresses and 
-            //		outstandingReadLengths.  Thus, all we have to do is just resend them, if we have not retried too many times
+            //		filled in requests for the missing part into the scoreboard (they have not gone out yet).
+            //		Thus, all we have to do is read those parts back like any other read, which retries
+            //		them as needed.
             //		Once we get into this state, don't reenter the outer while loop.  At this point
             //		we can only return true, false with FAILWRITEANDRUNCAPACITY/FAILREADACK, or false with some fatal error.
             //		Stated another way, we don't want to try resending the entire write and run command again.
+            std::vector <REQUEST> missing;
+
             setLastError(0);
-				
-            while(numRetries < maxRetries){
-                LogIt("sirc::war.retries %u",numRetries);
-                if (!resendOutstandingPackets(INVALIDREADTRANSMIT DEBUG_ONLY_2ARGS("WriteAndRun",&writeAndRunResends)))
-                    return false;
+            for(uint32_t i = ringHead; i != ringTail; i++){
+                REQUEST *request = requestAt(i);
+                if(request->packet == NULL)
+                    continue;
+                missing.push_back(*request);
+                markPacketAcked(request->packet);
+                removeRequest(i);
+            }
 
-                numRetries++;
-
-                //Try to get the reads back
-                if(receiveReadResponses(0, outData)){
-                    //We got back all of the outstanding reads
-                    if(okCapacity){
-                        setLastError(0);
-                        return true;
-                    }
-                    else{
-                        setLastError(FAILWRITEANDRUNCAPACITY);
-                        return false;
-                    }	
-                }
+            for(size_t i = 0; i < missing.size(); i++){
+                //Nothing to read past the end of the output buffer
+                if(missing[i].startAddress >= maxOutLength)
+                    continue;
+                missing[i].length = min(missing[i].length, maxOutLength - missing[i].startAddress);
 
-                //Verify that receiveReadData did not return false due to some error
-                // rather then just not getting back all of the read responses we expected.
-                MAYBE_BAILOUT();
+                if(!sendRead(missing[i].startAddress, missing[i].length, outData + missing[i].startAddress)){
+                    if(getLastError() == FAILREADACK)
+                        setLastError(FAILWRITEANDRUNREADACK);
+                    return false;
+                }
             }
 
-            //We have resent too many times
-            PRINTF(("Write and run resent too many times without response!\n"));
-            return bailOut(FAILWRITEANDRUNREADACK);
+            //We got back all of the missing reads
+            if(okCapacity){
+                setLastError(0);
+                return true;
+            }
+            setLastError(FAILWRITEANDRUNCAPACITY);
+            return false;
         }
 
         //Some other, unrecoverable problem might have occured.  In that case, we enter the normal
@@ -914,21 +1750,612 @@ BOOL ETH_SIRC::sendWriteAndRun(uint32_t startAddress, uint32_t inLength, uint8_t
 	return bailOut(FAILWRITEACK);
 }
 
+//Write the inputs and parameter registers of a job, raise the execution signal, wait for
+// the execution signal to be lowered, then read back the outputs.
+//Returns true if entire process is successful.
+//If function fails for any reason, returns false.
+// Check error code with getLastError().
+BOOL ETH_SIRC::submitJob(const SIRC::JOB *job){
+	//Once the I/O thread is running it does the work, see forwardToIoThread
+	if(forwardToIoThread()){
+		ASYNC_REQUEST *request = newAsyncRequest(ASYNC_SUBMITJOB);
+		if(!request)
+			return false;
+		request->in = job;
+		return runOnIoThread(queueAsyncRequest(request));
+	}
+	IO_GUARD guard(this);
+	//This function sends everything up to the run as one train of packets: the input writes
+	// (through the write window), the parameter registers (as batch writes if the FPGA takes
+	// them), the run command and a read of the run register.  The FPGA handles commands in
+	// order, so the read of the run register is answered once execution is over (or right
+	// away, with the execution signal still raised, by an FPGA that does not hold the response).
+	//We then collect the acks for the whole train at once.
+	//The outputs are only requested after that, since the FPGA might not let us read
+	// the output buffer while it is still running.
+	//If anything is lost after the run went out we wait for the run register read, and then
+	// go by the acks that did come back.  If the run and everything before it got through,
+	// only the outputs are left to read.  Otherwise we cannot tell whether the FPGA ran, or
+	// ran with all of its inputs, and we fail rather than run the job a second time.
+	const SIRC::JOB_SEGMENT *segment;
+	PACKET *Packet;
+	uint32_t startTime = GetTickCount();
+	uint32_t elapsed;
+	uint32_t doneTimeout;
+	uint32_t startAddress;
+	uint32_t length;
+	uint32_t currLength;
+	uint32_t count;
+	uint8_t *buffer;
+	const uint8_t *regNumbers;
+	const uint32_t *regValues;
+	uint32_t value;
+	BOOL gotDone = false;
+	BOOL runAcked = false;
+	BOOL registersSent = false;
+	int lost;
+
+    LogIt("sirc:sj %u %u",job ? job->numInputs : 0, job ? job->numOutputs : 0);
+
+	setLastError(0);
+
+	if(!checkJob(job))
+		return false;
+
+	//The inputs might be written any number of times, and the run changes things.
+	for(uint32_t i = 0; i < job->numInputs; i++)
+		invalidateShadowRange(job->inputs[i].startAddress, job->inputs[i].length);
+	for(uint32_t i = 0; i < job->numRegisters; i++)
+		forgetRegister(job->regNumbers[i]);
+
+	//Everything written so far has to be in place first
+	if(!waitForBackgroundAcks(0))
+		return false;
+
+	//If we do not know yet whether the FPGA takes batch register writes, find out with the
+	// job's own registers before the train goes out (see sendParamRegisterWriteBatch).
+	if(job->numRegisters > 0 && !batchRegistersKnown){
+		if(!sendParamRegisterWriteBatch(job->numRegisters, job->regNumbers, job->regValues))
+			return false;
+		registersSent = true;
+	}
+
+	//Send the input writes
+	for(uint32_t i = 0; i < job->numInputs; i++){
+		segment = &job->inputs[i];
+		startAddress = segment->startAddress;
+		length = segment->length;
+		buffer = segment->buffer;
+
+		while(length > 0){
+			//Break this write into MAXWRITESIZE sized chunks or smaller
+			currLength = min(length, MAXWRITESIZE(maxPacketSize));
+
+			//If the window is full, wait until (at least) one ack frees up a slot.
+			//Resending a write here is fine, the run has not gone out yet.
+			while(outstandingTransmits >= (int)writeWindow){
+				DEBUG_ONLY(writeWindowStalls++;);
+				if(!waitForWriteAcks(writeWindow - 1))
+					return false;
+			}
+
+			//The param writes behind us kick the driver anyways
+			if(!createWriteRequestBackAndTransmit(startAddress, currLength, buffer,
+												  outstandingTransmits + 1 >= (int)writeWindow)){
+				//If the send errored out, something is very wrong.
+				return bailOut(0);
+			}
+
+			buffer += currLength;
+			startAddress += currLength;
+			length -= currLength;
+		}
+	}
+
+	//Send the parameter registers, one at a time to an FPGA that does not take batches
+	count = (registersSent) ? 0 : job->numRegisters;
+	regNumbers = job->regNumbers;
+	regValues = job->regValues;
+	while(count > 0){
+		currLength = (useBatchRegisters) ? min(count, (uint32_t)MAXPARAMBATCH) : 1;
+
+		if(useBatchRegisters){
+			if(!createParamWriteBatchRequestBackAndTransmit(currLength, regNumbers, regValues,
+															retransmitTimeout(writeTimeout), writeTimeout)){
+				//If the send errored out, something is very wrong.
+				return bailOut(getLastError());
+			}
+		}
+		else if(!createParamWriteRequestBackAndTransmit(regNumbers[0], regValues[0])){
+			//If the send errored out, something is very wrong.
+			return bailOut(getLastError());
+		}
+
+		regNumbers += currLength;
+		regValues += currLength;
+		count -= currLength;
+	}
+
+	//Raise the execution signal
+	if(!createParamWriteRequestBackAndTransmit(255, 1)){
+		//If the send errored out, something is very wrong.
+		return bailOut(getLastError());
+	}
+
+	//Read the run register.  The response might wait for the FPGA to finish running,
+	// so no round trip timing here and no resends before maxWaitTimeInMsec.
+	doneTimeout = max(job->maxWaitTimeInMsec, retransmitTimeout(readTimeout));
+	if(!createParamReadRequestBackAndTransmit(255, doneTimeout, 0)){
+		//If the send errored out, something is very wrong.
+		return bailOut(getLastError());
+	}
+
+	//Collect the acks for everything but (maybe) the run register read
+	if(!receiveJobAcks(&value, &gotDone, &runAcked)){
+		//Verify that receiveJobAcks did not return false due to some error
+		// rather then just not getting back the acks we expected.
+		MAYBE_BAILOUT();
+
+		//Something was lost.
+		//First wait for the run register read: once it is answered the FPGA is done with
+		// the train, every ack that is coming is in, and the answer cannot turn up later
+		// as the response to some other read.
+		PRINTF(("Job acks didn't come back in time, falling back!\n"));
+		DEBUG_ONLY(jobFallbacks++;);
+		while(!gotDone){
+			elapsed = GetTickCount() - startTime;
+			if(elapsed >= doneTimeout)
+				break;
+
+			Packet = PacketDriver->GetNextReceivedPacket(doneTimeout - elapsed);
+			if(Packet == NULL)
+				break;
+
+			assert(Packet->Mode == PacketModeReceiving);
+			(void) checkJobAck(Packet, &value, &gotDone, &runAcked);
+			if(!addReceive(Packet))
+				return bailOut(0);
+		}
+
+		//Whatever is still outstanding, other than the run, never got through or its ack did not
+		lost = outstandingTransmits - ((runAcked) ? 0 : 1);
+		emptyOutstandingPackets();
+
+		if(!gotDone){
+			PRINTF(("Job done response didn't come back in time!\n"));
+			setLastError(FAILWAITACK);
+			return false;
+		}
+
+		//The run register only reads non-zero after a run
+		if(!runAcked && value == 0){
+			//Either the run never got there, or it did and is over already
+			PRINTF(("Job run not acked, not running it again!\n"));
+			setLastError(FAILWRITEACK);
+			return false;
+		}
+		if(lost > 0){
+			//It ran, but maybe without some of its inputs
+			PRINTF(("Job inputs not acked, not running it again!\n"));
+			setLastError(FAILWRITEACK);
+			return false;
+		}
+
+		//Only acks were late, the outputs are all that is left
+	}
+	else if(!gotDone){
+		//Wait for the run register, it did not come in with the acks
+		if(!receiveParamReadResponse(&value, job->maxWaitTimeInMsec)){
+			//If receiveParamReadResponse timed out, use the
+			// error code FAILWAITACK
+            int8_t err = getLastError();
+			if(err == 0){
+				PRINTF(("Job done response didn't come back in time!\n"));
+				err = FAILWAITACK;
+			}
+
+			return bailOut(err);
+		}
+	}
+
+	//Still running, keep polling for whatever time is left
+	if(value != 0){
+		elapsed = GetTickCount() - startTime;
+		if(!waitDone((elapsed < job->maxWaitTimeInMsec) ? job->maxWaitTimeInMsec - elapsed : 0))
+			return false;
+	}
+
+	//Read back the outputs
+	for(uint32_t i = 0; i < job->numOutputs; i++){
+		segment = &job->outputs[i];
+		if(!sendRead(segment->startAddress, segment->length, segment->buffer))
+			return false;
+	}
+
+	setLastError(0);
+	//Make sure that there are no outstanding packets
+	assert(ringHead == ringTail);
+	assert(outstandingTransmits == 0);
+	return true;
+}
+
+//Asynchronous interface.
+//Requests are queued to a background I/O thread that runs them one at a time, in order,
+// through the same code as the synchronous calls.  There is still only the one set of
+// outstanding packets, so this overlaps the caller with the I/O, not requests with each other.
+//Each request gets its own event, result and error code, which waitAsync hands back to the caller.
+
+//Queue a write request, see sendWrite.  Returns NULL w/error code if it cannot be queued.
+ETH_SIRC::ASYNC_HANDLE ETH_SIRC::sendWriteAsync(uint32_t startAddress, uint32_t length, uint8_t *buffer){
+    ASYNC_REQUEST *request = newAsyncRequest(ASYNC_WRITE);
+    if (!request)
+        return NULL;
+    request->address = startAddress;
+    request->length  = length;
+    request->buffer  = buffer;
+    return queueAsyncRequest(request);
+}
+
+//Queue a read request, see sendRead.  Returns NULL w/error code if it cannot be queued.
+ETH_SIRC::ASYNC_HANDLE ETH_SIRC::sendReadAsync(uint32_t startAddress, uint32_t length, uint8_t *buffer){
+    ASYNC_REQUEST *request = newAsyncRequest(ASYNC_READ);
+    if (!request)
+        return NULL;
+    request->address = startAddress;
+    request->length  = length;
+    request->buffer  = buffer;
+    return queueAsyncRequest(request);
+}
+
+//Queue a parameter register write, see sendParamRegisterWrite.
+//Returns NULL w/error code if it cannot be queued.
+ETH_SIRC::ASYNC_HANDLE ETH_SIRC::sendParamRegisterWriteAsync(uint8_t regNumber, uint32_t value){
+    ASYNC_REQUEST *request = newAsyncRequest(ASYNC_PARAMWRITE);
+    if (!request)
+        return NULL;
+    request->address = regNumber;
+    request->value   = value;
+    return queueAsyncRequest(request);
+}
+
+//Queue a parameter register read, see sendParamRegisterRead.
+//Returns NULL w/error code if it cannot be queued.
+ETH_SIRC::ASYNC_HANDLE ETH_SIRC::sendParamRegisterReadAsync(uint8_t regNumber, uint32_t *value){
+    ASYNC_REQUEST *request = newAsyncRequest(ASYNC_PARAMREAD);
+    if (!request)
+        return NULL;
+    request->address = regNumber;
+    request->valueP  = value;
+    return queueAsyncRequest(request);
+}
+
+//Queue a run request, see sendRun.  Returns NULL w/error code if it cannot be queued.
+ETH_SIRC::ASYNC_HANDLE ETH_SIRC::sendRunAsync(){
+    ASYNC_REQUEST *request = newAsyncRequest(ASYNC_RUN);
+    if (!request)
+        return NULL;
+    return queueAsyncRequest(request);
+}
+
+//Queue a wait for the execution signal to be lowered, see waitDone.
+//Returns NULL w/error code if it cannot be queued.
+ETH_SIRC::ASYNC_HANDLE ETH_SIRC::waitDoneAsync(uint32_t maxWaitTimeInMsec){
+    ASYNC_REQUEST *request = newAsyncRequest(ASYNC_WAITDONE);
+    if (!request)
+        return NULL;
+    request->timeout = maxWaitTimeInMsec;
+    return queueAsyncRequest(request);
+}
+
+//Queue a write and run request, see sendWriteAndRun.
+//Returns NULL w/error code if it cannot be queued.
+ETH_SIRC::ASYNC_HANDLE ETH_SIRC::sendWriteAndRunAsync(uint32_t startAddress, uint32_t inLength, uint8_t *inData, 
+                                                    uint32_t maxWaitTimeInMsec, uint8_t *outData, uint32_t maxOutLength, 
+                                                    uint32_t *outputLength){
+    ASYNC_REQUEST *request = newAsyncRequest(ASYNC_WRITEANDRUN);
+    if (!request)
+        return NULL;
+    request->address      = startAddress;
+    request->length       = inLength;
+    request->buffer       = inData;
+    request->timeout      = maxWaitTimeInMsec;
+    request->outData      = outData;
+    request->maxOutLength = maxOutLength;
+    request->valueP       = outputLength;
+    return queueAsyncRequest(request);
+}
+
+//Wait for an asynchronous request to complete
+// handle: as returned when the request was queued
+// maxWaitTimeInMsec: # of milliseconds to wait (INFINITE is ok)
+//Returns true if the request completed successfully, false if not.
+//Either way the handle is released, and the request's error code goes in *error.
+//If the request is still running after maxWaitTimeInMsec, returns false w/ FAILASYNCPENDING
+// in *error and the handle stays valid, so it can be waited on again.
+//The caller need not own the link, so the shared error code is left alone.
+BOOL ETH_SIRC::waitAsync(ASYNC_HANDLE handle, uint32_t maxWaitTimeInMsec, int8_t *error){
+    if (!handle){
+        if (error)
+            *error = INVALIDBUFFER;
+        return false;
+    }
+
+    if (WaitForSingleObject(handle->done, maxWaitTimeInMsec) != WAIT_OBJECT_0){
+        if (error)
+            *error = FAILASYNCPENDING;
+        return false;
+    }
+
+    BOOL result = handle->result;
+    if (error)
+        *error = handle->error;
+    CloseHandle(handle->done);
+    delete handle;
+    return result;
+}
+
+//Hand a synchronous call over to the I/O thread and wait for it to be done.
+//handle is NULL w/error code if the request could not be queued.
+//The error code comes back in the request, the caller stores it as the synchronous call
+// would have.  Nobody else writes it while the I/O thread runs, so no lock is needed.
+BOOL ETH_SIRC::runOnIoThread(ASYNC_HANDLE handle){
+    int8_t error;
+    BOOL result;
+
+    if (!handle)
+        return false;
+    result = waitAsync(handle, INFINITE, &error);
+    setLastError(error);
+    return result;
+}
+
+//Same, for the calls that only update our own state and do not return anything.
+//If the request cannot be queued, run it here.  It does not wait its turn then, but
+// the state it changes must not be left stale.
+void ETH_SIRC::runOnIoThread(ASYNC_OP op, uint32_t address, uint32_t length){
+    ASYNC_REQUEST *request = newAsyncRequest(op);
+
+    if (request){
+        request->address = address;
+        request->length  = length;
+        (void) waitAsync(queueAsyncRequest(request), INFINITE);
+        return;
+    }
+
+    IO_GUARD guard(this);
+    if (op == ASYNC_INVALIDATESHADOW)
+        invalidateInputShadow(address, length);
+    else
+        setParamRegisterVolatile((uint8_t)address, length);
+}
+
+//Allocate and initialize a request of the given type.
+//Return NULL w/error code if we run out of memory.
+ETH_SIRC::ASYNC_REQUEST *ETH_SIRC::newAsyncRequest(ASYNC_OP op){
+    ASYNC_REQUEST *request = new (std::nothrow) ASYNC_REQUEST;
+    if (!request){
+        setLastError(FAILMEMALLOC);
+        return NULL;
+    }
+    memset(request, 0, sizeof(*request));
+    request->op = op;
+
+    request->done = CreateEvent(NULL, TRUE, FALSE, NULL);
+    if (!request->done){
+        delete request;
+        setLastError(FAILMEMALLOC);
+        return NULL;
+    }
+
+    //Start the I/O thread, if this is the first time around
+    if (!startIoThread()){
+        CloseHandle(request->done);
+        delete request;
+        return NULL;
+    }
+
+    return request;
+}
+
+//Start the I/O thread, unless it is already running
+//Return false w/error code if that does not work.
+BOOL ETH_SIRC::startIoThread(void){
+    BOOL result = true;
+
+    EnterCriticalSection(&asyncLock);
+    if (ioThread){
+        LeaveCriticalSection(&asyncLock);
+        return true;
+    }
+
+    asyncWakeup = CreateEvent(NULL, FALSE, FALSE, NULL);
+    if (asyncWakeup)
+        ioThread = CreateThread(NULL, 0, ioThreadMain, this, 0, &ioThreadId);
+    if (!asyncWakeup || !ioThread){
+        if (asyncWakeup)
+            CloseHandle(asyncWakeup);
+        asyncWakeup = ioThread = NULL;
+        result = false;
+    }
+    LeaveCriticalSection(&asyncLock);
+
+    if (!result)
+        setLastError(FAILMEMALLOC);
+    return result;
+}
+
+//Put a request on the submitted list and wake up the I/O thread.
+//Safe to call from any number of threads at once, no lock is taken.
+ETH_SIRC::ASYNC_HANDLE ETH_SIRC::queueAsyncRequest(ASYNC_REQUEST *request){
+    ASYNC_REQUEST *next;
+
+    //Push it in front of the list.  Only the I/O thread takes requests off, and always
+    // the whole list at once, so there is no ABA problem here.
+    do {
+        next = asyncSubmitted;
+        request->next = next;
+    } while (InterlockedCompareExchangePointer((void * volatile *)&asyncSubmitted, request, next) != next);
+
+    SetEvent(asyncWakeup);
+    return request;
+}
+
+//Take the oldest request, wait for one if there is none.
+//Only the I/O thread calls this, asyncHead is all its own.
+ETH_SIRC::ASYNC_REQUEST *ETH_SIRC::dequeueAsyncRequest(void){
+    ASYNC_REQUEST *request;
+    ASYNC_REQUEST *submitted;
+
+    for(;;){
+        //Finish the last batch first
+        request = asyncHead;
+        if (request){
+            asyncHead = request->next;
+            return request;
+        }
+
+        //Take everything submitted since, it comes newest first so turn it around
+        submitted = (ASYNC_REQUEST *)InterlockedExchangePointer((void * volatile *)&asyncSubmitted, NULL);
+        while (submitted){
+            request = submitted;
+            submitted = request->next;
+            request->next = asyncHead;
+            asyncHead = request;
+        }
+
+        if (!asyncHead)
+            WaitForSingleObject(asyncWakeup, INFINITE);
+    }
+}
+
+//Entry point for the I/O thread
+DWORD WINAPI ETH_SIRC::ioThreadMain(void *context){
+    ((ETH_SIRC *)context)->processAsyncRequests();
+    return 0;
+}
+
+//Run the queued requests, in order, until told to exit
+void ETH_SIRC::processAsyncRequests(void){
+    ASYNC_REQUEST *request;
+    BOOL result;
+
+    for(;;){
+        request = dequeueAsyncRequest();
+
+        switch(request->op){
+            case ASYNC_WRITE:
+                result = sendWrite(request->address, request->length, request->buffer);
+                break;
+            case ASYNC_READ:
+                result = sendRead(request->address, request->length, request->buffer);
+                break;
+            case ASYNC_PARAMWRITE:
+                result = sendParamRegisterWrite((uint8_t)request->address, request->value);
+                break;
+            case ASYNC_PARAMREAD:
+                result = sendParamRegisterRead((uint8_t)request->address, request->valueP);
+                break;
+            case ASYNC_RUN:
+                result = sendRun();
+                break;
+            case ASYNC_WAITDONE:
+                result = waitDone(request->timeout);
+                break;
+            case ASYNC_WRITEANDRUN:
+                result = sendWriteAndRun(request->address, request->length, request->buffer,
+                                         request->timeout, request->outData, request->maxOutLength,
+                                         request->valueP);
+                break;
+            case ASYNC_GETPARAMETERS:
+                result = getParameters((SIRC::PARAMETERS *)request->out, request->length);
+                break;
+            case ASYNC_SETPARAMETERS:
+                result = setParameters((const SIRC::PARAMETERS *)request->in, request->length);
+                break;
+            case ASYNC_READTOSINK:
+                result = sendReadToSink(request->address, request->length, request->sink, request->out);
+                break;
+            case ASYNC_PARAMWRITEBATCH:
+                result = sendParamRegisterWriteBatch(request->length, request->regNumbers, request->values);
+                break;
+            case ASYNC_PARAMREADBATCH:
+                result = sendParamRegisterReadBatch(request->length, request->regNumbers, request->valueP);
+                break;
+            case ASYNC_SUBMITJOB:
+                result = submitJob((const SIRC::JOB *)request->in);
+                break;
+            case ASYNC_RESET:
+                result = sendReset();
+                break;
+            case ASYNC_INVALIDATESHADOW:
+                invalidateInputShadow(request->address, request->length);
+                result = true;
+                break;
+            case ASYNC_SETVOLATILE:
+                setParamRegisterVolatile((uint8_t)request->address, request->length);
+                result = true;
+                break;
+            case ASYNC_EXIT:
+            default:
+                //The exit request belongs to the destructor
+                return;
+        }
+
+        //Hand the outcome over to whoever waits for it (this is ioThreadError)
+        request->result = result;
+        request->error  = getLastError();
+        SetEvent(request->done);
+    }
+}
+
+//Get exclusive use of the packet driver.
+//Once the I/O thread runs, every call is queued to it (see forwardToIoThread), so the lock
+// only sorts it out with a call that was already under way when the thread started.
+void ETH_SIRC::enterIo(void){
+    DWORD me = GetCurrentThreadId();
+
+    //Nested call (sendWriteAndRun calls sendWrite, etc)
+    if (ioOwner == me){
+        ioDepth++;
+        return;
+    }
+
+    EnterCriticalSection(&ioLock);
+    ioOwner = me;
+    ioDepth = 1;
+}
+
+//Give up the packet driver
+void ETH_SIRC::leaveIo(void){
+    if (--ioDepth > 0)
+        return;
+    ioOwner = 0;
+    LeaveCriticalSection(&ioLock);
+}
+
 //Internal methods
 
 #pragma intrinsic(_byteswap_ulong,_byteswap_ushort) //jic. And btw why don't we define BYTE_ORDER
+#if !defined(_MSC_VER) && defined(__GNUC__)
+//Same thing, different name
+#define _byteswap_ushort(_x_) __builtin_bswap16(_x_)
+#define _byteswap_ulong(_x_) __builtin_bswap32(_x_)
+#endif
 
 //Allocate a packet for xmit, initialize state & locals
 inline BOOL ETH_SIRC::allocateAndFillPacket(uint16_t length){
 	//Get a new xmit packet to put the message in.
-	currentPacket = PacketDriver->AllocatePacket(NULL,MAXPACKETSIZE,false);
+	currentPacket = PacketDriver->AllocatePacket(NULL,maxPacketSize,false);
 	if(!currentPacket){
 		setLastError(FAILMEMALLOC);
 		return false;
 	}
 
+	//No retransmit timer running for it (yet)
+	currentPacket->UserState = NULL;
+
 	//The packet payload will be N bytes long
-	assert(length <= MAXPACKETDATASIZE);
+	assert(length <= MAXPACKETDATASIZE(maxPacketSize));
 
 	//The length of the frame will be the length of the payload plus 6 + 6 + 2 (dest MAC,
 	//  source MAC, and payload length)
@@ -938,7 +2365,7 @@ inline BOOL ETH_SIRC::allocateAndFillPacket(uint16_t length){
 	memcpy(currentPacket->Buffer, &ethHeader, 12);
 
 	//The payload length field (bytes 12 and 13) does not include the length of the header
-#if defined(_MSC_VER) //other compilers might not
+#if defined(_MSC_VER) || defined(__GNUC__) //other compilers might not
     *(uint16_t*)(currentPacket->Buffer+12) = _byteswap_ushort(length);
 #else
 	currentPacket->Buffer[13] = (length) % 256;
@@ -951,9 +2378,58 @@ inline BOOL ETH_SIRC::allocateAndFillPacket(uint16_t length){
     return true;
 }
 
+//Precompute the frame header and write command for full-size write packets.
+//Only the address differs from one to the next, see allocateWriteFromTemplate.
+void ETH_SIRC::buildWriteTemplate(void){
+	uint32_t length = MAXWRITESIZE(maxPacketSize);
+
+	//Ethernet header, as in allocateAndFillPacket
+	memcpy(writeTemplate, &ethHeader, 12);
+	writeTemplate[12] = (uint8_t)((9 + length) >> 8);
+	writeTemplate[13] = (uint8_t)((9 + length) % 256);
+
+	//Write command, with the address left blank
+	currentBuffer = &writeTemplate[14];
+	currentBuffer[0] = 'w';
+	setLengthAndAddress(length, 0);
+
+	writeTemplateLength = length;
+}
+
+//Allocate a packet for a full-size write, and fill it in from the template.
+//The packet payload is left to the caller, as after allocateAndFillPacket.
+inline BOOL ETH_SIRC::allocateWriteFromTemplate(uint32_t address){
+	currentPacket = PacketDriver->AllocatePacket(NULL,maxPacketSize,false);
+	if(!currentPacket){
+		setLastError(FAILMEMALLOC);
+		return false;
+	}
+
+	//No retransmit timer running for it (yet)
+	currentPacket->UserState = NULL;
+	currentPacket->nBytesAvail = sizeof(writeTemplate) + writeTemplateLength;
+
+	//Fixed size, so this is a couple of wide moves rather than a call
+	memcpy(currentPacket->Buffer, writeTemplate, sizeof(writeTemplate));
+	currentBuffer = &(currentPacket->Buffer[14]);
+
+	//Then the address (1-4)
+#if defined(_MSC_VER) || defined(__GNUC__) //other compilers might not
+	address = _byteswap_ulong(address);
+	memcpy(currentBuffer+1, &address, 4);
+#else
+	for(int i = 3; i >=0; i--){
+		currentBuffer[i + 1] = address % 256;
+		address = address >> 8;
+	}
+#endif
+
+	return true;
+}
+
 //Set the start address and write length fields (1-4 and 5-8)
 inline void ETH_SIRC::setLengthAndAddress(uint32_t length, uint32_t address){
-#if defined(_MSC_VER) //other compilers might not
+#if defined(_MSC_VER) || defined(__GNUC__) //other compilers might not
     *(uint32_t*)(currentBuffer+1) = _byteswap_ulong(address);
     *(uint32_t*)(currentBuffer+5) = _byteswap_ulong(length);
 #else
@@ -966,9 +2442,18 @@ inline void ETH_SIRC::setLengthAndAddress(uint32_t length, uint32_t address){
 #endif
 }
 
+//Have the packet driver pick up the last length bytes of the payload from data
+// when the packet is posted, instead of copying them into the packet here.
+//data must stay put until the packet is acked.
+inline void ETH_SIRC::setPayloadReference(uint8_t *data, uint32_t length){
+    currentPacket->nBytesAvail -= length;
+    currentPacket->Gather = data;
+    currentPacket->GatherLength = length;
+}
+
 //Set the value field (2-5)
 inline void ETH_SIRC::setValueField(uint32_t value){
-#if defined(_MSC_VER) //other compilers might not
+#if defined(_MSC_VER) || defined(__GNUC__) //other compilers might not
     *(uint32_t*)(currentBuffer+2) = _byteswap_ulong(value);
 #else
 	for(int i = 3; i >=0; i--){
@@ -981,11 +2466,14 @@ inline void ETH_SIRC::setValueField(uint32_t value){
 //This function queues a receive on the network port
 //Return true on success, return false w/error code on failure
 inline BOOL ETH_SIRC::addReceive(PACKET *Packet){
+	HRESULT Result;
     
+    //Receives are always sized for the largest frame the NIC can take,
+    // whatever frame size we agreed on with the FPGA.
     if (Packet)
-        Packet->Length = MAXPACKETSIZE;//recycle
+        Packet->Length = nicFrameSize;//recycle
     else
-        Packet = PacketDriver->AllocatePacket(NULL,MAXPACKETSIZE,true);
+        Packet = PacketDriver->AllocatePacket(NULL,nicFrameSize,true);
 	if(!Packet){
 		setLastError(FAILMEMALLOC);
 		return false;
@@ -993,7 +2481,34 @@ inline BOOL ETH_SIRC::addReceive(PACKET *Packet){
 
     BIGDEBUG_adding_receive(Packet);
 
-    PacketDriver->PostReceivePacket(Packet);
+    Result = PacketDriver->PostReceivePacket(Packet);
+
+	if(Result != S_OK && Result != ERROR_IO_PENDING){
+		PRINTF(("Bad receive packet!\n"));
+		setLastError(FAILVMNSCOMPLETION);
+		return false;
+	}
+
+    return true;
+}
+
+//Same as addReceive, for a batch of packets we got back from the NIC.
+//Return true on success, return false w/error code on failure
+inline BOOL ETH_SIRC::addReceives(PACKET **Packets, uint32_t count){
+	HRESULT Result;
+
+    for(uint32_t i = 0; i < count; i++){
+        Packets[i]->Length = nicFrameSize;//recycle
+        BIGDEBUG_adding_receive(Packets[i]);
+    }
+
+    Result = PacketDriver->PostReceivePackets(Packets, count);
+
+	if(Result != S_OK && Result != ERROR_IO_PENDING){
+		PRINTF(("Bad receive packets!\n"));
+		setLastError(FAILVMNSCOMPLETION);
+		return false;
+	}
 
     return true;
 }
@@ -1041,10 +2556,29 @@ BOOL ETH_SIRC::bailOut(int8_t errorCode){
 // later, after the packet has been freed.
 void ETH_SIRC::emptyOutstandingPackets(){
 	PACKET *        Packet;
+    uint32_t        inFlight;
+
+    //Only requests that are still on the scoreboard can draw a late response.
+    //If there are none we just pick up whatever already arrived and are done,
+    // rather than sitting through a full timeout on every error.
+    //A read request draws one response per chunk, those past nextAddress are still to come.
+    inFlight = backgroundTransmits;
+	for(uint32_t i = ringHead; i != ringTail; i++){
+        REQUEST *request = requestAt(i);
+        if (request->packet == NULL)
+            continue;
+        if (request->packet->Buffer[14] == 'r'){
+            uint32_t chunkSize = MAXREADSIZE(maxPacketSize);
+            uint32_t left = request->startAddress + request->length - request->nextAddress;
+            inFlight += (left + chunkSize - 1) / chunkSize;
+        }
+        else
+            inFlight++;
+    }
 
 	//Keep polling until it comes up empty
 	for(;;){
-        Packet = PacketDriver->GetNextReceivedPacket(readTimeout);
+        Packet = PacketDriver->GetNextReceivedPacket((inFlight > 0) ? retransmitTimeout(readTimeout) : 0);
         if (Packet == NULL)
             break;
 
@@ -1052,90 +2586,218 @@ void ETH_SIRC::emptyOutstandingPackets(){
         assert(Packet->Mode == PacketModeReceiving);
         BIGDEBUG_packet_received(Packet,1);
 
+        //Each late response accounts for one of them
+        if (inFlight > 0)
+            inFlight--;
+
         //Received packets get re-posted immediately
         (void) addReceive(Packet);
     }
 
 	//Now put the outstanding transmits into the free list
-	for(packetIter = outstandingPackets.begin(); packetIter != outstandingPackets.end(); packetIter++){
-        PacketDriver->FreePacket(*packetIter,false);
+	for(uint32_t i = ringHead; i != ringTail; i++){
+        PACKET *packet = requestAt(i)->packet;
+        if (packet == NULL)
+            continue;
+        PacketDriver->FreePacket(packet,false);
         //Decrement the outstanding packet counter
         outstandingTransmits --;
 	}
-    outstandingPackets.clear();
-
-	//Empty the read starting address and length lists
-	outstandingReadStartAddresses.clear();
-	outstandingReadLengths.clear();
+    ringHead = ringTail = ringIter = 0;
+    writeBatch.clear();
+    freeBackgroundRequests();
+    retransmitTimers.clear();
+    timerSlots.clear();
+    freeTimerSlots.clear();
+    readChunkCount = 0;
 }
 
 //Create a write request, add it to the back of the outstanding queue and transmit it.
 //Return true if the addition & transmission goes OK.
 //Return false w/error code if not.
 BOOL ETH_SIRC::createWriteRequestBackAndTransmit(uint32_t startAddress, uint32_t length, uint8_t *buffer, BOOL flushQueue){
+	if(!createWriteRequestBack(startAddress, length, buffer))
+		return false;
+
+    currentPacket->Flush = flushQueue;
+    return sendCurrentPacket(INVALIDWRITETRANSMIT,false DEBUG_ONLY_1ARG("Write"));
+}
+
+//Create a write request in currentPacket and add it to the back of the outstanding queue,
+// for the caller to transmit.
+//Return true if the addition goes OK.
+//Return false w/error code if not.
+BOOL ETH_SIRC::createWriteRequestBack(uint32_t startAddress, uint32_t length, uint8_t *buffer){
 
     LogIt("sirc::cwr %u %u",startAddress,length);
 
-	/*The packet will be N + 9 bytes long: N payload + 1 byte command + 4 bytes address + 4 bytes length) */
-    if (!allocateAndFillPacket(9+length))
-        return false;
+	//Most writes are broken up into full-size packets, which only differ in their address.
+	//Those are stamped out of a template, the frame size might have changed since it was made.
+	if(writeTemplateLength != MAXWRITESIZE(maxPacketSize))
+		buildWriteTemplate();
 
-	//Set the command byte to 'w'
-	currentBuffer[0] = 'w';
+	if(length == writeTemplateLength){
+		if(!allocateWriteFromTemplate(startAddress))
+			return false;
+	}else{
+		/*The packet will be N + 9 bytes long: N payload + 1 byte command + 4 bytes address + 4 bytes length) */
+		if (!allocateAndFillPacket(9+length))
+			return false;
 
-    setLengthAndAddress(length,startAddress);
+		//Set the command byte to 'w'
+		currentBuffer[0] = 'w';
 
-	//Copy the write data over
-	memcpy(currentBuffer + 9, buffer, length);
+		setLengthAndAddress(length,startAddress);
+	}
+
+	//The write data goes straight out of the caller's buffer
+    setPayloadReference(buffer, length);
 
 	//Keep track of this message
-	outstandingPackets.push_back(currentPacket);
-	outstandingTransmits++;
+	if (!addRequestBack(currentPacket, 0, 0))
+		return false;
+	armRetransmitTimer(currentPacket, retransmitTimeout(writeTimeout), 1, writeTimeout);
+	return true;
+}
 
-    currentPacket->Flush = flushQueue;
-    return sendCurrentPacket(INVALIDWRITETRANSMIT,false DEBUG_ONLY_1ARG("Write"));
+//Post the write packets sendWrite has queued up in one go, kicking the driver after the
+// last one.
+//Return true if the send goes OK, return false w/error code if not.
+BOOL ETH_SIRC::postWriteBatch(void){
+	HRESULT Result;
+
+	if(writeBatch.empty())
+		return true;
+
+	for(uint32_t i = 0; i < writeBatch.size(); i++){
+		writeBatch[i]->Flush = (i + 1 == writeBatch.size());
+		BIGDEBUG_adding_transmit(writeBatch[i]);
+	}
+
+	Result = PacketDriver->PostTransmitPackets(&writeBatch[0], (UINT32)writeBatch.size());
+	writeBatch.clear();
+
+	if(Result != S_OK && Result != ERROR_IO_PENDING){
+		PRINTF(("Write not sent!\n"));
+		setLastError(INVALIDWRITETRANSMIT);
+		return false;
+	}
+	return true;
 }
 
+//Check writes off the scoreboard until no more than maxLeftOutstanding are still unacknowledged.
+//Whenever a retransmit timer goes off we resend just the writes that timed out.
+//Return true once the window has opened up, return false w/error code if not.
+BOOL ETH_SIRC::waitForWriteAcks(uint32_t maxLeftOutstanding){
+	for(;;){
+		//Try to receive acks for the outstanding writes
+		if(receiveWriteAcks(maxLeftOutstanding))
+			//We got enough of the acks back
+			return true;
+
+		//Verify that receiveWriteAcks did not return false due to some error
+		// rather then just not getting back all of the acks we expected.
+		MAYBE_BAILOUT();
+
+		//Some of the writes' acks did not come back in time, so re-send those.
+		//A write that has already been resent too many times fails the whole thing.
+		if (!resendExpiredPackets(INVALIDWRITETRANSMIT, FAILWRITEACK DEBUG_ONLY_2ARGS("Write",&writeResends))) {
+			return false;
+		}
+
+		//We lost something, back off
+		if (resentSequence != 0)
+			closeWriteWindow();
+	}
+}
+
+//A write was acked, open the write window a bit.
+//One packet per ack below writeWindowThreshold, one packet per window's worth of acks above it.
+inline void ETH_SIRC::openWriteWindow(void){
+	if (writeWindow >= maxOutstandingWrites)
+		return;
+
+	if (writeWindow < writeWindowThreshold){
+		writeWindow++;
+		return;
+	}
+
+	if (++writeWindowAcks >= writeWindow){
+		writeWindowAcks = 0;
+		writeWindow++;
+	}
+}
+
+//A write had to be resent, halve the write window.
+//Losses among the packets that were already in flight when we last cut the window
+// are part of the same congestion event, those do not count again.
+void ETH_SIRC::closeWriteWindow(void){
+	if ((int32_t)(resentSequence - writeWindowRecovery) <= 0)
+		return;
+
+	writeWindowThreshold = max(writeWindow / 2, (uint32_t)MINWRITEWINDOW);
+	writeWindow = writeWindowThreshold;
+	writeWindowAcks = 0;
+	writeWindowRecovery = timerSequence;
+	DEBUG_ONLY(writeWindowCuts++;);
+}
+
+#ifdef PACEWRITES
+//Space the writes one smoothed round trip / write window apart.
+//The gaps are much shorter than a timer tick, so we spin.
+void ETH_SIRC::paceWrite(void){
+	uint32_t gap;
+
+	if (!haveRoundTrip)
+		return;
+
+	gap = smoothedRoundTrip / writeWindow;
+	while (getMicroseconds() - lastWriteTransmit < gap)
+		YieldProcessor();
+	lastWriteTransmit = getMicroseconds();
+}
+#endif
+
 //Try and grab as many write acks that we can up till:
-// 1) we get all of the outstanding writes acked, return true
-// 2) we haven't gotten a new ack for N seconds (N should never be less than 1), return false
+// 1) we get the outstanding writes down to maxLeftOutstanding, return true
+// 2) the retransmit timer of some outstanding write goes off, return false
 // 3) we have some problem on the completion port or addReceive, return false w/ error code
-BOOL ETH_SIRC::receiveWriteAcks(){
-	PACKET *        Packet;
+BOOL ETH_SIRC::receiveWriteAcks(uint32_t maxLeftOutstanding){
+	PACKET *        Packets[RECEIVEBATCH];
+	uint32_t        count;
 
 	for(;;){
-        Packet = PacketDriver->GetNextReceivedPacket(writeTimeout);
-        if (Packet == NULL)
+        count = PacketDriver->GetNextReceivedPackets(Packets, RECEIVEBATCH,
+                                                     nextRetransmitTimeout(writeTimeout));
+        if (count == 0)
             break;
 
-		//Some packet completed
-        assert(Packet->Mode == PacketModeReceiving);
-        BIGDEBUG_packet_received(Packet,0);
-
-        //Check if this is a good write ack
-        if(checkWriteAck(Packet)){
-            //This is a good ack, repost the receive packet.
-            if (addReceive(Packet)){
-
-                //See if we have gotten all of the write acks back
-                //If we have gotten all the writes acked, we are done for now
-                if(outstandingTransmits == 0){
-                    return true;
-                }
-                //Nope, keep going
-                continue;
-            }
+        //Nothing but write acks should show up while we write, so we can
+        // go through the whole batch even if the first few are enough.
+        for(uint32_t i = 0; i < count; i++){
+            //Some packet completed
+            assert(Packets[i]->Mode == PacketModeReceiving);
+            BIGDEBUG_packet_received(Packets[i],0);
+
+            //Check if this is a good write ack
+            //If this isn't an ack of something we sent, it just gets reposted
+            if(checkWriteAck(Packets[i]))
+                openWriteWindow();
+        }
 
+        //Repost the receive packets, all at once.
+        if (!addReceives(Packets, count)){
             //Something went wrong posting a receive, bail out.
             LogIt("sirc::rwa.ar");
             return false;
         }
-	
-        //This isn't an ack of something we sent, but we should free the packet anyways.
-        if (!addReceive(Packet)){
-            LogIt("sirc::rwa.ar1");
-            return false;
+
+        //See if we have gotten enough of the write acks back
+        //If the window is open far enough, we are done for now
+        if(outstandingTransmits <= (int)maxLeftOutstanding){
+            return true;
         }
+        //Nope, keep going
     }
 
 	//This return false is not an error per se, we just timed out
@@ -1159,6 +2821,359 @@ inline BOOL ETH_SIRC::checkWriteAck(PACKET* packet){
     return checkSimpleResponse(packet,'w',9);
 }
 
+//Requests acked in the background (see TRANSACTIONIDS).
+//These go out with a transaction ID and wait in backgroundRing, not in the scoreboard, so the
+// calls that follow can have their own requests outstanding at the same time.
+//They share the retransmit timers (and the write window) with everybody else.
+
+//Send a block of data to an input buffer on the FPGA without waiting for the acks.
+//The data is copied into the packets, so the caller can reuse buffer right away.
+//Return true once every write command is on the wire, return false w/error code if not.
+BOOL ETH_SIRC::sendBackgroundWrite(uint32_t startAddress, uint32_t length, uint8_t *buffer){
+	uint32_t currLength;
+	BOOL flush;
+
+	//If this overwrites data still in flight, a resent packet could land on top of the new data
+	if(backgroundHigh > backgroundLow && startAddress < backgroundHigh && startAddress + length > backgroundLow){
+		if(!waitForBackgroundAcks(0))
+			return false;
+	}
+
+	while(length > 0){
+		//Break this write into chunks that leave room for the envelope
+		if(length > MAXWRITESIZE(maxPacketSize) - TAGLENGTH)
+			currLength = MAXWRITESIZE(maxPacketSize) - TAGLENGTH;
+		else
+			currLength = length;
+
+		if(!makeRoomInBackground())
+			return false;
+
+		//Kick the driver on the last packet, and on any packet that fills the window
+		flush = (currLength == length) || (backgroundTransmits + 1 >= (int)writeWindow);
+#ifdef PACEWRITES
+		paceWrite();
+		flush = true;
+#endif
+		if(!createBackgroundWriteAndTransmit(startAddress, currLength, buffer, flush)){
+			//If the send errored out, something is very wrong.
+			return bailOut(0);
+		}
+
+		//Remember what is in flight
+		if(backgroundHigh == backgroundLow){
+			backgroundLow = startAddress;
+			backgroundHigh = startAddress + currLength;
+		}
+		else{
+			backgroundLow = min(backgroundLow, startAddress);
+			backgroundHigh = max(backgroundHigh, startAddress + currLength);
+		}
+
+		//Update all of the markers
+		buffer += currLength;
+		startAddress += currLength;
+		length -= currLength;
+	}
+
+	setLastError(0);
+	return true;
+}
+
+//Send a 32-bit value to the parameter register file on the FPGA without waiting for the ack.
+//Return true once the register write is on the wire, return false w/error code if not.
+BOOL ETH_SIRC::sendBackgroundParamRegisterWrite(uint8_t regNumber, uint32_t value){
+	//Same as for writes, a resent packet must not land on top of the new value
+	if(backgroundRegisters[regNumber] && !waitForBackgroundAcks(0))
+		return false;
+
+	if(!makeRoomInBackground())
+		return false;
+
+	if(!createBackgroundParamWriteAndTransmit(regNumber, value)){
+		//If the send errored out, something is very wrong.
+		return bailOut(getLastError());
+	}
+	backgroundRegisters[regNumber]++;
+
+	setLastError(0);
+	return true;
+}
+
+//Wait until the write window has room for one more request, and there is a free transaction ID.
+//Return false w/error code if the acks do not come.
+BOOL ETH_SIRC::makeRoomInBackground(void){
+	//The window might shrink while we wait, hence the loop.
+	while(backgroundTransmits >= (int)writeWindow){
+		DEBUG_ONLY(writeWindowStalls++;);
+		if(!waitForBackgroundAcks(writeWindow - 1))
+			return false;
+	}
+
+	//The oldest request is still outstanding and we are about to reuse its ID.
+	//Rare, the ring has room for two full windows.
+	if(backgroundTail - backgroundHead >= backgroundSize)
+		return waitForBackgroundAcks(0);
+
+	return true;
+}
+
+//Allocate a packet for xmit with a transaction ID envelope around a command length bytes long.
+//The ID is that of the next free slot in backgroundRing.
+//currentBuffer is left pointing at the command.
+inline BOOL ETH_SIRC::allocateAndFillTaggedPacket(uint16_t length){
+    if (!allocateAndFillPacket(TAGLENGTH + length))
+        return false;
+
+	currentBuffer[0] = 'T';
+	currentBuffer[1] = (backgroundTail >> 8) & 0xff;
+	currentBuffer[2] = backgroundTail & 0xff;
+	currentBuffer += TAGLENGTH;
+    return true;
+}
+
+//Keep track of a request with the transaction ID allocateAndFillTaggedPacket gave it
+inline void ETH_SIRC::addBackgroundRequest(PACKET *packet){
+	backgroundRing[backgroundTail++ & (backgroundSize - 1)] = packet;
+	backgroundTransmits++;
+}
+
+//Create a write request with a transaction ID, keep track of it and transmit it.
+//Return true if the addition & transmission goes OK.
+//Return false w/error code if not.
+BOOL ETH_SIRC::createBackgroundWriteAndTransmit(uint32_t startAddress, uint32_t length, uint8_t *buffer, BOOL flushQueue){
+
+    LogIt("sirc::cbw %u %u",startAddress,length);
+
+	//The packet will be N + 9 bytes long inside the envelope
+    if (!allocateAndFillTaggedPacket(9+length))
+        return false;
+
+	//Set the command byte to 'w'
+	currentBuffer[0] = 'w';
+
+    setLengthAndAddress(length,startAddress);
+
+	//The caller does not wait for the ack, so the data has to be copied
+	memcpy(currentBuffer+9, buffer, length);
+
+	addBackgroundRequest(currentPacket);
+	armRetransmitTimer(currentPacket, retransmitTimeout(writeTimeout), 1, writeTimeout);
+
+    currentPacket->Flush = flushQueue;
+    return sendCurrentPacket(INVALIDWRITETRANSMIT,false DEBUG_ONLY_1ARG("Background write"));
+}
+
+//Create a register write request with a transaction ID, keep track of it and transmit it.
+//Return true if the addition & transmission goes OK.
+//Return false w/error code if not.
+BOOL ETH_SIRC::createBackgroundParamWriteAndTransmit(uint8_t regNumber, uint32_t value){
+	//The packet will be 6 bytes long inside the envelope (1 byte command + 1 byte address + 4 bytes value)
+    if (!allocateAndFillTaggedPacket(6))
+        return false;
+
+	//Set the command byte to 'k'
+	currentBuffer[0] = 'k';
+
+	//Copy the register address over
+	currentBuffer[1] = regNumber;
+
+	//Copy the value over
+    setValueField(value);
+
+	addBackgroundRequest(currentPacket);
+	armRetransmitTimer(currentPacket, retransmitTimeout(writeTimeout), 1, writeTimeout);
+
+    return sendCurrentPacket(INVALIDPARAMWRITETRANSMIT,false DEBUG_ONLY_1ARG("Background param write"));
+}
+
+//Collect background acks until no more than maxLeftOutstanding requests are still unacknowledged.
+//Whenever a retransmit timer goes off we resend just the requests that timed out.
+//Return true once enough of the acks are in, return false w/error code if not.
+BOOL ETH_SIRC::waitForBackgroundAcks(uint32_t maxLeftOutstanding){
+	PACKET *        Packet;
+
+	while(backgroundTransmits > (int)maxLeftOutstanding){
+        Packet = PacketDriver->GetNextReceivedPacket(nextRetransmitTimeout(writeTimeout));
+        if (Packet == NULL){
+            //Some of the acks did not come back in time, so re-send those.
+            //A request that has already been resent too many times fails the whole thing.
+            if (!resendExpiredPackets(INVALIDWRITETRANSMIT, FAILWRITEACK DEBUG_ONLY_2ARGS("Background",&backgroundResends))) {
+                return false;
+            }
+
+            //We lost something, back off
+            if (resentSequence != 0)
+                closeWriteWindow();
+            continue;
+        }
+
+		//Some packet completed
+        assert(Packet->Mode == PacketModeReceiving);
+        BIGDEBUG_packet_received(Packet,0);
+
+        //Anything but a background ack is too late to matter, just repost the packet
+        (void) checkBackgroundAck(Packet);
+        if (!addReceive(Packet)){
+            //Something went wrong posting a receive, bail out.
+            return bailOut(0);
+        }
+    }
+
+	return true;
+}
+
+//See if this packet is the ack of a request outstanding in the background
+//If so, retire the request and return true.
+//If not, return false.
+BOOL ETH_SIRC::checkBackgroundAck(PACKET* packet){
+	uint8_t *message;
+	uint8_t *testMessage;
+	PACKET *testPacket;
+	uint32_t id;
+	uint16_t length;
+
+	message = packet->Buffer;
+
+	//See if the packet is from the expected source, and has an envelope
+    if (memcmp(message+6,ethHeader.FPGA_MACAddress,6) != 0)
+        return false;
+	if (message[14] != 'T')
+		return false;
+
+	//The ID has to be one we handed out and have not retired yet
+	id = (message[15] << 8) | message[16];
+	if (((id - backgroundHead) & 0xffff) >= backgroundTail - backgroundHead)
+		return false;
+	testPacket = backgroundRing[id & (backgroundSize - 1)];
+	if (testPacket == NULL)
+		return false;
+	testMessage = testPacket->Buffer;
+
+	//The ack is the envelope plus the first 9 bytes of a write (command byte, address and length)
+	// or all 6 bytes of a register write
+	length = TAGLENGTH + ((testMessage[14 + TAGLENGTH] == 'w') ? 9 : 6);
+	if (message[12] != (length >> 8) || message[13] != (length & 0xff))
+		return false;
+	if (memcmp(message+14,testMessage+14,length) != 0)
+		return false;
+
+    BIGDEBUG_packet_matched(testPacket);
+	if (testMessage[14 + TAGLENGTH] == 'w')
+		openWriteWindow();
+	else {
+		//The FPGA has the value now, unless another write to the register is still in flight
+		uint8_t regNumber = testMessage[15 + TAGLENGTH];
+		if (--backgroundRegisters[regNumber] == 0)
+			rememberRegister(regNumber, ((uint32_t)testMessage[16 + TAGLENGTH] << 24) | (testMessage[17 + TAGLENGTH] << 16) |
+										(testMessage[18 + TAGLENGTH] << 8) | testMessage[19 + TAGLENGTH]);
+	}
+
+	stopRetransmitTimer(testPacket);
+	PacketDriver->FreePacket(testPacket,false);
+	backgroundRing[id & (backgroundSize - 1)] = NULL;
+	backgroundTransmits--;
+
+	//Let the head of the ring move past any requests acked out of order
+	while ((backgroundHead != backgroundTail) && (backgroundRing[backgroundHead & (backgroundSize - 1)] == NULL))
+		backgroundHead++;
+
+	//Nothing in flight anymore
+	if (backgroundTransmits == 0)
+		backgroundLow = backgroundHigh = 0;
+	return true;
+}
+
+//Put the requests outstanding in the background into the free list.
+//Their IDs are not reused, so any ack that still shows up for them is ignored.
+void ETH_SIRC::freeBackgroundRequests(void){
+	//Whatever writes are still in flight might or might not have landed
+	if(backgroundHigh != backgroundLow)
+		invalidateShadowRange(backgroundLow, backgroundHigh - backgroundLow);
+	for(uint32_t i = 0; i < 256; i++){
+		if(backgroundRegisters[i])
+			forgetRegister((uint8_t)i);
+	}
+
+	for(uint32_t i = backgroundHead; i != backgroundTail; i++){
+        PACKET *packet = backgroundRing[i & (backgroundSize - 1)];
+        if (packet == NULL)
+            continue;
+        PacketDriver->FreePacket(packet,false);
+        backgroundRing[i & (backgroundSize - 1)] = NULL;
+	}
+    backgroundHead = backgroundTail;
+    backgroundTransmits = 0;
+    backgroundLow = backgroundHigh = 0;
+    memset(backgroundRegisters, 0, sizeof(backgroundRegisters));
+}
+
+//Get the next received packet, same as PacketDriver->GetNextReceivedPacket, except that
+// background acks are taken care of here while we wait for whatever the caller wants.
+//Return NULL on timeout, or w/error code if something went wrong.
+PACKET *ETH_SIRC::getNextReceivedPacket(uint32_t timeOut){
+	PACKET *        Packet;
+	uint32_t startTime = GetTickCount();
+	uint32_t elapsed;
+
+	for(;;){
+        Packet = PacketDriver->GetNextReceivedPacket(timeOut);
+        if (Packet == NULL || backgroundTransmits == 0 || !checkBackgroundAck(Packet))
+            return Packet;
+
+        BIGDEBUG_packet_received(Packet,0);
+        if (!addReceive(Packet))
+            return NULL;
+
+        //Keep waiting for whatever is left of timeOut
+        if (timeOut != INFINITE){
+            elapsed = GetTickCount() - startTime;
+            timeOut = (elapsed < timeOut) ? timeOut - elapsed : 0;
+            startTime += elapsed;
+        }
+    }
+}
+
+//Same as getNextReceivedPacket, for up to maxPackets packets at a time.
+//Only the first packet is waited for, the others are whatever the NIC has ready.
+//Return how many we got, zero on timeout (or w/error code if something went wrong).
+uint32_t ETH_SIRC::getNextReceivedPackets(PACKET **packets, uint32_t maxPackets, uint32_t timeOut){
+	uint32_t count, kept;
+	uint32_t startTime = GetTickCount();
+	uint32_t elapsed;
+
+	for(;;){
+        count = PacketDriver->GetNextReceivedPackets(packets, maxPackets, timeOut);
+        if (count == 0 || backgroundTransmits == 0)
+            return count;
+
+        //Take the background acks out, keep the rest in order at the front
+        kept = 0;
+        for(uint32_t i = 0; i < count; i++){
+            if (backgroundTransmits == 0 || !checkBackgroundAck(packets[i])){
+                packets[kept++] = packets[i];
+                continue;
+            }
+
+            BIGDEBUG_packet_received(packets[i],0);
+            if (!addReceive(packets[i])){
+                //Do not lose the ones we kept
+                (void) addReceives(packets, kept);
+                return 0;
+            }
+        }
+        if (kept != 0)
+            return kept;
+
+        //Keep waiting for whatever is left of timeOut
+        if (timeOut != INFINITE){
+            elapsed = GetTickCount() - startTime;
+            timeOut = (elapsed < timeOut) ? timeOut - elapsed : 0;
+            startTime += elapsed;
+        }
+    }
+}
+
 //Create a read request, add it to the back of the outstanding queue and transmit it.
 //Return true if transmission goes smoothly.
 //Return false with error code if anything goes wrong.
@@ -1174,18 +3189,19 @@ BOOL ETH_SIRC::createReadRequestBackAndTransmit(uint32_t startAddress, uint32_t
     setLengthAndAddress(length,startAddress);
 
 	//Keep track of this message
-	outstandingPackets.push_back(currentPacket);
-	outstandingReadStartAddresses.push_back(startAddress);
-	outstandingReadLengths.push_back(length);
-	outstandingTransmits++;
+	if (!addRequestBack(currentPacket, startAddress, length))
+		return false;
+	setReadOwner(ringTail - 1);
+	armRetransmitTimer(currentPacket, retransmitTimeout(readTimeout), 1, readTimeout);
 
     return sendCurrentPacket(INVALIDREADTRANSMIT,true DEBUG_ONLY_1ARG("Read"));
 }
 
 
-//Create a read request just before the location currently pointed to by the various iterators
-// in the outstandingPacket lists.
-//When we are done, the iterators will point to the location just beyond the read request we just made
+//Create a read request just before the location currently pointed to by ringIter
+// in the scoreboard.  The request is not transmitted yet, its retransmit timer
+// is already expired so resendExpiredPackets will send it.
+//When we are done, ringIter will point to the location just beyond the read request we just made
 //Return true if the addition went smoothly.
 //Return false w/error code if not.
 BOOL ETH_SIRC::createReadRequestCurrentIterLocation(uint32_t startAddress, uint32_t length){
@@ -1200,126 +3216,125 @@ BOOL ETH_SIRC::createReadRequestCurrentIterLocation(uint32_t startAddress, uint3
     setLengthAndAddress(length,startAddress);
 
 	//Keep track of this message
-	packetIter = outstandingPackets.insert(packetIter, currentPacket);
-	startAddressIter = outstandingReadStartAddresses.insert(startAddressIter, startAddress);
-	lengthIter = outstandingReadLengths.insert(lengthIter, length);
+	if (!addRequestCurrentIterLocation(currentPacket, startAddress, length))
+		return false;
 
-	incrementCurrIterLocation();
-	outstandingTransmits++;
+	//This one goes out with the next round of retransmissions
+	armRetransmitTimer(currentPacket, retransmitTimeout(readTimeout), 0, readTimeout);
 	return true;
 }
 
-// We have sent out one or more read requests (in strictly increasing addresses).
-// The transmitted request packets are in outstandingPackets and the corresponding starting address
-//	and length of the requests are in outstandingReadStartAddresses and outstandingReadLengths.
-// We pass this function the initial start address of the entire read so that we know what the
-//  offset should be within the buffer for subsequent read request replies.
+// We have sent out one or more read requests.
+// The transmitted request packets are in the scoreboard, along with the corresponding starting address
+//	and length of the requests.
 // Try any grab as many read responses as we can till:
 //	1) we get all of the reads back that we asked for, return true
-//	2) we haven't gotten a new ack for N seconds (N should never be less than 1), return false
-//		and outstandingPacket/ReadStartAddress/ReadLength will be loaded with the resends
+//	2) the retransmit timer of some outstanding request goes off, we haven't gotten a new
+//		response for N seconds (N should never be less than 1), or every request has sent back
+//		its last response and no stragglers show up, return false and the scoreboard will be
+//		loaded with the resends
 // 3) we have some problem on the completion port or addReceive, return false w/ error code
-BOOL ETH_SIRC::receiveReadResponses(uint32_t initialStartAddress, uint8_t *buffer){
-	PACKET *        Packet;
-
-	//Let's keep track of where we are in the list of outstanding packets.
-	//These iterators will always point to the lowest-address request still outstanding
-	// (that is, we have not seen a response to it, nor anything with a higher requested address than it).
-	//Since this is a sorted list, any packet earlier in the list will only have requests
-	// from lower addresses.
-	packetIter = outstandingPackets.begin();
-	startAddressIter = outstandingReadStartAddresses.begin();
-	lengthIter = outstandingReadLengths.begin();
-
-	//This is the starting address we are expecting
-	uint32_t currAddress = 0;
-	uint32_t currLength = 0;
-
-	noResends = true;
+BOOL ETH_SIRC::receiveReadResponses(READ_SINK sink, void *context){
+	PACKET *        Packets[RECEIVEBATCH];
+	uint32_t        count;
+	uint32_t        timeout;
+	BOOL            done;
+	int8_t          err;
 
 	for(;;){
-        Packet = PacketDriver->GetNextReceivedPacket(readTimeout);
-        if (Packet == NULL)
+        //Once every request has sent back its last response, only wait a little for stragglers.
+        if (outstandingTransmits == 0)
+            timeout = READREORDERDELAY;
+        else
+            timeout = nextRetransmitTimeout(retransmitTimeout(readTimeout));
+
+        count = getNextReceivedPackets(Packets, RECEIVEBATCH, timeout);
+        if (count == 0)
             break;
 
-		//Some packet completed
-        assert(Packet->Mode == PacketModeReceiving);
-        BIGDEBUG_packet_received(Packet,0);
-
-        //Check if this is any read response packet we are expecting.
-        //If it is, copy the data to the buffer, update the currAddress/currLength,
-        // and update the outstanding packet list (removing or adding as necessary).
-        if(checkReadData(Packet, &currAddress, &currLength, buffer, initialStartAddress)){
-
-            //This is a good read response, so repost the packet
-            if (addReceive(Packet)){
-                //We know we are done if there are no more transmits outstanding and the
-                // currLength == 0
-                if(outstandingTransmits == 0 && currLength == 0){
-                    return true;
-                }
-                //We know we are done for now if we are at the end of the outstanding queue and we have
-                // currLength == 0).  No sense in waiting to time out, we know that we had some problems
-                // and we want to resend.
-                if(packetIter == outstandingPackets.end() && currLength == 0){
+        done = false;
+        err = 0;
+        for(uint32_t i = 0; i < count; i++){
+            //Some packet completed
+            assert(Packets[i]->Mode == PacketModeReceiving);
+            BIGDEBUG_packet_received(Packets[i],0);
+
+            //Check if this is any read response packet we are expecting.
+            //If it is, hand the data to the sink, check it off in the bitmap
+            // and retire the request that asked for it once it has sent back everything.
+            if(checkReadData(Packets[i], sink, context)){
+                //We know we are done if every byte has come back.
+                //Whatever else is in the batch is a straggler.
+                if(readBytesMissing == 0){
+                    done = true;
                     break;
                 }
-
                 //We are not done, keep going.
                 continue;
             }
 
-            //Something went wrong posting a receive, bail out.
+            //This was not a good read response, skip it unless checkReadData had a problem
+            err = getLastError();
+            if(err != 0)
+                break;
+        }
+
+        //Repost the whole batch, good or not
+        if (!addReceives(Packets, count)){
             return false;
         }
-        else{
-            //This was not a good read response, so just free the packet and go back around
-            int8_t err = getLastError();
 
-            //repost the packet
-            if (!addReceive(Packet)){
-                return false;
-            }
+        if(err != 0){
+            //checkReadData had some sort of problem, so return
+            setLastError(err);
+            return false;
+        }
 
-            if(err != 0){
-                //checkReadData had some sort of problem, so return
-                setLastError(err);
-                return false;
+        if(done){
+            //Anything still outstanding crossed a response that got here first.
+            for(uint32_t i = ringHead; i != ringTail; i++){
+                PACKET *packet = requestAt(i)->packet;
+                if(packet == NULL)
+                    continue;
+                //Not its own response, don't time it
+                packet->UserState2 = NULL;
+                markPacketAcked(packet);
+                removeRequest(i);
             }
+            return true;
         }
     }
 
-	//We timed out. Any outstanding requests still in the outstanding list should be
+	//We timed out, or ran out of stragglers. Any outstanding requests whose timers went off should be
 	// re-sent.  This will be taken care of when we return from this function.
-	//However, we have to add a re-send request for any remaining part of the current request, if any.
-	//We have a current request if currLength is not zero.
-	if(currLength != 0){
-		//Add a new request before the current location.
-		if(!createReadRequestCurrentIterLocation(currAddress, currLength)){
-			return false;
-		}
+	//However, we have to ask again for any holes no request is covering anymore.
+	if(!requestReadHoles()){
+		return false;
 	}
 	return false;
 }
 
 //This function looks at the packet we have been sent and determines if the packet
-//	is a response to any of the outstanding read requests we have.
+//	is a response to the read in progress.
 //If it it not a response to a read request, we will return false.
-//If it is a response, we copy the data to the buffer in the correct location, update 
-// currAddress & currLength, and add or remove any necessary read requests from the
-// outstanding list.  If this goes OK, we will return true.  If anything goes wrong
-// we will return false with an error code.
-BOOL ETH_SIRC::checkReadData(PACKET* packet, uint32_t* currAddress, uint32_t* currLength, 
-							 uint8_t* buffer, uint32_t initialStartAddress){
+//If it is a response, we hand the new data to the sink with its offset in the read, check it off
+// in the bitmap, and retire the request that asked for it if this was its last response.
+// If this goes OK, we will return true.  If anything goes wrong we will return false with
+// an error code.
+BOOL ETH_SIRC::checkReadData(PACKET* packet, READ_SINK sink, void *context){
 	uint8_t *message = packet->Buffer;
 
 	uint32_t dataLength;
 	uint32_t startAddress;
+	uint32_t offset;
+	uint32_t length;
+	uint32_t end;
+	uint32_t from, to;
+	uint32_t index;
+	uint32_t oldNextAddress;
+	REQUEST *request;
 	int i;
 
-	//When we enter this function, packetIter will always be pointing at a request for which 
-	// we have not seen any responses.  This is because as soon as we see any 
-	// response from a given request, we remove it from the list.
 	//First, see if this is a valid read response
 	//See if the packet is from the expected source
     if (memcmp(message+6,ethHeader.FPGA_MACAddress,6) != 0)
@@ -1344,188 +3359,519 @@ BOOL ETH_SIRC::checkReadData(PACKET* packet, uint32_t* currAddress, uint32_t* cu
 		startAddress += message[15 + i];
 	}
 
-	//This is probably a valid read response, let's try to match it up
-	for(;;){
-        //If currLength == 0, the request at packetIter is a new one and we are hoping to get
-        //		responses for it.  currAddress does not have any meaningful value in it yet.
-		if(*currLength == 0){
-			//	If this is the case, we should update currAddress and currLength with the
-			//		values from the request at packetIter.
-			//See if we are all out of requests.
-			if(lengthIter == outstandingReadLengths.end()){
-				//This only happens when we get responses beyond of the range of the requests we have queued up
-				//If this happens, something is wrong, so just toss out the packet
-				return false;
-			}
+	//It has to lie within the read.
+	//If not, something is wrong (perhaps a late response to some earlier read), so just
+	// toss out the packet.
+	offset = startAddress - readBase;
+	length = dataLength - 5;
+	if(startAddress < readBase || offset >= readLength || length > readLength - offset)
+		return false;
+	end = offset + length;
 
-			*currLength = *lengthIter;
-			*currAddress = *startAddressIter;
-			
-			//	Now, there are a few things that can happen:
-			//	1) we get a response for the beginning of the request at packetIter
-			if(startAddress == *currAddress){
-                LogIt("sirc::crd0 %u %u",startAddress,dataLength-5);
-				//	a) mark the packet acked
-				markPacketAcked(*packetIter);
-				//	b) remove the packet at from the outstanding list
-				removeReadRequestCurrentIterLocation();
-				//	b) copy over the received data to the buffer
-				memcpy(buffer+(startAddress - initialStartAddress), message + 19, dataLength - 5);
-				//	c) update currLength & currAddress
-				*currLength -= dataLength - 5;
-				*currAddress += dataLength - 5;
-				return true;
-			}
-			//	2) we get a response for the middle of the request at packetIter (we missed some
-			//		data for the beginning of the request)
-			if(startAddress > *currAddress && startAddress < *currAddress + *currLength){
-                LogIt("sirc::crd1 %u %u",startAddress,dataLength-5);
-				noResends = false;
-				//	a) mark the packet acked
-				markPacketAcked(*packetIter);
-				//	b) remove the packet at from the outstanding list
-				removeReadRequestCurrentIterLocation();				
-				//	c) create and insert a new read request for the missing piece
-				if(!createReadRequestCurrentIterLocation(*currAddress, startAddress - *currAddress)){
-					return false;
-				}
-				//	d) copy over the data
-				memcpy(buffer+(startAddress - initialStartAddress), message + 19, dataLength - 5);
-				//	e) update currLength & currAddress
-				*currLength -= (startAddress - *currAddress) + dataLength - 5;
-				*currAddress = startAddress + dataLength - 5;
-				return true;
-			}
-			//	3) we get a response for an interval beyond the end of the request at packetIter
-			//		(we missed responses for the entire request)
-			if(startAddress >= *currAddress + *currLength){
-                LogIt("sirc::crd2 %u %u ???",startAddress,dataLength-5);
-				noResends = false;
-				//	a) increment packetIter (leave the old request in the list)
-				incrementCurrIterLocation();
-				//	b) set currLength = 0 (indicate we are trying to consider a new request)
-				*currLength = 0;
-				//	c) go back to the start of the function
+	//Did we get all of it already?  Then a resend crossed the original response.
+	if(isReadRangeReceived(offset, end)){
+		LogIt("sirc::crd dup %u %u",startAddress,length);
+		return true;
+	}
+
+	LogIt("sirc::crd %u %u",startAddress,length);
+	if(isReadRangeMissing(offset, end)){
+		sink(context, offset, message + 19, length);
+		readBytesMissing -= length;
+	}
+	else {
+		//We asked again in chunks of our own, which need not line up with the responses
+		// we got the first time around.  Only hand over what is new.
+		for(from = offset; from < end; from = to){
+			if(isReadByteReceived(from)){
+				to = from + 1;
 				continue;
 			}
-			// 4) we get a response for an interval before the request at packetIter.
-			//		In this case, something has gone wrong (perhaps a delay in the network?)
-			//		Either way, just toss out the packet
-            return false;
+			for(to = from + 1; to < end && !isReadByteReceived(to); to++)
+				;
+			sink(context, from, message + 19 + (from - offset), to - from);
+			readBytesMissing -= to - from;
+		}
+	}
+	markReadRange(offset, end);
+
+	//Check off the request that asked for it, if it is still around
+	if(findReadOwner(offset / readChunkSize, &index)){
+		request = requestAt(index);
+		oldNextAddress = request->nextAddress;
+
+		//The request got through, no need to resend it.
+		//A late response does not move it back.
+		stopRetransmitTimer(request->packet);
+		request->nextAddress = max(request->nextAddress, startAddress + length);
+
+		//Its last response, so it has nothing more to send us
+		if(request->nextAddress == request->startAddress + request->length){
+			markPacketAcked(request->packet);
+			removeRequest(index);
 		}
 
-		//If currLength != 0, we are hoping to get a response at currAddress, a part of a request
-		//		already started.
-
-        //	There are a few things that can happen here:
-        //	1) we get a response for right at currAddress (typical)
-        if(startAddress == *currAddress){
-            //	a) copy over the received data to the buffer
-            LogIt("sirc::crd00 %u %u",startAddress,dataLength-5);
-            memcpy(buffer+(startAddress - initialStartAddress), message + 19, dataLength - 5);
-            //	b) update currLength & currAddress
-            *currLength -= dataLength - 5;
-            *currAddress += dataLength - 5;
-            return true;
-        }
-        //	2) we get a response for the middle between currAddress and currLength (we missed some data
-        //		for the beginning of the request)
-        if(startAddress > *currAddress && startAddress < *currAddress + *currLength){
-            LogIt("sirc::crd01 %u %u",startAddress,dataLength-5);
-            noResends = false;
-            //	a) create and insert a new read request for the missing piece
-            if(!createReadRequestCurrentIterLocation(*currAddress, startAddress - *currAddress)){
-                return false;
-            }
-            //	b) copy over the data
-            memcpy(buffer+(startAddress - initialStartAddress), message + 19, dataLength - 5);
-            //	c) update currLength & currAddress
-            *currLength -= (startAddress - *currAddress) + dataLength - 5;
-            *currAddress = startAddress + dataLength - 5;
-            return true;
-        }
-        // 3) we get a response for an interval beyond the end of the current request
-        //		(we missed the response for the remainder of the current request)
-        if(startAddress >= *currAddress + *currLength){
-            LogIt("sirc::crd02 %u %u ????",startAddress,dataLength-5);
-            noResends = false;
-            //	a) create and insert a new read request for the missing piece of the current request
-            if(!createReadRequestCurrentIterLocation(*currAddress, *currLength)){
-                return false;
-            }
-            //	b) set currLength to zero to indicate we are done with the current request
-            *currLength = 0;
-            //	c) go back to the start of the function
-            continue;
-        }
-        // 4) we get a response for an interval before the current request
-        //		In this case, something has gone wrong (perhaps a delay in the network?)
-        //		Either way, we have probably created a new read request for this packet already,
-        //			
-        //		Either way, just toss out the packet
+#ifdef FASTREADRETRANSMIT
+		//If it moved on, whatever it skipped far enough back that it is not just reordering
+		// got lost, ask for that again right away
+		uint32_t lastChunk = (end - 1) / readChunkSize;
+		if(startAddress + length > oldNextAddress && lastChunk + 1 > READREORDERCHUNKS){
+			uint32_t oldNextChunk = (oldNextAddress - readBase + readChunkSize - 1) / readChunkSize;
+			uint32_t firstChunk = (oldNextChunk > READREORDERCHUNKS) ? oldNextChunk - READREORDERCHUNKS : 0;
+
+			if(!requestLostChunks(firstChunk, lastChunk + 1 - READREORDERCHUNKS, READREORDERCHUNKS
+								  DEBUG_ONLY_1ARG(&readFastResends)))
+				return false;
+		}
+#endif
+	}
+	return true;
+}
+
+//Ask again for all of the holes in the read in progress, in one pass.
+//Requests that got any response have sent back all they are going to, retire them.
+//Requests that never got a response are left for resendExpiredPackets.
+//Return true if the requests go out OK, return false w/error code if not.
+BOOL ETH_SIRC::requestReadHoles(void){
+	for(uint32_t i = ringHead; i != ringTail; i++){
+		PACKET *packet = requestAt(i)->packet;
+		if(packet == NULL || packet->UserState != NULL)
+			continue;
+		markPacketAcked(packet);
+		removeRequest(i);
+	}
+
+	return requestLostChunks(0, readChunkCount, 0);
+}
+
+//Every run of lost chunks between firstChunk and endChunk gets a new request.
+//slack: see isChunkLost.
+//Return true if the requests go out OK, return false w/error code if not.
+BOOL ETH_SIRC::requestLostChunks(uint32_t firstChunk, uint32_t endChunk, uint32_t slack, int *counter){
+	uint32_t chunk, first;
+	uint32_t startAddress, length;
+
+	for(chunk = firstChunk; chunk < endChunk; ){
+		if(!isChunkLost(chunk, slack)){
+			chunk++;
+			continue;
+		}
+
+		first = chunk;
+		while(chunk < endChunk && isChunkLost(chunk, slack))
+			chunk++;
+
+		startAddress = readBase + first * readChunkSize;
+		length = min(chunk * readChunkSize, readLength) - first * readChunkSize;
+		LogIt("sirc::rh %u %u",startAddress,length);
+		DEBUG_ONLY(if (counter) (*counter)++;);
+		if(!createReadRequestBackAndTransmit(startAddress, length))
+			return false;
+	}
+	return true;
+}
+
+//A chunk is lost if it has not come back and no request is going to send it anymore:
+// either nobody is asking for it, or the request that is has sent us more than slack
+// chunks past it (fewer than that could just be reordering).
+BOOL ETH_SIRC::isChunkLost(uint32_t chunk, uint32_t slack){
+	uint32_t index;
+
+	if(isChunkReceived(chunk))
+		return false;
+	if(!findReadOwner(chunk, &index))
+		return true;
+	return requestAt(index)->nextAddress > readBase + (chunk + slack) * readChunkSize;
+}
+
+//Get ready to reassemble a new read, nothing has come back yet.
+void ETH_SIRC::startReadReassembly(uint32_t startAddress, uint32_t length){
+	readBase = startAddress;
+	readLength = length;
+	readChunkSize = MAXREADSIZE(maxPacketSize);
+	readChunkCount = (length + readChunkSize - 1) / readChunkSize;
+	readBytesMissing = length;
+	readBitmap.assign((length + 31) / 32, 0);
+	readOwner.resize(readChunkCount);
+}
+
+//Bits of word w of readBitmap that stand for the bytes from offset to end
+static inline uint32_t readRangeMask(uint32_t w, uint32_t offset, uint32_t end){
+	uint32_t mask = ~0u;
+
+	if(w == (offset >> 5))
+		mask &= ~0u << (offset & 31);
+	if(w == ((end - 1) >> 5))
+		mask &= ~0u >> (31 - ((end - 1) & 31));
+	return mask;
+}
+
+//Have all of the bytes of the read in progress from offset to end come back?
+BOOL ETH_SIRC::isReadRangeReceived(uint32_t offset, uint32_t end){
+	for(uint32_t w = offset >> 5; w <= (end - 1) >> 5; w++){
+		uint32_t mask = readRangeMask(w, offset, end);
+		if((readBitmap[w] & mask) != mask)
+			return false;
+	}
+	return true;
+}
+
+//Has none of them?
+BOOL ETH_SIRC::isReadRangeMissing(uint32_t offset, uint32_t end){
+	for(uint32_t w = offset >> 5; w <= (end - 1) >> 5; w++){
+		if(readBitmap[w] & readRangeMask(w, offset, end))
+			return false;
+	}
+	return true;
+}
+
+//Check them off
+void ETH_SIRC::markReadRange(uint32_t offset, uint32_t end){
+	for(uint32_t w = offset >> 5; w <= (end - 1) >> 5; w++)
+		readBitmap[w] |= readRangeMask(w, offset, end);
+}
+
+//The read request in this ring slot is the one asking for its chunks now.
+//Requests from outside the read in progress (if any) are left alone.
+void ETH_SIRC::setReadOwner(uint32_t index){
+	REQUEST *request = requestAt(index);
+	uint32_t offset = request->startAddress - readBase;
+
+	if(readChunkCount == 0 || request->startAddress < readBase ||
+	   offset >= readLength || request->length > readLength - offset)
+		return;
+
+	for(uint32_t chunk = offset / readChunkSize; chunk * readChunkSize < offset + request->length; chunk++)
+		readOwner[chunk] = index;
+}
+
+//The ring slots moved around, point the chunks back at their requests.
+void ETH_SIRC::rebuildReadOwners(void){
+	if(readChunkCount == 0)
+		return;
+
+	for(uint32_t i = ringHead; i != ringTail; i++){
+		PACKET *packet = requestAt(i)->packet;
+		if(packet != NULL && packet->Buffer[14] == 'r')
+			setReadOwner(i);
+	}
+}
+
+//Is the request that asked for this chunk last still outstanding?
+//If so, return true with its ring slot in *index.
+BOOL ETH_SIRC::findReadOwner(uint32_t chunk, uint32_t *index){
+	uint32_t i = readOwner[chunk];
+	REQUEST *request;
+
+	if(i - ringHead >= ringTail - ringHead)
+		return false;
+
+	request = requestAt(i);
+	if(request->packet == NULL || request->packet->Buffer[14] != 'r')
+		return false;
+	if(readBase + chunk * readChunkSize < request->startAddress ||
+	   readBase + chunk * readChunkSize >= request->startAddress + request->length)
+		return false;
+
+	*index = i;
+	return true;
+}
+
+//Create a register write request, add it to the back of the outstanding queue and transmit it.
+//Return true if the addition & transmission goes OK.
+//Return false w/error code if not.
+BOOL ETH_SIRC::createParamWriteRequestBackAndTransmit(uint8_t regNumber, uint32_t value){
+	//The packet will be 6 bytes long (1 byte command + 1 byte address + 4 bytes length)
+    if (!allocateAndFillPacket(6))
         return false;
+
+	//Set the command byte to 'k'
+	currentBuffer[0] = 'k';
+
+	//Copy the register address over
+	currentBuffer[1] = regNumber;
+	
+	//Copy the value over
+    setValueField(value);
+
+	//Keep track of this message
+	if (!addRequestBack(currentPacket, 0, 0))
+		return false;
+	armRetransmitTimer(currentPacket, retransmitTimeout(writeTimeout), 1, writeTimeout);
+
+    return sendCurrentPacket(INVALIDPARAMWRITETRANSMIT,false DEBUG_ONLY_1ARG("Param write"));
+}
+
+//See if this param write ack matches the one that is outstanding
+//If the packet matches the one in the outstandingPacket list, return true.
+//If not, return false.
+BOOL ETH_SIRC::checkParamWriteAck(PACKET* packet, uint32_t *unused){
+    return checkSimpleResponse(packet, 'k', 6);
+}
+
+//Create a register read request, add it to the back of the outstanding queue and transmit it.
+//The request is retransmitted if no response comes back within timeout msecs.
+//Return true if the addition & transmission goes OK.
+//Return false w/error code if not.
+BOOL ETH_SIRC::createParamReadRequestBackAndTransmit(uint8_t regNumber, uint32_t timeout, uint32_t ceiling){
+
+	//The packet will be 2 bytes long (1 byte command + 1 byte address)
+    if (!allocateAndFillPacket(2))
+        return false;
+
+	//Set the command byte to 'y'
+	currentBuffer[0] = 'y';
+
+	//Copy the register address over
+	currentBuffer[1] = regNumber;
+
+	//Keep track of this message
+	if (!addRequestBack(currentPacket, 0, 0))
+		return false;
+	armRetransmitTimer(currentPacket, timeout, 1, ceiling);
+
+    return sendCurrentPacket(INVALIDPARAMREADTRANSMIT,false DEBUG_ONLY_1ARG("Param read"));
+}
+
+
+//See if this param write ack matches the one that is outstanding
+//If the packet matches the one in the outstandingPacket list, return true.
+//If not, return false.
+BOOL ETH_SIRC::checkParamReadData(PACKET* packet, uint32_t *value){
+    return checkResponseWithValue(packet,value, 'y', ringHead);
+}
+
+//Create a batch param write request, add it to the back of the outstanding queue and transmit it.
+//Return true if the addition & transmission goes OK.
+//Return false w/error code if not.
+BOOL ETH_SIRC::createParamWriteBatchRequestBackAndTransmit(uint32_t count, const uint8_t *regNumbers, const uint32_t *values,
+														   uint32_t timeout, uint32_t ceiling){
+	//The packet will be 1 byte command + 1 byte count + count * (1 byte address + 4 bytes value)
+    if (!allocateAndFillPacket(PARAMWRITEBATCHLENGTH(count)))
+        return false;
+
+	//Set the command byte to 'K'
+	currentBuffer[0] = 'K';
+	currentBuffer[1] = (uint8_t)count;
+
+	//Copy the (address, value) pairs over
+	for(uint32_t i = 0; i < count; i++){
+		uint8_t *pair = currentBuffer + 2 + 5 * i;
+		uint32_t value = values[i];
+
+		pair[0] = regNumbers[i];
+		for(int j = 4; j > 0; j--){
+			pair[j] = value % 256;
+			value = value >> 8;
+		}
+	}
+
+	//Keep track of this message
+	if (!addRequestBack(currentPacket, 0, 0))
+		return false;
+	armRetransmitTimer(currentPacket, timeout, 1, ceiling);
+
+    return sendCurrentPacket(INVALIDPARAMWRITETRANSMIT,false DEBUG_ONLY_1ARG("Param write batch"));
+}
+
+//See if this packet acks the batch param write that is outstanding.
+//The ack is an echo of the whole request.
+BOOL ETH_SIRC::checkParamWriteBatchAck(PACKET* packet, uint32_t *unused){
+	uint8_t *message = packet->Buffer;
+
+	if(message[14] != 'K')
+		return false;
+
+    return checkSimpleResponse(packet, 'K', PARAMWRITEBATCHLENGTH(message[15]));
+}
+
+//Create a batch param read request, add it to the back of the outstanding queue and transmit it.
+//Return true if the addition & transmission goes OK.
+//Return false w/error code if not.
+BOOL ETH_SIRC::createParamReadBatchRequestBackAndTransmit(uint32_t count, const uint8_t *regNumbers,
+														  uint32_t timeout, uint32_t ceiling){
+	//The packet will be 1 byte command + 1 byte count + count * 1 byte address
+    if (!allocateAndFillPacket(PARAMREADBATCHLENGTH(count)))
+        return false;
+
+	//Set the command byte to 'Y'
+	currentBuffer[0] = 'Y';
+	currentBuffer[1] = (uint8_t)count;
+
+	//Copy the register addresses over
+	memcpy(currentBuffer + 2, regNumbers, count);
+
+	//Keep track of this message
+	if (!addRequestBack(currentPacket, 0, 0))
+		return false;
+	armRetransmitTimer(currentPacket, timeout, 1, ceiling);
+
+    return sendCurrentPacket(INVALIDPARAMREADTRANSMIT,false DEBUG_ONLY_1ARG("Param read batch"));
+}
+
+//See if this packet is the response to the batch param read that is outstanding.
+//The response repeats the request, followed by the values in the same order.
+//If it matches, copy the values over and return true.
+//If not, return false.
+BOOL ETH_SIRC::checkParamReadBatchData(PACKET* packet, uint32_t *values){
+	uint8_t *message;
+	uint8_t *testMessage;
+	PACKET *testPacket;
+	uint32_t count;
+
+	message = packet->Buffer;
+
+	//See if the packet is from the expected source
+    if (memcmp(message+6,ethHeader.FPGA_MACAddress,6) != 0)
+        return false;
+
+	//Check the command byte and the length
+	if(message[14] != 'Y')
+		return false;
+	count = message[15];
+	if(message[12] * 256 + message[13] != PARAMWRITEBATCHLENGTH(count))
+		return false;
+
+	//There is only the one request outstanding
+	testPacket = requestAt(ringHead)->packet;
+	if(testPacket == NULL)
+		return false;
+	testMessage = testPacket->Buffer;
+
+	//Check that it is an answer for the registers we asked for
+	if(memcmp(message + 14, testMessage + 14, PARAMREADBATCHLENGTH(count)) != 0)
+		return false;
+
+    BIGDEBUG_packet_matched(testPacket);
+	message += 14 + PARAMREADBATCHLENGTH(count);
+	for(uint32_t i = 0; i < count; i++){
+		values[i] = 0;
+		for(int j = 0; j < 4; j++){
+			values[i] += message[4 * i + j] << (3 - j) * 8;
+		}
 	}
+
+    markPacketAcked(testPacket);
+	removeRequest(ringHead);
+	return true;
 }
 
-//Create a register write request, add it to the back of the outstanding queue and transmit it.
-//Return true if the addition & transmission goes OK.
-//Return false w/error code if not.
-BOOL ETH_SIRC::createParamWriteRequestBackAndTransmit(uint8_t regNumber, uint32_t value){
-	//The packet will be 6 bytes long (1 byte command + 1 byte address + 4 bytes length)
-    if (!allocateAndFillPacket(6))
-        return false;
+//Check everything in a job before we send any of it.
+//Return true if the job looks OK, return false w/error code if not.
+BOOL ETH_SIRC::checkJob(const SIRC::JOB *job){
+	const SIRC::JOB_SEGMENT *segment;
 
-	//Set the command byte to 'k'
-	currentBuffer[0] = 'k';
+	if(!job ||
+	   (job->numInputs && !job->inputs) ||
+	   (job->numOutputs && !job->outputs) ||
+	   (job->numRegisters && (!job->regNumbers || !job->regValues))){
+		setLastError(INVALIDBUFFER);
+		return false;
+	}
 
-	//Copy the register address over
-	currentBuffer[1] = regNumber;
-	
-	//Copy the value over
-    setValueField(value);
+	for(uint32_t i = 0; i < job->numInputs; i++){
+		segment = &job->inputs[i];
+		if(!segment->buffer){
+			setLastError(INVALIDBUFFER);
+			return false;
+		}
+		if(segment->startAddress > maxInputDataBytes){
+			setLastError(INVALIDADDRESS);
+			return false;
+		}
+		if(segment->length == 0 || segment->startAddress + segment->length > maxInputDataBytes){
+			setLastError(INVALIDLENGTH);
+			return false;
+		}
+	}
 
-	//Keep track of this message
-	outstandingPackets.push_back(currentPacket);
-	outstandingTransmits++;
+	for(uint32_t i = 0; i < job->numRegisters; i++){
+		if(!(job->regNumbers[i] < 255)){
+			setLastError(INVALIDADDRESS);
+			return false;
+		}
+	}
 
-    return sendCurrentPacket(INVALIDPARAMWRITETRANSMIT,false DEBUG_ONLY_1ARG("Param write"));
-}
+	for(uint32_t i = 0; i < job->numOutputs; i++){
+		segment = &job->outputs[i];
+		if(!segment->buffer){
+			setLastError(INVALIDBUFFER);
+			return false;
+		}
+		if(segment->startAddress > maxOutputDataBytes){
+			setLastError(INVALIDADDRESS);
+			return false;
+		}
+		if(segment->length == 0 || segment->startAddress + segment->length > maxOutputDataBytes){
+			setLastError(INVALIDLENGTH);
+			return false;
+		}
+	}
 
-//See if this param write ack matches the one that is outstanding
-//If the packet matches the one in the outstandingPacket list, return true.
-//If not, return false.
-BOOL ETH_SIRC::checkParamWriteAck(PACKET* packet, uint32_t *unused){
-    return checkSimpleResponse(packet, 'k', 6);
+	return true;
 }
 
-//Create a register read request, add it to the back of the outstanding queue and transmit it.
-//Return true if the addition & transmission goes OK.
-//Return false w/error code if not.
-BOOL ETH_SIRC::createParamReadRequestBackAndTransmit(uint8_t regNumber){
+//Try and grab the acks for a job's packet train until:
+// 1) nothing is outstanding but (maybe) the run register read, return true
+// 2) the retransmit timer of some outstanding packet goes off, return false
+// 3) we have some problem on the completion port or addReceive, return false w/ error code
+//If the run register read comes back on the way, *gotDone is set and its value is in *doneValue.
+//*runAcked is set once the run command is acked.
+BOOL ETH_SIRC::receiveJobAcks(uint32_t *doneValue, BOOL *gotDone, BOOL *runAcked){
+	PACKET *        Packet;
 
-	//The packet will be 2 bytes long (1 byte command + 1 byte address)
-    if (!allocateAndFillPacket(2))
-        return false;
+	for(;;){
+		//The run register read is the only one that stays outstanding while the FPGA runs
+		if(outstandingTransmits == (*gotDone ? 0 : 1))
+			return true;
 
-	//Set the command byte to 'y'
-	currentBuffer[0] = 'y';
+        Packet = PacketDriver->GetNextReceivedPacket(nextRetransmitTimeout(writeTimeout));
+        if (Packet == NULL)
+            break;
 
-	//Copy the register address over
-	currentBuffer[1] = regNumber;
+		//Some packet completed
+        assert(Packet->Mode == PacketModeReceiving);
+        BIGDEBUG_packet_received(Packet,0);
 
-	//Keep track of this message
-	outstandingPackets.push_back(currentPacket);
-	outstandingTransmits++;
+        //Check it off if it acks something we sent, either way repost the receive packet.
+        (void) checkJobAck(Packet, doneValue, gotDone, runAcked);
+        if (!addReceive(Packet)){
+            return false;
+        }
+    }
 
-    return sendCurrentPacket(INVALIDPARAMREADTRANSMIT,false DEBUG_ONLY_1ARG("Param read"));
+	//This return false is not an error per se, we just timed out
+	return false;
 }
 
-
-//See if this param write ack matches the one that is outstanding
-//If the packet matches the one in the outstandingPacket list, return true.
+//See if this packet acks any of the packets of a job that are outstanding.
+//If the packet matches one in the outstandingPacket list, return true.
 //If not, return false.
-BOOL ETH_SIRC::checkParamReadData(PACKET* packet, uint32_t *value){
-    return checkResponseWithValue(packet,value, 'y');
+BOOL ETH_SIRC::checkJobAck(PACKET* packet, uint32_t *doneValue, BOOL *gotDone, BOOL *runAcked){
+	switch(packet->Buffer[14]){
+	case 'w':
+		if(!checkWriteAck(packet))
+			return false;
+		openWriteWindow();
+		return true;
+	case 'K':
+		return checkParamWriteBatchAck(packet, NULL);
+	case 'k':
+		if(!checkParamWriteAck(packet, NULL))
+			return false;
+		//Job registers are all below 255, this is the run
+		if(packet->Buffer[15] == 255)
+			*runAcked = true;
+		return true;
+	case 'y':
+		//The run register read went out last
+		if(*gotDone || !checkResponseWithValue(packet, doneValue, 'y', ringTail - 1))
+			return false;
+		*gotDone = true;
+		return true;
+	default:
+		return false;
+	}
 }
 
 //Create a write and run request, add it to the back of the outstanding queue and transmit it.
@@ -1542,13 +3888,13 @@ BOOL ETH_SIRC::createWriteAndRunRequestBackAndTransmit(uint32_t startAddress, ui
 
     setLengthAndAddress(length,startAddress);
 
-	//Copy the write data over
-	memcpy(currentBuffer + 9, buffer, length);
+	//The write data goes straight out of the caller's buffer
+    setPayloadReference(buffer, length);
 
 	//Keep track of this message
     //It will be handled specially though (in receiveWriteAndRunAcks)
-	outstandingPackets.push_back(currentPacket);
-	outstandingTransmits++;
+	if (!addRequestBack(currentPacket, 0, 0))
+		return false;
 
     return sendCurrentPacket(INVALIDWRITEANDRUNTRANSMIT,false DEBUG_ONLY_1ARG("Write and run"));
 }
@@ -1563,23 +3909,22 @@ BOOL ETH_SIRC::createWriteAndRunRequestBackAndTransmit(uint32_t startAddress, ui
 //		Set lastError to FAILWRITEANDRUNCAPACITY, set outputLength to the total length of the response and return false
 // 4) We miss some reponse, regardless of whether or not it would fit in the output buffer
 //		Set lastError to FAILREADACK, set outputLength to the total length of the response, put the requests for the
-//		missing parts (except those that wouldn't fit in the output buffer) into outstandingPackets, 
-//		outstandingReadStartAddresses and outstandingReadLengths, and return false
+//		missing parts (except those that wouldn't fit in the output buffer) into the scoreboard,
+//		and return false
 // 5) We have some other technical problem like the other receiveXXX functions.
 //		Set lastError appropriately and return false.
 BOOL ETH_SIRC::receiveWriteAndRunAcks(uint32_t maxWaitTimeInMsec, uint32_t maxOutLength, uint8_t *buffer, uint32_t *outputLength){
 	PACKET *        Packet;
 
-	//Let's keep track of where we are in the list of outstanding packets.
+	//Let's keep track of where we are in the scoreboard.
 
     //If we hear anything at all the 'g' command was received.
-    //That implicitly acks the corresponding xmit packet.
-    bool firstPacket = true;//outstandingPackets.front()?
+    //That implicitly acks the corresponding xmit packet, which is the only one in the scoreboard.
+    bool firstPacket = true;
+    uint32_t commandSlot = ringHead;
 
-	//We will add requests, though, as we miss packets.
-	packetIter = outstandingPackets.begin();
-	startAddressIter = outstandingReadStartAddresses.begin();
-	lengthIter = outstandingReadLengths.begin();
+	//We will add requests, though, as we miss packets.  They go after the command.
+	ringIter = ringTail;
 
 	//This is the starting address we are expecting
 	uint32_t currAddress = 0;
@@ -1606,9 +3951,8 @@ BOOL ETH_SIRC::receiveWriteAndRunAcks(uint32_t maxWaitTimeInMsec, uint32_t maxOu
 	        //That is the packet at the head of the queue, free it now.
 	        if (firstPacket) {
 		        firstPacket = false;
-			    markPacketAcked(*packetIter);
-				outstandingPackets.erase(packetIter);
-				packetIter = outstandingPackets.begin();
+			    markPacketAcked(requestAt(commandSlot)->packet);
+				removeRequest(commandSlot);
 			}
 
             if (addReceive(Packet)){
@@ -1623,6 +3967,9 @@ BOOL ETH_SIRC::receiveWriteAndRunAcks(uint32_t maxWaitTimeInMsec, uint32_t maxOu
                 //	3) we missed at least one packet somewhere down the line, regardless if the output could fit
                 //		or not (lastError == FAILREADACK and we return false)
                 if(currLength == 0){
+                    //Late responses might have filled in all of the holes we saw
+                    if(getLastError() == FAILWRITEANDRUNREADACK && outstandingTransmits == 0)
+                        setLastError(okCapacity ? 0 : FAILWRITEANDRUNCAPACITY);
                     return(getLastError() == 0);
                 }
 
@@ -1648,10 +3995,9 @@ BOOL ETH_SIRC::receiveWriteAndRunAcks(uint32_t maxWaitTimeInMsec, uint32_t maxOu
 
     //If we saw no response at all we must free that xmit packet now.
     if (firstPacket) {
-        markPacketAcked(*packetIter);
-        outstandingPackets.erase(packetIter);
+        markPacketAcked(requestAt(commandSlot)->packet);
+        removeRequest(commandSlot);
     }
-	//packetIter = outstandingPackets.begin();//quick hack: BUGBUG recheck
 
 	//We timed out.
 	//Have we seen any response yet?  If not, let's return a FAILWRITEACK error
@@ -1765,9 +4111,11 @@ BOOL ETH_SIRC::checkWriteAndRunData(PACKET* packet, uint32_t* currAddress, uint3
 		*currLength -= startAddress - *currAddress;
 	}
 	else if(startAddress < *currAddress){
-		//This is data we were expecting earlier.  We have already put in another
-		//	request for it, so just ignore this packet.
-		return false;
+		//This is data we were expecting earlier, it got here late.
+		//If we have put in another request for it, take that out (the network reordered
+		//	the packets rather than losing them).  Otherwise it is a duplicate, so just
+		//	ignore this packet.
+		return fillWriteAndRunHole(startAddress, dataLength - 9, message + 23, buffer, maxOutLength);
 	}
 
 	//		3) copy the data to the buffer in the correct location and update 
@@ -1779,6 +4127,64 @@ BOOL ETH_SIRC::checkWriteAndRunData(PACKET* packet, uint32_t* currAddress, uint3
 	return true;
 }
 
+//A write & run response came in late, see if it fills (part of) a hole we have put
+// in a read request for.  Those requests have not gone out yet.
+//If so, copy the data to the buffer, trim the request and return true.
+//If not, it is a duplicate, return false.
+//Return false w/error code if anything goes wrong.
+BOOL ETH_SIRC::fillWriteAndRunHole(uint32_t startAddress, uint32_t length, uint8_t *data,
+								   uint8_t *buffer, uint32_t maxOutLength){
+	REQUEST *request;
+	uint32_t holeStart;
+	uint32_t holeEnd;
+	uint32_t endAddress;
+
+	for(uint32_t i = ringHead; i != ringTail; i++){
+		request = requestAt(i);
+		if(request->packet == NULL || request->packet->Buffer[14] != 'r')
+			continue;
+
+		holeStart = request->startAddress;
+		holeEnd = holeStart + request->length;
+		if(startAddress < holeStart || startAddress >= holeEnd)
+			continue;
+
+		endAddress = min(startAddress + length, holeEnd);
+		LogIt("sirc::cwr late %u %u",startAddress,endAddress - startAddress);
+		if(startAddress < maxOutLength)
+			memcpy(buffer + startAddress, data, min(endAddress, maxOutLength) - startAddress);
+
+		if(startAddress == holeStart && endAddress == holeEnd){
+			//Filled it all in
+			markPacketAcked(request->packet);
+			removeRequest(i);
+		}
+		else if(startAddress == holeStart){
+			setReadRequestRange(i, endAddress, holeEnd - endAddress);
+		}
+		else{
+			setReadRequestRange(i, holeStart, startAddress - holeStart);
+			//Filled in the middle, ask for the rest separately
+			if(endAddress < holeEnd && !createReadRequestCurrentIterLocation(endAddress, holeEnd - endAddress))
+				return false;
+		}
+		return true;
+	}
+	return false;
+}
+
+//Point the read request in this ring slot, which has not gone out yet, at a different range
+void ETH_SIRC::setReadRequestRange(uint32_t index, uint32_t startAddress, uint32_t length){
+	REQUEST *request = requestAt(index);
+
+	request->startAddress = startAddress;
+	request->length = length;
+	request->nextAddress = startAddress;
+
+	currentPacket = request->packet;
+	currentBuffer = &(currentPacket->Buffer[14]);
+	setLengthAndAddress(length, startAddress);
+}
 
 //Create a reset request, add it to the back of the outstanding queue and transmit it.
 //Return true if the addition & transmission goes OK.
@@ -1793,8 +4199,10 @@ BOOL ETH_SIRC::createResetRequestAndTransmit(){
 	currentBuffer[0] = 'm';
 
 	//Keep track of this message
-	outstandingPackets.push_back(currentPacket);
-	outstandingTransmits++;
+	if (!addRequestBack(currentPacket, 0, 0))
+		return false;
+	//The reset in the constructor is also our first round trip measurement
+	armRetransmitTimer(currentPacket, retransmitTimeout(writeTimeout), 1, writeTimeout);
 
     return sendCurrentPacket(INVALIDRESETTRANSMIT,false DEBUG_ONLY_1ARG("Reset"));
 }
@@ -1807,12 +4215,118 @@ BOOL ETH_SIRC::checkResetAck(PACKET* packet, uint32_t *unused){
     return checkSimpleResponse(packet,'m',1);
 }
 
+//Create a frame size request, add it to the back of the outstanding queue and transmit it.
+//Return true if the addition & transmission goes OK.
+//Return false w/error code if not.
+BOOL ETH_SIRC::createFrameSizeRequestAndTransmit(uint32_t frameSize){
+
+	//The packet will be 5 bytes long (1 byte command + 4 bytes frame size)
+    if (!allocateAndFillPacket(5))
+        return false;
+
+	//Set the command byte to 'n'
+	currentBuffer[0] = 'n';
+
+	//Copy the frame size over (1-4)
+#if defined(_MSC_VER) || defined(__GNUC__) //other compilers might not
+    *(uint32_t*)(currentBuffer+1) = _byteswap_ulong(frameSize);
+#else
+	for(int i = 3; i >=0; i--){
+		currentBuffer[i + 1] = frameSize % 256;
+		frameSize = frameSize >> 8;
+	}
+#endif
+
+	//Keep track of this message
+	if (!addRequestBack(currentPacket, 0, 0))
+		return false;
+	armRetransmitTimer(currentPacket, NEGOTIATETIMEOUT, 1);
+
+    return sendCurrentPacket(INVALIDFRAMESIZETRANSMIT,false DEBUG_ONLY_1ARG("Frame size"));
+}
+
+//See if this packet answers the frame size request that is outstanding
+//If it does, return true and the frame size the FPGA agreed to.
+//If not, return false.
+BOOL ETH_SIRC::checkFrameSizeResponse(PACKET* packet, uint32_t *frameSize){
+	uint8_t *message;
+	PACKET *testPacket;
+
+	message = packet->Buffer;
+
+	//See if the packet is from the expected source
+    if (memcmp(message+6,ethHeader.FPGA_MACAddress,6) != 0)
+        return false;
+
+	//This should be exactly 5 bytes long (command byte + frame size)
+	if(message[12] != 0 || message[13] != 5 || message[14] != 'n')
+		return false;
+
+	//There is only the one request outstanding
+	testPacket = requestAt(ringHead)->packet;
+	if(testPacket == NULL || testPacket->Buffer[14] != 'n')
+		return false;
+
+    BIGDEBUG_packet_matched(testPacket);
+	*frameSize = 0;
+	for(int i = 0; i < 4; i++){
+		*frameSize += message[i + 15] << (3 - i) * 8;
+	}
+
+    markPacketAcked(testPacket);
+	removeRequest(ringHead);
+	return true;
+}
+
+//Create a transaction ID request, add it to the back of the outstanding queue and transmit it.
+//Return true if the addition & transmission goes OK.
+//Return false w/error code if not.
+BOOL ETH_SIRC::createTransactionIdRequestAndTransmit(){
+
+	//The packet will be 1 bytes long (1 byte command)
+    if (!allocateAndFillPacket(1))
+        return false;
+
+	//Set the command byte to 't'
+	currentBuffer[0] = 't';
+
+	//Keep track of this message
+	if (!addRequestBack(currentPacket, 0, 0))
+		return false;
+	armRetransmitTimer(currentPacket, NEGOTIATETIMEOUT, 1);
+
+    return sendCurrentPacket(INVALIDTRANSACTIONIDTRANSMIT,false DEBUG_ONLY_1ARG("Transaction ID"));
+}
+
+//See if this packet answers the transaction ID request that is outstanding
+//If it does, return true.
+//If not, return false.
+BOOL ETH_SIRC::checkTransactionIdResponse(PACKET* packet, uint32_t *unused){
+    return checkSimpleResponse(packet,'t',1);
+}
+
+//See if this packet is a done notification from the FPGA.
+//Nothing is outstanding for it, it is just a hint to go read the run register.
+BOOL ETH_SIRC::checkDoneNotification(PACKET* packet, uint32_t *unused){
+	uint8_t *message;
+
+	message = packet->Buffer;
+
+	//See if the packet is from the expected source
+    if (memcmp(message+6,ethHeader.FPGA_MACAddress,6) != 0)
+        return false;
+
+	//This should be exactly 1 byte long
+	return (message[12] == 0 && message[13] == 1 && message[14] == 'd');
+}
+
 //Generic method for receiving and checking a response packet
-BOOL ETH_SIRC::receiveGenericAck(uint32_t timeOut, uint32_t *arg2, BOOL (ETH_SIRC::*checkFunction)(PACKET*,uint32_t *),int errorCode){
+//Returns false w/o an error code if the retransmit timer goes off before we get the response.
+BOOL ETH_SIRC::receiveGenericAck(uint32_t timeOut, uint32_t *arg2, BOOL (ETH_SIRC::*checkFunction)(PACKET*,uint32_t *)){
 	PACKET *        Packet;
 
 	for(;;){
-        Packet = PacketDriver->GetNextReceivedPacket(timeOut);
+        Packet = getNextReceivedPacket(nextRetransmitTimeout(timeOut));
         if (Packet == NULL)
             break;
 
@@ -1838,16 +4352,15 @@ BOOL ETH_SIRC::receiveGenericAck(uint32_t timeOut, uint32_t *arg2, BOOL (ETH_SIR
         }
     }
 
-	//We did not receive the ack we wanted, error out.
-    setLastError(errorCode);
+	//This return false is not an error per se, we just timed out
 	return false;
 
 }
 
-//See if this packet matches the register read that is outstanding
+//See if this packet matches the register read that is outstanding in slot index of the ring
 //If the packet matches the one in the outstandingPacket list, return true.
 //If not, return false.
-BOOL ETH_SIRC::checkResponseWithValue(PACKET *packet, uint32_t *value, uint8_t commandCode)
+BOOL ETH_SIRC::checkResponseWithValue(PACKET *packet, uint32_t *value, uint8_t commandCode, uint32_t index)
 {
 	uint8_t *message;
 	uint8_t *testMessage;
@@ -1869,8 +4382,10 @@ BOOL ETH_SIRC::checkResponseWithValue(PACKET *packet, uint32_t *value, uint8_t c
 	if(message[14] != commandCode)
 		return false;
 
-	//So far, so good - let's try to match this against the one outstanding write
-	testPacket = outstandingPackets.front();
+	//So far, so good - let's try to match this against the one outstanding read
+	testPacket = requestAt(index)->packet;
+	if(testPacket == NULL)
+		return false;
 	testMessage = testPacket->Buffer;
 
 	//Check if we recognize reg address
@@ -1886,7 +4401,7 @@ BOOL ETH_SIRC::checkResponseWithValue(PACKET *packet, uint32_t *value, uint8_t c
         markPacketAcked(testPacket);
 
 		//remove this from the outstanding packets
-		outstandingPackets.pop_front();
+		removeRequest(index);
 
 		return true;
 	}
@@ -1897,7 +4412,7 @@ BOOL ETH_SIRC::checkResponseWithValue(PACKET *packet, uint32_t *value, uint8_t c
 //See if this message matches a register register write ack that is outstanding
 //If the packet matches the one in the outstandingPacket list, return true.
 //If not, return false.
-BOOL ETH_SIRC::checkSimpleResponse(PACKET *packet, uint8_t commandCode, uint8_t length)
+BOOL ETH_SIRC::checkSimpleResponse(PACKET *packet, uint8_t commandCode, uint16_t length)
 {
 	uint8_t *message;
 	uint8_t *testMessage;
@@ -1910,14 +4425,18 @@ BOOL ETH_SIRC::checkSimpleResponse(PACKET *packet, uint8_t commandCode, uint8_t
 
 	//See if the packet is the correct length
 	//This should be exactly length bytes long
-	if(message[12] != 0 || message[13] != length)
+	if(message[12] != (length >> 8) || message[13] != (length & 0xff))
 		return false;
 
 	//So far, so good - let's try to match this against one of the outstanding requests
-	//We add the newest packets sent to the end of the list, so the oldest (and likely first to be acked)
-	// packets should be near the front.
-	for(packetIter = outstandingPackets.begin(); packetIter != outstandingPackets.end(); packetIter++){
-        PACKET *testPacket = *packetIter;
+	//We add the newest packets sent to the tail of the ring, so the oldest (and likely first to be acked)
+	// packets should be near the head.
+	for(uint32_t i = ringHead; i != ringTail; i++){
+        PACKET *testPacket = requestAt(i)->packet;
+
+        //Acked out of order already
+        if (testPacket == NULL)
+            continue;
 
 		testMessage = testPacket->Buffer;
 
@@ -1929,7 +4448,7 @@ BOOL ETH_SIRC::checkSimpleResponse(PACKET *packet, uint8_t commandCode, uint8_t
             markPacketAcked(testPacket);
 
             //remove this from the outstanding packets
-            outstandingPackets.erase(packetIter);
+            removeRequest(i);
 
             return true;
         }
@@ -1938,46 +4457,321 @@ BOOL ETH_SIRC::checkSimpleResponse(PACKET *packet, uint8_t commandCode, uint8_t
 	return false;
 }
 
+//Order the retransmit timers so the one that goes off first is at the top of the heap
+bool ETH_SIRC::laterDeadline(const RETRANSMIT_TIMER &a, const RETRANSMIT_TIMER &b){
+    return (int32_t)(a.deadline - b.deadline) > 0;
+}
+
+//Start the retransmit timer for a packet that has been sent transmits times so far.
+//A packet that has not been sent yet (transmits == 0) is due right away.
+//If ceiling is not zero the timeout is adaptive: it doubles on every retransmission up
+// to ceiling, and the first transmission is timed to update the round trip estimate.
+//Otherwise the timeout is fixed (e.g. the response waits for the FPGA to finish running).
+void ETH_SIRC::armRetransmitTimer(PACKET *packet, uint32_t timeout, uint32_t transmits, uint32_t ceiling){
+    RETRANSMIT_TIMER timer;
+    uint32_t slot = (uint32_t)(UINT_PTR)packet->UserState;
+
+    //Zero means "no timer running"
+    if (++timerSequence == 0)
+        timerSequence++;
+
+    timer.deadline  = GetTickCount() + ((transmits) ? timeout : 0);
+    timer.sequence  = timerSequence;
+    timer.timeout   = timeout;
+    timer.ceiling   = ceiling;
+    timer.transmits = transmits;
+    timer.packet    = packet;
+
+    //The packet keeps its slot across retransmissions, the slot remembers which timer
+    // is the live one.  Acking the packet gives the slot back.
+    if (slot == 0){
+        if (freeTimerSlots.empty()){
+            timerSlots.push_back(0);
+            slot = (uint32_t)timerSlots.size();
+        }
+        else {
+            slot = freeTimerSlots.back() + 1;
+            freeTimerSlots.pop_back();
+        }
+        packet->UserState = (void *)(UINT_PTR)slot;
+    }
+    timer.slot = slot - 1;
+    timerSlots[timer.slot] = timerSequence;
+
+    //Only time packets that were sent just once, an ack for a retransmitted
+    // packet could be for any of the copies (Karn's algorithm).
+    //Zero means "not timed"
+    if (ceiling && transmits == 1){
+        uint32_t now = getMicroseconds();
+        packet->UserState2 = (void *)(UINT_PTR)((now) ? now : 1);
+    }
+    else
+        packet->UserState2 = NULL;
+
+    retransmitTimers.push_back(timer);
+    push_heap(retransmitTimers.begin(), retransmitTimers.end(), laterDeadline);
+}
+
+//How long can we wait for a response before the next retransmit timer goes off?
+//If there are no timers running we wait for idleTimeout, but never longer.
+uint32_t ETH_SIRC::nextRetransmitTimeout(uint32_t idleTimeout){
+    int32_t timeLeft;
+
+    //Weed out the timers of packets that have been acked already
+    while (!retransmitTimers.empty() && !isTimerLive(retransmitTimers.front())){
+        pop_heap(retransmitTimers.begin(), retransmitTimers.end(), laterDeadline);
+        retransmitTimers.pop_back();
+    }
+
+    if (retransmitTimers.empty())
+        return idleTimeout;
+
+    timeLeft = (int32_t)(retransmitTimers.front().deadline - GetTickCount());
+    if (timeLeft <= 0)
+        return 0;
+
+    return min((uint32_t)timeLeft, idleTimeout);
+}
+
 //Common function to handle retransmissions
-BOOL ETH_SIRC::resendOutstandingPackets(int errorCode, char *callerName, int *counter){
-    for(packetIter = outstandingPackets.begin(); packetIter != outstandingPackets.end(); packetIter++){
-        PACKET *packet = *packetIter;
+//Only the packets whose timer has gone off are retransmitted, everybody else keeps waiting.
+//If an expired packet has already been resent maxRetries times, fail with failCode.
+BOOL ETH_SIRC::resendExpiredPackets(int errorCode, int failCode, char *callerName, int *counter){
+    uint32_t now = GetTickCount();
+
+    resentSequence = 0;
+
+    while (!retransmitTimers.empty()){
+        RETRANSMIT_TIMER timer = retransmitTimers.front();
+
+        //Is the earliest timer still running?  Then so are all the others.
+        if (isTimerLive(timer) && (int32_t)(timer.deadline - now) > 0)
+            break;
+
+        pop_heap(retransmitTimers.begin(), retransmitTimers.end(), laterDeadline);
+        retransmitTimers.pop_back();
+
+        //Already acked
+        if (!isTimerLive(timer))
+            continue;
+
+        //Short adaptive timeouts are not counted against maxRetries until they have backed off
+        // all the way to the ceiling, a slow FPGA gets at least as long as with fixed timeouts.
+        if (timer.transmits > maxRetries && timer.timeout >= timer.ceiling){
+            //We have resent too many times
+            PRINTF(("%s resent too many times without response!\n",callerName));
+            return bailOut(failCode);
+        }
 
         //Increment the proper debug counter
-        DEBUG_ONLY(*counter++;);
+        DEBUG_ONLY(if (timer.transmits) (*counter)++;);
+
+        //Remember the most recent (re)transmission that got lost
+        if (timer.transmits && (resentSequence == 0 || (int32_t)(timer.sequence - resentSequence) > 0))
+            resentSequence = timer.sequence;
 
         //Log the event
-        LogIt("sirc::resend %p",(UINT_PTR)packet);
+        LogIt("sirc::resend %p %u",(UINT_PTR)timer.packet,timer.transmits);
 
-        //Retransmit now
-        if(!addTransmit(packet)){
+        //Retransmit now, and make sure the driver notices
+        timer.packet->Flush = TRUE;
+        if(!addTransmit(timer.packet)){
             //We are in serious trouble.
             PRINTF(("%s not sent!\n",callerName));
             return bailOut(errorCode);
         }
+
+        //Back off, unless this was the first transmission
+        if (timer.transmits)
+            timer.timeout = min(2 * timer.timeout, max(timer.timeout, timer.ceiling));
+        armRetransmitTimer(timer.packet, timer.timeout, timer.transmits + 1, timer.ceiling);
+    }
+    return true;
+}
+
+//Current retransmit timeout, in milliseconds, never more than ceiling.
+//RTO = SRTT + 4 * RTTVAR (but at least a tick), see RFC 6298.
+uint32_t ETH_SIRC::retransmitTimeout(uint32_t ceiling){
+    uint32_t timeout;
+
+    if (!haveRoundTrip)
+        return ceiling;
+
+    timeout = smoothedRoundTrip + max((uint32_t)1000, 4 * roundTripVariance);
+    timeout = max((timeout + 999) / 1000, (uint32_t)MINRETRANSMITTIMEOUT);
+    return min(timeout, ceiling);
+}
+
+//A packet that was timed has been acked, update the round trip estimates.
+void ETH_SIRC::sampleRoundTrip(PACKET *packet){
+    uint32_t sample, delta;
+
+    sample = getMicroseconds() - (uint32_t)(UINT_PTR)packet->UserState2;
+    packet->UserState2 = NULL;
+
+    if (!haveRoundTrip){
+        smoothedRoundTrip = sample;
+        roundTripVariance = sample / 2;
+        haveRoundTrip = true;
+        return;
+    }
+
+    //RTTVAR = 3/4 RTTVAR + 1/4 |SRTT - R|, then SRTT = 7/8 SRTT + 1/8 R
+    delta = (sample > smoothedRoundTrip) ? sample - smoothedRoundTrip : smoothedRoundTrip - sample;
+    roundTripVariance = roundTripVariance - roundTripVariance / 4 + delta / 4;
+    smoothedRoundTrip = smoothedRoundTrip - smoothedRoundTrip / 8 + sample / 8;
+}
+
+//Time in microseconds, from the performance counter.  Wraps around every 71 minutes.
+uint32_t ETH_SIRC::getMicroseconds(void){
+    LARGE_INTEGER counter;
+
+    QueryPerformanceCounter(&counter);
+    return (uint32_t)((counter.QuadPart / counterFrequency) * 1000000 +
+                      ((counter.QuadPart % counterFrequency) * 1000000) / counterFrequency);
+}
+
+//Scoreboard management.
+//The outstanding requests live in a ring of slots, in the order they were sent (or, for reads,
+// in increasing address order).  Requests acked out of order leave an empty slot behind,
+// which is skipped over and reclaimed when the head of the ring gets to it.
+
+//Make sure there is a free slot at the tail of the ring.
+//Squeeze out the empty slots first, grow the ring only if that is not enough.
+//Return false w/error code if we ran out of memory.
+BOOL ETH_SIRC::makeRoomInRing(void){
+    uint32_t from, to, newIter;
+    REQUEST *newRing;
+
+    if (ringTail - ringHead < ringSize)
+        return true;
+
+    //Compact in place, keeping the order and ringIter pointing at the same request
+    newIter = ringIter;
+    to = ringHead;
+    for (from = ringHead; from != ringTail; from++){
+        if (from == ringIter)
+            newIter = to;
+        if (requestAt(from)->packet == NULL)
+            continue;
+        if (to != from)
+            *requestAt(to) = *requestAt(from);
+        to++;
+    }
+    if (ringIter == ringTail)
+        newIter = to;
+    ringIter = newIter;
+    ringTail = to;
+
+    if (ringTail - ringHead < ringSize){
+        rebuildReadOwners();
+        return true;
+    }
+
+    //Really full, get a bigger ring
+    newRing = new (std::nothrow) REQUEST[2 * ringSize];
+    if (!newRing){
+        setLastError(FAILMEMALLOC);
+        return false;
+    }
+    for (from = ringHead; from != ringTail; from++)
+        newRing[from - ringHead] = *requestAt(from);
+
+    ringIter -= ringHead;
+    ringTail -= ringHead;
+    ringHead = 0;
+    ringSize *= 2;
+    delete [] requestRing;
+    requestRing = newRing;
+    rebuildReadOwners();
+    return true;
+}
+
+//Add a request at the tail of the ring
+//Return false w/error code (and free the packet) if there is no room.
+BOOL ETH_SIRC::addRequestBack(PACKET *packet, uint32_t startAddress, uint32_t length){
+    REQUEST *request;
+
+    if (!makeRoomInRing()){
+        PacketDriver->FreePacket(packet,false);
+        return false;
+    }
+
+    request = requestAt(ringTail++);
+    request->packet = packet;
+    request->startAddress = startAddress;
+    request->length = length;
+    request->nextAddress = startAddress;
+
+    outstandingTransmits++;
+    return true;
+}
+
+//Add a request just before ringIter, which is left pointing at the same request as before.
+//Return false w/error code (and free the packet) if there is no room.
+BOOL ETH_SIRC::addRequestCurrentIterLocation(PACKET *packet, uint32_t startAddress, uint32_t length){
+    REQUEST *request;
+
+    if ((ringIter != ringHead) && (requestAt(ringIter - 1)->packet == NULL)){
+        //Typically we just removed the request there, so reuse its slot.
+        request = requestAt(ringIter - 1);
+    }
+    else if ((ringIter == ringHead) && (ringTail - ringHead < ringSize)){
+        //Adding in front of everything else
+        request = requestAt(--ringHead);
+    }
+    else {
+        if (!makeRoomInRing()){
+            PacketDriver->FreePacket(packet,false);
+            return false;
+        }
+
+        //Shift everything from ringIter on up by one slot
+        for (uint32_t i = ringTail; i != ringIter; i--)
+            *requestAt(i) = *requestAt(i - 1);
+        ringTail++;
+        request = requestAt(ringIter++);
     }
+
+    request->packet = packet;
+    request->startAddress = startAddress;
+    request->length = length;
+    request->nextAddress = startAddress;
+
+    outstandingTransmits++;
     return true;
 }
 
-void ETH_SIRC::incrementCurrIterLocation(){
-	assert(packetIter != outstandingPackets.end());
-	packetIter++;
-	assert(startAddressIter != outstandingReadStartAddresses.end());
-	startAddressIter++;
-	assert(lengthIter != outstandingReadLengths.end());
-	lengthIter++;
+//Empty out a slot, and let the head of the ring move past any empty slots.
+void ETH_SIRC::removeRequest(uint32_t index){
+    requestAt(index)->packet = NULL;
+
+    while ((ringHead != ringTail) && (requestAt(ringHead)->packet == NULL))
+        ringHead++;
 }
 
-void ETH_SIRC::removeReadRequestCurrentIterLocation(){
-	packetIter = outstandingPackets.erase(packetIter);
-	startAddressIter = outstandingReadStartAddresses.erase(startAddressIter);
-	lengthIter = outstandingReadLengths.erase(lengthIter);
+//A response to this packet came back, its retransmit timer (if any) is stale now.
+inline void ETH_SIRC::stopRetransmitTimer(PACKET* packet){
+    uint32_t slot = (uint32_t)(UINT_PTR)packet->UserState;
+
+    //Zero is never a live sequence number
+    if (slot != 0){
+        timerSlots[slot - 1] = 0;
+        freeTimerSlots.push_back(slot - 1);
+        packet->UserState = NULL;
+    }
+
+    //Learn from the round trip, if this one was timed
+    if (packet->UserState2)
+        sampleRoundTrip(packet);
 }
 
 //Mark this packet acked and free it if the transmission has been completed.
 inline void ETH_SIRC::markPacketAcked(PACKET* packet){
     assert((packet->Mode == PacketModeTransmitting) ||
            (packet->Mode == PacketModeTransmittingBuffer));
+    stopRetransmitTimer(packet);
+
     //We have seen a response from the read request, free the transmission packet.
     PacketDriver->FreePacket(packet,false);
 
@@ -1996,6 +4790,9 @@ void ETH_SIRC::printPacket(PACKET* packet){
         for(i = 0; i < packet->nBytesAvail; i++){
             printf("%02x ", packet->Buffer[i]);	
         }
+        for(i = 0; i < packet->GatherLength; i++){
+            printf("%02x ", packet->Gather[i]);
+        }
         printf("\n");
     });
 }
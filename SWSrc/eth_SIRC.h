@@ -53,6 +53,8 @@ public:
 	//Returns true if write is successful.
 	//If write fails for any reason, returns false.
 	// Check error code with getLastError().
+	//If the FPGA takes transaction IDs (see TRANSACTIONIDS) this returns as soon as the data
+	// is on the wire, and a write that is never acked fails a later call instead.
 	BOOL __stdcall sendWrite(uint32_t startAddress, uint32_t length, uint8_t *buffer);
 
 	//Read a block of data from the output buffer of the FPGA
@@ -70,6 +72,7 @@ public:
 	//Returns true if write is successful.
 	//If write fails for any reason, returns false.
 	// Check error code with getLastError()
+	//Same as sendWrite for transaction IDs.
 	BOOL __stdcall sendParamRegisterWrite(uint8_t regNumber, uint32_t value);
 
 	//Read a 32-bit value from the parameter register file on the FPGA back to the PC
@@ -121,6 +124,87 @@ public:
     //Modify the active set of parameters and limits for this instance
     BOOL __stdcall setParameters(const SIRC::PARAMETERS *inParameters, uint32_t length);
 
+	//Read a block of data from the output buffer of the FPGA, handing each read response
+	// to sink straight out of the packet it came in.  See SIRC::sendReadToSink.
+	BOOL __stdcall sendReadToSink(uint32_t startAddress, uint32_t length, READ_SINK sink, void *context);
+
+	//Write or read several parameter registers with a single command and a single ack.
+	//FPGAs that do not answer the batch commands get them one register at a time, the
+	// first batch finds out (costing up to MAXRETRIES * NEGOTIATETIMEOUT, once).
+	//See SIRC::sendParamRegisterWriteBatch and SIRC::sendParamRegisterReadBatch.
+	BOOL __stdcall sendParamRegisterWriteBatch(uint32_t count, const uint8_t *regNumbers, const uint32_t *values);
+	BOOL __stdcall sendParamRegisterReadBatch(uint32_t count, const uint8_t *regNumbers, uint32_t *values);
+
+	//Run a whole job, sending everything up to the run as one train of packets.
+	//A job is never run twice: if an ack is lost and we cannot tell that the run went through
+	// with all of its inputs, this fails with FAILWRITEACK and it is up to the caller to
+	// submit the job again.  See SIRC::submitJob.
+	BOOL __stdcall submitJob(const SIRC::JOB *job);
+
+	//Asynchronous versions of the calls above.
+	//Each one queues the request to a background I/O thread and returns right away with a
+	// handle, or NULL if the request could not be queued (check error code with getLastError()).
+	//This lets the caller do other work while a request is on the wire, it does not make
+	// requests run concurrently: they still run one at a time, in the order they were queued,
+	// and synchronous calls are queued behind them.
+	//Any number of threads can queue requests at the same time, this does not take a lock.
+	//Once the I/O thread is running, every synchronous call on this object is queued the
+	// same way (and waited for), so threads sharing this object line up behind each other
+	// in the queue rather than on a lock.  A sink given to sendReadToSink is then called
+	// on the I/O thread.
+	//Buffers must stay valid, and untouched, until the request completes.
+	//Every handle must be passed to waitAsync() exactly once it has completed.
+	struct ASYNC_REQUEST;
+	typedef ASYNC_REQUEST *ASYNC_HANDLE;
+	ASYNC_HANDLE __stdcall sendWriteAsync(uint32_t startAddress, uint32_t length, uint8_t *buffer);
+	ASYNC_HANDLE __stdcall sendReadAsync(uint32_t startAddress, uint32_t length, uint8_t *buffer);
+	ASYNC_HANDLE __stdcall sendParamRegisterWriteAsync(uint8_t regNumber, uint32_t value);
+	ASYNC_HANDLE __stdcall sendParamRegisterReadAsync(uint8_t regNumber, uint32_t *value);
+	ASYNC_HANDLE __stdcall sendRunAsync(void);
+	ASYNC_HANDLE __stdcall waitDoneAsync(uint32_t maxWaitTimeInMsec);
+	ASYNC_HANDLE __stdcall sendWriteAndRunAsync(uint32_t startAddress, uint32_t inLength, uint8_t *inData, 
+		uint32_t maxWaitTimeinMsec, uint8_t *outData, uint32_t maxOutLength, 
+		uint32_t *outputLength);
+
+	//Wait for an asynchronous request to complete
+	// handle: as returned by one of the calls above
+	// maxWaitTimeInMsec: # of milliseconds to wait (INFINITE is ok)
+	// error: if not NULL, receives the error code as well
+	//Returns what the synchronous call would have returned, the error code it would have
+	// set is only passed back through error.  The handle is released.
+	//If the request has not completed in time, returns false w/ FAILASYNCPENDING and the
+	// handle stays valid.
+	//This does not touch getLastError(), which reflects the most recent synchronous call
+	// on this object, from whichever thread.
+	BOOL __stdcall waitAsync(ASYNC_HANDLE handle, uint32_t maxWaitTimeInMsec, int8_t *error = NULL);
+
+	//Same as SIRC::getLastError and SIRC::setLastError, except on the I/O thread: it keeps
+	// its error code to itself (see ioThreadError), so it never races with the callers.
+	inline int8_t __stdcall getLastError(){
+		return (onIoThread()) ? ioThreadError : SIRC::getLastError();
+	}
+	inline void __stdcall setLastError(int8_t code){
+		if (onIoThread())
+			ioThreadError = code;
+		else
+			SIRC::setLastError(code);
+	}
+
+	//Forget what we know of the contents of the FPGA input buffer (see SHADOWINPUT), so the
+	// next sendWrite to that range goes to the FPGA in full.
+	//Designs whose execution changes the input buffer should call this after every run.
+	// startAddress: local address on FPGA input buffer where the change begins
+	// length: # of bytes that might have changed
+	void __stdcall invalidateInputShadow(uint32_t startAddress, uint32_t length);
+
+	//Tell us whether the FPGA itself changes a parameter register (see SHADOWREGISTERS).
+	//Volatile registers are always written and read on the FPGA, the others are only
+	// written when their value changes and read back from what we wrote last.
+	//Register 255 (the execution signal) is always volatile.
+	// regNumber: register in question (between 0 and 254)
+	// isVolatile: true if the FPGA might change it
+	void __stdcall setParamRegisterVolatile(uint8_t regNumber, BOOL isVolatile);
+
 private:
 	PACKET_DRIVER *PacketDriver;
     struct {
@@ -128,11 +212,30 @@ private:
         uint8_t My_MACAddress[6];
     } ethHeader;
 	
-	std::list <PACKET *> outstandingPackets;
+	//Scoreboard of outstanding requests, a ring of ringSize (a power of 2) slots.
+	//Indices are free-running, ringHead is the oldest request still outstanding
+	// and ringTail is the next free slot.  Slots acked out of order have packet == NULL.
+	//For reads we also keep the starting address and length of the request,
+	// and where we expect the next response to it to start.
+	typedef struct {
+		PACKET *packet;
+		uint32_t startAddress;
+		uint32_t length;
+		uint32_t nextAddress;
+	} REQUEST;
+	REQUEST *requestRing;
+	uint32_t ringSize;
+	uint32_t ringHead;
+	uint32_t ringTail;
+	//Where we are in the ring while matching write & run read responses
+	uint32_t ringIter;
 	//How many outstanding packets do we have?
-	//We could just do outstandingPackets.size(), but that might be slow
 	int outstandingTransmits;
-	std::list <PACKET *>::iterator packetIter;
+
+    //Largest frame the NIC can take, and the one we agreed on with the FPGA.
+    //Both include the 14 byte header.
+    uint32_t nicFrameSize;
+    uint32_t maxPacketSize;
 
     //How many can we have anyways?
     uint32_t maxOutstandingReads;
@@ -143,16 +246,91 @@ private:
     uint32_t maxInputDataBytes;
     uint32_t maxOutputDataBytes;
 
-	//These are the parameters used when we are doing reads.
-	std::list <uint32_t> outstandingReadStartAddresses;
-	std::list <uint32_t> outstandingReadLengths;
-
-	std::list <uint32_t>::iterator startAddressIter;
-	std::list <uint32_t>::iterator lengthIter;
-
-	//Over the current set of read requests, have we seen the
-	// need for any resends?
-	BOOL noResends;
+	//Retransmit timers, kept as a heap ordered by deadline.
+	//An armed packet owns a slot in timerSlots (UserState holds its index plus one), and the
+	// slot holds the sequence number of the packet's live timer.  Any other timer for that
+	// slot is stale and gets dropped when it reaches the top, without looking at its packet,
+	// which might have been freed by then.  Slots go back to freeTimerSlots when the packet
+	// is acked, emptyOutstandingPackets drops them all.
+	typedef struct {
+		uint32_t deadline;
+		uint32_t sequence;
+		uint32_t timeout;
+		uint32_t ceiling;
+		uint32_t transmits;
+		uint32_t slot;
+		PACKET *packet;
+	} RETRANSMIT_TIMER;
+	std::vector <RETRANSMIT_TIMER> retransmitTimers;
+	std::vector <uint32_t> timerSlots;
+	std::vector <uint32_t> freeTimerSlots;
+	uint32_t timerSequence;
+	//Timer sequence of the latest lost packet found by resendExpiredPackets, zero if none
+	uint32_t resentSequence;
+
+	//Congestion window for writes, never more than maxOutstandingWrites.
+	//writeWindowRecovery is the timer sequence when we last cut the window.
+	uint32_t writeWindow;
+	uint32_t writeWindowThreshold;
+	uint32_t writeWindowAcks;
+	uint32_t writeWindowRecovery;
+	uint32_t lastWriteTransmit;
+
+	//Round trip estimates for this FPGA, in microseconds.
+	//A packet sent just once carries its send time in UserState2, so the ack can be timed.
+	BOOL haveRoundTrip;
+	uint32_t smoothedRoundTrip;
+	uint32_t roundTripVariance;
+	LONGLONG counterFrequency;
+
+	//Reassembly of the read in progress.
+	//The responder breaks every read request into responses of its own size from the start of
+	// the request.  That need not be our MAXREADSIZE (say another host reset the frame size),
+	// so each response goes by its own address and length: a byte that came back has its bit
+	// set in readBitmap, readBytesMissing counts the others.
+	//We ask again for lost data in whole chunks of readChunkSize, readOwner has the ring slot of
+	// the request that asked for each chunk last.  readChunkCount is zero when no read is in progress.
+	uint32_t readBase;
+	uint32_t readLength;
+	uint32_t readChunkSize;
+	uint32_t readChunkCount;
+	uint32_t readBytesMissing;
+	std::vector <uint32_t> readBitmap;
+	std::vector <uint32_t> readOwner;
+
+	//Does the FPGA take the 'K'/'Y' batch register commands?  The first batch finds out, until
+	// then batchRegistersKnown is false.  FPGAs that do not get their registers one at a time.
+	BOOL batchRegistersKnown;
+	BOOL useBatchRegisters;
+
+	//Requests acked in the background, if the FPGA takes transaction IDs.
+	//backgroundRing has backgroundSize (a power of 2, at most 64K) slots indexed by transaction ID.
+	//IDs are free-running, backgroundHead is the oldest request still outstanding and
+	// backgroundTail is the next ID we hand out.  Slots acked out of order are NULL.
+	//backgroundLow/High cover the input buffer writes in flight (empty if equal) and
+	// backgroundRegisters counts the writes in flight to each parameter register.
+	BOOL useTransactionIds;
+	PACKET **backgroundRing;
+	uint32_t backgroundSize;
+	uint32_t backgroundHead;
+	uint32_t backgroundTail;
+	int backgroundTransmits;
+	uint32_t backgroundLow;
+	uint32_t backgroundHigh;
+	uint8_t backgroundRegisters[256];
+
+	//Last known contents of the FPGA input buffer, if SHADOWINPUT.
+	//A byte is known if its bit is set in inputShadowValid.  Both are sized on first use,
+	// and again whenever maxInputDataBytes changes.
+	std::vector <uint8_t> inputShadow;
+	std::vector <uint32_t> inputShadowValid;
+
+	//Last value we wrote to each parameter register, if SHADOWREGISTERS.
+	//A register is known if its bit is set in registerKnown, which never happens to the
+	// registers set in registerVolatile.
+	uint32_t registerShadow[256];
+	uint32_t registerKnown[256 / 32];
+	uint32_t registerVolatile[256 / 32];
 
 	// Have we seen any response from the write & run command?
 	BOOL noResponse;
@@ -164,6 +342,83 @@ private:
     PACKET *currentPacket;
 	uint8_t *currentBuffer;
 
+	//Frame header and write command of a full-size write packet (of writeTemplateLength bytes
+	// of data, zero if none yet) with the address left blank.
+	uint8_t writeTemplate[14 + 9];
+	uint32_t writeTemplateLength;
+
+	//Write packets on the scoreboard that sendWrite has not posted yet, see postWriteBatch.
+	std::vector <PACKET *> writeBatch;
+
+	//Only one thread at a time may talk to the FPGA.  ioOwner/ioDepth let the public
+	// methods call each other while holding ioLock.
+	CRITICAL_SECTION ioLock;
+	DWORD ioOwner;
+	int ioDepth;
+	void enterIo(void);
+	void leaveIo(void);
+	class IO_GUARD {
+	public:
+		IO_GUARD(ETH_SIRC *sirc) : sirc(sirc) { sirc->enterIo(); }
+		~IO_GUARD() { sirc->leaveIo(); }
+	private:
+		ETH_SIRC *sirc;
+	};
+
+	//Queue of asynchronous requests and the I/O thread that runs them.
+	//Requests are pushed on asyncSubmitted (newest first) with a compare & swap, the I/O thread
+	// takes the whole list at once and keeps it in FIFO order in asyncHead, which only it touches.
+	//asyncLock is only there to start the I/O thread once.
+	//The I/O thread has its own error code, ioThreadError, that processAsyncRequests copies
+	// into each request.  Once the I/O thread runs, the one in SIRC is written by
+	// runOnIoThread as each synchronous call returns, from its request, without a lock.
+	typedef enum {
+		ASYNC_WRITE,
+		ASYNC_READ,
+		ASYNC_PARAMWRITE,
+		ASYNC_PARAMREAD,
+		ASYNC_RUN,
+		ASYNC_WAITDONE,
+		ASYNC_WRITEANDRUN,
+		ASYNC_GETPARAMETERS,
+		ASYNC_SETPARAMETERS,
+		ASYNC_READTOSINK,
+		ASYNC_PARAMWRITEBATCH,
+		ASYNC_PARAMREADBATCH,
+		ASYNC_SUBMITJOB,
+		ASYNC_RESET,
+		ASYNC_INVALIDATESHADOW,
+		ASYNC_SETVOLATILE,
+		ASYNC_EXIT
+	} ASYNC_OP;
+	CRITICAL_SECTION asyncLock;
+	ASYNC_REQUEST * volatile asyncSubmitted;
+	ASYNC_REQUEST *asyncHead;
+	HANDLE asyncWakeup;
+	HANDLE ioThread;
+	DWORD ioThreadId;
+	int8_t ioThreadError;
+
+	ASYNC_REQUEST *newAsyncRequest(ASYNC_OP op);
+	BOOL startIoThread(void);
+	ASYNC_HANDLE queueAsyncRequest(ASYNC_REQUEST *request);
+	ASYNC_REQUEST *dequeueAsyncRequest(void);
+	static DWORD WINAPI ioThreadMain(void *context);
+	void processAsyncRequests(void);
+	BOOL runOnIoThread(ASYNC_HANDLE handle);
+	void runOnIoThread(ASYNC_OP op, uint32_t address, uint32_t length);
+	inline BOOL onIoThread(void)
+	{
+		return ioThread && GetCurrentThreadId() == ioThreadId;
+	}
+	//Should this synchronous call be handed to the I/O thread?
+	//Not if this is the I/O thread, or a thread already in the middle of a call.
+	inline BOOL forwardToIoThread(void)
+	{
+		DWORD me = GetCurrentThreadId();
+		return ioThread && me != ioThreadId && me != ioOwner;
+	}
+
 #ifdef DEBUG
 	int writeResends;
 	int readResends;
@@ -171,66 +426,216 @@ private:
 	int paramReadResends;
 	int resetResends;
 	int writeAndRunResends;
+	int writeWindowStalls;
+	int writeWindowCuts;
+	int jobFallbacks;
+	int readFastResends;
+	int backgroundResends;
+	int shadowBytesSkipped;
+	int registerWritesSkipped;
+	int registerReadsSkipped;
 #endif
 
     inline BOOL allocateAndFillPacket(uint16_t length);
+    void buildWriteTemplate(void);
+    inline BOOL allocateWriteFromTemplate(uint32_t address);
     inline void setLengthAndAddress(uint32_t length, uint32_t address);
     inline void setValueField(uint32_t value);
+    inline void setPayloadReference(uint8_t *data, uint32_t length);
     inline BOOL sendCurrentPacket(int8_t errorCode, BOOL flushOutstanding, char *packetName = NULL);
 
 	inline BOOL addReceive(PACKET *Packet = NULL);
+	inline BOOL addReceives(PACKET **Packets, uint32_t count);
 	inline BOOL addTransmit(PACKET* Packet);
 	void emptyOutstandingPackets(void);
     BOOL bailOut(int8_t errorCode);
 
-    BOOL receiveGenericAck(uint32_t timeOut, uint32_t *arg2, BOOL (ETH_SIRC::*checkFunction)(PACKET*,uint32_t *),int errorCode);
-    BOOL checkSimpleResponse(PACKET *packet, uint8_t commandCode, uint8_t length);
-    BOOL checkResponseWithValue(PACKET *packet, uint32_t *value, uint8_t commandCode);
-    BOOL ETH_SIRC::resendOutstandingPackets(int errorCode, char *callerName = NULL, int *counter = NULL);
+    BOOL receiveGenericAck(uint32_t timeOut, uint32_t *arg2, BOOL (ETH_SIRC::*checkFunction)(PACKET*,uint32_t *));
+    BOOL checkSimpleResponse(PACKET *packet, uint8_t commandCode, uint16_t length);
+    BOOL checkResponseWithValue(PACKET *packet, uint32_t *value, uint8_t commandCode, uint32_t index);
+    BOOL resendExpiredPackets(int errorCode, int failCode, char *callerName = NULL, int *counter = NULL);
+
+    static bool laterDeadline(const RETRANSMIT_TIMER &a, const RETRANSMIT_TIMER &b);
+    void armRetransmitTimer(PACKET *packet, uint32_t timeout, uint32_t transmits, uint32_t ceiling = 0);
+    uint32_t nextRetransmitTimeout(uint32_t idleTimeout);
+    uint32_t retransmitTimeout(uint32_t ceiling);
+    void sampleRoundTrip(PACKET *packet);
+    uint32_t getMicroseconds(void);
+    inline BOOL isTimerLive(const RETRANSMIT_TIMER &timer)
+    {
+        return timerSlots[timer.slot] == timer.sequence;
+    }
+
+
+	BOOL sendWriteNow(uint32_t startAddress, uint32_t length, uint8_t *buffer);
+	BOOL sendWriteThroughShadow(uint32_t startAddress, uint32_t length, uint8_t *buffer);
+	BOOL findDirtyRange(uint32_t startAddress, uint32_t length, const uint8_t *buffer,
+						uint32_t *offset, uint32_t *dirtyLength);
+	void updateInputShadow(uint32_t startAddress, uint32_t length, const uint8_t *buffer);
+	void invalidateShadowRange(uint32_t startAddress, uint32_t length);
+	inline BOOL isShadowKnown(uint32_t address)
+	{
+		return (inputShadowValid[address >> 5] & (1u << (address & 31))) != 0;
+	}
 
+	inline BOOL isRegisterKnown(uint8_t regNumber, uint32_t *value);
+	inline void rememberRegister(uint8_t regNumber, uint32_t value);
+	inline void forgetRegister(uint8_t regNumber);
 
 	BOOL createWriteRequestBackAndTransmit(uint32_t startAddress, uint32_t length, uint8_t *buffer, BOOL flushQueue);
-	BOOL receiveWriteAcks(void);
+	BOOL createWriteRequestBack(uint32_t startAddress, uint32_t length, uint8_t *buffer);
+	BOOL postWriteBatch(void);
+	BOOL waitForWriteAcks(uint32_t maxLeftOutstanding);
+	inline void openWriteWindow(void);
+	void closeWriteWindow(void);
+	void paceWrite(void);
+	BOOL receiveWriteAcks(uint32_t maxLeftOutstanding);
 	BOOL checkWriteAck(PACKET* packet);
 
+	BOOL sendBackgroundWrite(uint32_t startAddress, uint32_t length, uint8_t *buffer);
+	BOOL sendBackgroundParamRegisterWrite(uint8_t regNumber, uint32_t value);
+	BOOL makeRoomInBackground(void);
+	inline BOOL allocateAndFillTaggedPacket(uint16_t length);
+	inline void addBackgroundRequest(PACKET *packet);
+	BOOL createBackgroundWriteAndTransmit(uint32_t startAddress, uint32_t length, uint8_t *buffer, BOOL flushQueue);
+	BOOL createBackgroundParamWriteAndTransmit(uint8_t regNumber, uint32_t value);
+	BOOL waitForBackgroundAcks(uint32_t maxLeftOutstanding);
+	BOOL checkBackgroundAck(PACKET* packet);
+	void freeBackgroundRequests(void);
+	PACKET *getNextReceivedPacket(uint32_t timeOut);
+	uint32_t getNextReceivedPackets(PACKET **packets, uint32_t maxPackets, uint32_t timeOut);
+
 	BOOL createReadRequestBackAndTransmit(uint32_t startAddress, uint32_t length);
 	BOOL createReadRequestCurrentIterLocation(uint32_t startAddress, uint32_t length);
-	BOOL receiveReadResponses(uint32_t initialStartAddress, uint8_t *buffer);
-	BOOL checkReadData(PACKET* packet, uint32_t* currAddress, uint32_t* currLength,  
-		uint8_t* buffer, uint32_t initialStartAddress);
+	BOOL receiveReadResponses(READ_SINK sink, void *context);
+	BOOL checkReadData(PACKET* packet, READ_SINK sink, void *context);
+	BOOL requestReadHoles(void);
+	BOOL requestLostChunks(uint32_t firstChunk, uint32_t endChunk, uint32_t slack, int *counter = NULL);
+	BOOL isChunkLost(uint32_t chunk, uint32_t slack);
+	void startReadReassembly(uint32_t startAddress, uint32_t length);
+	void setReadOwner(uint32_t index);
+	void rebuildReadOwners(void);
+	BOOL findReadOwner(uint32_t chunk, uint32_t *index);
+	BOOL isReadRangeReceived(uint32_t offset, uint32_t end);
+	BOOL isReadRangeMissing(uint32_t offset, uint32_t end);
+	void markReadRange(uint32_t offset, uint32_t end);
+	inline BOOL isReadByteReceived(uint32_t offset)
+	{
+		return (readBitmap[offset >> 5] >> (offset & 31)) & 1;
+	}
+	inline BOOL isChunkReceived(uint32_t chunk)
+	{
+		return isReadRangeReceived(chunk * readChunkSize, min((chunk + 1) * readChunkSize, readLength));
+	}
+	static void __stdcall copyToBuffer(void *context, uint32_t offset, const uint8_t *data, uint32_t length);
 
 	BOOL createParamWriteRequestBackAndTransmit(uint8_t regNumber, uint32_t value);
 	inline BOOL receiveParamWriteAck(void)
     {
-        return receiveGenericAck(writeTimeout,NULL,&ETH_SIRC::checkParamWriteAck, FAILWRITEACK);
+        return receiveGenericAck(writeTimeout,NULL,&ETH_SIRC::checkParamWriteAck);
     }
 	BOOL checkParamWriteAck(PACKET* packet, uint32_t *unused);
 
-	BOOL createParamReadRequestBackAndTransmit(uint8_t regNumber);
+	BOOL createParamReadRequestBackAndTransmit(uint8_t regNumber, uint32_t timeout, uint32_t ceiling);
 	inline BOOL receiveParamReadResponse(uint32_t *value, uint32_t maxWaitTimeInMsec)
     {
-        return receiveGenericAck(maxWaitTimeInMsec,value,&ETH_SIRC::checkParamReadData, FAILREADACK);
+        return receiveGenericAck(maxWaitTimeInMsec,value,&ETH_SIRC::checkParamReadData);
     }
 	BOOL checkParamReadData(PACKET* packet, uint32_t *value);
 
+	BOOL createParamWriteBatchRequestBackAndTransmit(uint32_t count, const uint8_t *regNumbers, const uint32_t *values,
+													 uint32_t timeout, uint32_t ceiling);
+	inline BOOL receiveParamWriteBatchAck(void)
+    {
+        return receiveGenericAck(writeTimeout,NULL,&ETH_SIRC::checkParamWriteBatchAck);
+    }
+	BOOL checkParamWriteBatchAck(PACKET* packet, uint32_t *unused);
+
+	BOOL createParamReadBatchRequestBackAndTransmit(uint32_t count, const uint8_t *regNumbers,
+													uint32_t timeout, uint32_t ceiling);
+	inline BOOL receiveParamReadBatchResponse(uint32_t *values)
+    {
+        return receiveGenericAck(readTimeout,values,&ETH_SIRC::checkParamReadBatchData);
+    }
+	BOOL checkParamReadBatchData(PACKET* packet, uint32_t *values);
+
+	inline BOOL receiveDoneNotification(uint32_t maxWaitTimeInMsec)
+    {
+        return receiveGenericAck(maxWaitTimeInMsec,NULL,&ETH_SIRC::checkDoneNotification);
+    }
+	BOOL checkDoneNotification(PACKET* packet, uint32_t *unused);
+
+	BOOL checkJob(const SIRC::JOB *job);
+	BOOL receiveJobAcks(uint32_t *doneValue, BOOL *gotDone, BOOL *runAcked);
+	BOOL checkJobAck(PACKET* packet, uint32_t *doneValue, BOOL *gotDone, BOOL *runAcked);
+
 	BOOL createWriteAndRunRequestBackAndTransmit(uint32_t startAddress, uint32_t length, uint8_t *buffer);
 	BOOL receiveWriteAndRunAcks(uint32_t maxWaitTimeInMsec, uint32_t maxOutLength, uint8_t *buffer, uint32_t *outputLength);
 	BOOL checkWriteAndRunData(PACKET* packet, uint32_t* currAddress, uint32_t* currLength,  
 									uint8_t* buffer, uint32_t *outputLength, uint32_t maxOutLength);
+	BOOL fillWriteAndRunHole(uint32_t startAddress, uint32_t length, uint8_t *data,
+							 uint8_t *buffer, uint32_t maxOutLength);
+	void setReadRequestRange(uint32_t index, uint32_t startAddress, uint32_t length);
 
 	BOOL createResetRequestAndTransmit(void);
 	inline BOOL receiveResetAck(void)
     {
-        return receiveGenericAck(writeTimeout,NULL,&ETH_SIRC::checkResetAck, FAILRESETACK);
+        return receiveGenericAck(writeTimeout,NULL,&ETH_SIRC::checkResetAck);
     }
 	BOOL checkResetAck(PACKET* packet, uint32_t *unused);
 
-	void incrementCurrIterLocation(void);
-	void removeReadRequestCurrentIterLocation(void);
+	BOOL negotiateFrameSize(void);
+	BOOL createFrameSizeRequestAndTransmit(uint32_t frameSize);
+	inline BOOL receiveFrameSizeResponse(uint32_t *frameSize, uint32_t maxWaitTimeInMsec)
+    {
+        return receiveGenericAck(maxWaitTimeInMsec,frameSize,&ETH_SIRC::checkFrameSizeResponse);
+    }
+	BOOL checkFrameSizeResponse(PACKET* packet, uint32_t *frameSize);
+
+	BOOL negotiateTransactionIds(void);
+	BOOL createTransactionIdRequestAndTransmit(void);
+	inline BOOL receiveTransactionIdResponse(uint32_t maxWaitTimeInMsec)
+    {
+        return receiveGenericAck(maxWaitTimeInMsec,NULL,&ETH_SIRC::checkTransactionIdResponse);
+    }
+	BOOL checkTransactionIdResponse(PACKET* packet, uint32_t *unused);
+
+	inline REQUEST *requestAt(uint32_t index)
+	{
+		return &requestRing[index & (ringSize - 1)];
+	}
+	BOOL makeRoomInRing(void);
+	BOOL addRequestBack(PACKET *packet, uint32_t startAddress, uint32_t length);
+	BOOL addRequestCurrentIterLocation(PACKET *packet, uint32_t startAddress, uint32_t length);
+	void removeRequest(uint32_t index);
+	inline void stopRetransmitTimer(PACKET* packet);
 	inline void markPacketAcked(PACKET* packet);
 
 	void printPacket(PACKET* packet);
 
 };
 
+//One queued asynchronous request.  The op arguments are kept as-is, the result and error
+// code are filled in by the I/O thread before it sets done.
+struct ETH_SIRC::ASYNC_REQUEST {
+	ASYNC_REQUEST *next;
+	ASYNC_OP op;
+	uint32_t address;
+	uint32_t length;
+	uint8_t *buffer;
+	uint32_t value;
+	uint32_t *valueP;
+	uint32_t timeout;
+	uint8_t *outData;
+	uint32_t maxOutLength;
+	const uint8_t *regNumbers;
+	const uint32_t *values;
+	const void *in;
+	void *out;
+	READ_SINK sink;
+	HANDLE done;
+	BOOL result;
+	int8_t error;
+};
+
 #endif //DEFINEETHSIRCH
@@ -452,6 +452,7 @@ public:
     virtual BOOL GetMaxOutstanding(OUT UINT32 *NumReads,
                                    OUT UINT32 *NumWrites) = 0;
 
+    virtual BOOL GetMaxFrameSize(OUT UINT32 *FrameSize) = 0;
 
     //
     // Methods that may be subclassed
@@ -469,6 +470,8 @@ public:
 
     virtual PACKET *GetNextReceivedPacket(IN UINT32 TimeOutInMsec);
 
+    virtual BOOL SetReceiveSpin(IN UINT32 Microseconds);
+
     //
     // Methods that likely should not be subclassed
     //
@@ -482,6 +485,9 @@ public:
     virtual HRESULT GetSpeed(IN HANDLE hDriver,
                              OUT ULONG *Speed
                              );
+    virtual HRESULT GetMaxTotalSize(IN HANDLE hDriver,
+                                    OUT ULONG *Size
+                                    );
     virtual BOOL SelectAdapter(IN  HANDLE          hControl,
                                IN  const wchar_t * DesiredAdapterName,
                                OUT wchar_t       * SelectedAdapter);
@@ -556,6 +562,8 @@ public:
         mMicKeyMac[0] = 0;
         Debug = 0;
         Quiet = FALSE;
+        ReceiveSpinTicks = 0;
+        CounterFrequency = 0;
     }
 
     //
@@ -575,6 +583,16 @@ public:
     // Despised global
     //
     HANDLE hFileHandle;
+
+    //
+    // Receive spin budget, in performance counter ticks (see SetReceiveSpin).
+    // Each version polls its own way, RemainingWait is for all of them.
+    //
+    LONGLONG ReceiveSpinTicks;
+    LONGLONG CounterFrequency;
+
+    UINT32 RemainingWait(IN UINT32 TimeOutInMsec,
+                         IN LONGLONG WaitDeadline);
 private:
     //
     // Common private state
@@ -718,6 +736,51 @@ VirtualPcDriver::GetSpeed(
     return (bResult ? S_OK : E_FAIL);
 }
 
+//=============================================================================
+//  Method: VirtualPcDriver::GetMaxTotalSize().
+//
+//  Description: Get the largest frame the interface below will take,
+//               header included.
+//=============================================================================
+
+HRESULT 
+VirtualPcDriver::GetMaxTotalSize(
+    IN HANDLE hDriver,
+    OUT ULONG *Size
+    )
+{
+    ULONG               IoCtlBufferLength = sizeof(PACKET_OID_DATA)-1 + sizeof(ULONG);
+    BYTE                IoCtlBuffer[sizeof(PACKET_OID_DATA)-1 + sizeof(ULONG)];
+    PPACKET_OID_DATA    OidData = NULL;
+    BOOL                bResult;
+
+    NOISE(("GetMaxTotalSize()"));
+
+    //
+    // Prepare our arguments
+    //
+    memset(IoCtlBuffer, 0, IoCtlBufferLength);
+    OidData = (PPACKET_OID_DATA) IoCtlBuffer;
+    OidData->Oid = OID_GEN_MAXIMUM_TOTAL_SIZE;
+    OidData->Length = sizeof(ULONG);
+
+    //
+    // Issue the request
+    //
+    bResult = DriverRequest(hDriver, FALSE, OidData);
+
+    //
+    // This might fail, older drivers do not pass it down.
+    //
+    if (!bResult)
+    {
+        *Size = MAX_STANDARD_FRAME_SIZE;
+    } else
+        memcpy(Size, OidData->Data, sizeof(ULONG));
+
+    return (bResult ? S_OK : E_FAIL);
+}
+
 //=============================================================================
 //  Method: VirtualPcDriver::SetMyVirtualMac().
 //
@@ -893,6 +956,55 @@ VirtualPcDriver::GetNextReceivedPacket(
     return Packet;
 }
 
+//=============================================================================
+//  Method: VirtualPcDriver::SetReceiveSpin().
+//
+//  Description: How long GetNextReceivedPacket polls before it sleeps.
+//=============================================================================
+
+BOOL
+VirtualPcDriver::SetReceiveSpin(
+    IN UINT32 Microseconds
+)
+{
+    LARGE_INTEGER Frequency;
+
+    if (!QueryPerformanceFrequency(&Frequency))
+        return FALSE;
+
+    CounterFrequency = Frequency.QuadPart;
+    ReceiveSpinTicks = (LONGLONG)Microseconds * CounterFrequency / 1000000;
+    return TRUE;
+}
+
+//=============================================================================
+//  Method: VirtualPcDriver::RemainingWait().
+//
+//  Description: What is left of TimeOutInMsec at WaitDeadline (see the
+//               drivers' spin), or all of it if we never spun.
+//=============================================================================
+
+UINT32
+VirtualPcDriver::RemainingWait(
+    IN UINT32 TimeOutInMsec,
+    IN LONGLONG WaitDeadline
+)
+{
+    LARGE_INTEGER Now;
+
+    if (WaitDeadline == 0)
+        return TimeOutInMsec;
+
+    QueryPerformanceCounter(&Now);
+    if (Now.QuadPart >= WaitDeadline)
+        return 0;
+
+    //
+    // Round up, so we do not come back a hair early and spin again for nothing.
+    //
+    return (UINT32)(((WaitDeadline - Now.QuadPart) * 1000 + CounterFrequency - 1) / CounterFrequency);
+}
+
 //=============================================================================
 //  Method: VirtualPcDriver::ChangeMacAddress().
 //
@@ -1307,6 +1419,14 @@ public:
         return TRUE;
     }
 
+    virtual BOOL GetMaxFrameSize(OUT UINT32 *FrameSize)
+    {
+        if (!bInitialized)
+            return false;
+        *FrameSize = MaxFrameSize;
+        return TRUE;
+    }
+
     virtual BOOL GetSymbolicName(IN const wchar_t * AdapterName,
                                  OUT wchar_t      * SymbolicName);
 
@@ -1314,6 +1434,12 @@ private:
     //
     // Our private methods
     //
+    BOOL SpinForCompletion(IN UINT32 TimeOutInMsec,
+                           IN OUT LONGLONG *SpinDeadline,
+                           IN OUT LONGLONG *WaitDeadline,
+                           OUT DWORD *Transferred,
+                           OUT OVERLAPPED **Overlapped,
+                           OUT BOOL *pResult);
 
     //
     // Our private state
@@ -1322,6 +1448,7 @@ private:
     HANDLE IoCompletionPort;
     PacketManager PacketMgr;
     UINT8 EthernetAddress[6];
+    UINT32 MaxFrameSize;
     BOOL bInitialized;
 };
 
@@ -1498,6 +1625,20 @@ VirtualPcDriver2::Open(IN const wchar_t *AdapterName
 
     DPRINTF(("PacketDriver Version is %x",GetVersion()));
 
+    //
+    //  See if the NIC is configured for jumbo frames.
+    //  Buffers are sized for this, so clip it to something sane.
+    //
+    ULONG TotalSize;
+    GetMaxTotalSize(this->hFileHandle, &TotalSize);
+    if (TotalSize > MAX_JUMBO_FRAME_SIZE)
+        TotalSize = MAX_JUMBO_FRAME_SIZE;
+    if (TotalSize < MAX_STANDARD_FRAME_SIZE)
+        TotalSize = MAX_STANDARD_FRAME_SIZE;
+    this->MaxFrameSize = TotalSize;
+
+    DPRINTF(("PacketDriver MaxFrameSize is %u",this->MaxFrameSize));
+
     //
     //  Create the I/O completion ports for send and
     //  receive operations to and from the packet driver.
@@ -1604,6 +1745,11 @@ VirtualPcDriver2::PostTransmitPacket(
     BOOL    bResult = FALSE;
     DWORD   nBytesTransferred = 0;
 
+    //
+    // WriteFile() wants it all in one piece
+    //
+    Packet->Flatten();
+
     LogIt("pkt::xp %p %u",(UINT_PTR)Packet,Packet->nBytesAvail);
 
     //
@@ -1681,20 +1827,26 @@ VirtualPcDriver2::GetNextCompletedPacket(
 #else
     UINT_PTR        Key;
 #endif
+    LONGLONG        SpinDeadline = 0, WaitDeadline = 0;
 
     //
     //  Wait for an I/O to complete.
+    //  In low-latency mode, poll the port a little while before going to
+    //  sleep on it. The spin comes out of the timeout, and a retry only
+    //  spins whatever is left of the budget.
     //
  Retry:
     Packet = NULL;
     Overlapped = NULL;
 
-    bResult = GetQueuedCompletionStatus(
+    if (!SpinForCompletion(TimeOutInMsec, &SpinDeadline, &WaitDeadline,
+                           &Transferred, &Overlapped, &bResult))
+        bResult = GetQueuedCompletionStatus(
                             this->IoCompletionPort,
                             &Transferred,
                             &Key,
                             &Overlapped,
-                            TimeOutInMsec
+                            RemainingWait(TimeOutInMsec, WaitDeadline)
                             );
 
     if (!bResult ||(Overlapped == NULL)) {
@@ -1747,6 +1899,66 @@ VirtualPcDriver2::GetNextCompletedPacket(
     return PacketModeTransmitting;
 }
 
+//=============================================================================
+//    Method: VirtualPcDriver2::SpinForCompletion().
+//
+//    Description: Poll the completion port for up to the spin budget (or
+//                 the timeout, if shorter). Returns TRUE if it gave us
+//                 something, with what GetQueuedCompletionStatus said in
+//                 *pResult. Deadlines as in VirtualPcDriver3::SpinForReceive.
+//=============================================================================
+
+BOOL
+VirtualPcDriver2::SpinForCompletion(
+    IN UINT32 TimeOutInMsec,
+    IN OUT LONGLONG *SpinDeadline,
+    IN OUT LONGLONG *WaitDeadline,
+    OUT DWORD *Transferred,
+    OUT OVERLAPPED **Overlapped,
+    OUT BOOL *pResult
+    )
+{
+    LARGE_INTEGER Now;
+    LONGLONG Ticks = ReceiveSpinTicks;
+#if (_MSC_VER > 1200)
+    ULONG_PTR Key;
+#else
+    UINT_PTR Key;
+#endif
+
+    if ((Ticks == 0) || (TimeOutInMsec == 0))
+        return FALSE;
+
+    QueryPerformanceCounter(&Now);
+    if (*SpinDeadline == 0) {
+        if (TimeOutInMsec != INFINITE) {
+            LONGLONG TimeOut = (LONGLONG)TimeOutInMsec * CounterFrequency / 1000;
+            if (Ticks > TimeOut)
+                Ticks = TimeOut;
+            *WaitDeadline = Now.QuadPart + TimeOut;
+        }
+        *SpinDeadline = Now.QuadPart + Ticks;
+    }
+
+    while (Now.QuadPart < *SpinDeadline) {
+        *Overlapped = NULL;
+        *pResult = GetQueuedCompletionStatus(this->IoCompletionPort,
+                                             Transferred,
+                                             &Key,
+                                             Overlapped,
+                                             0);
+        //
+        // A failed I/O dequeues a packet too, only an empty port does not
+        //
+        if (*pResult || (*Overlapped != NULL))
+            return TRUE;
+        YieldProcessor();
+        QueryPerformanceCounter(&Now);
+    }
+
+    return FALSE;
+}
+
 //=============================================================================
 //    Method: VirtualPcDriver2::Flush().
 //
@@ -1844,7 +2056,8 @@ VirtualPcDriver2::AllocatePacket(
     if (Buffer == NULL) {
         if (oldBuffer == NULL) {
             // always max size it
-            Buffer = ::new BYTE[kVPCNetSvMaximumPacketLength];
+            Buffer = ::new BYTE[(MaxFrameSize > kVPCNetSvMaximumPacketLength) ?
+                                MaxFrameSize : kVPCNetSvMaximumPacketLength];
             if (Buffer == NULL) {
                 //
                 // We must be out of memory, fail.
@@ -1903,6 +2116,7 @@ VirtualPcDriver2::VirtualPcDriver2(
     Quiet = gQuiet;
     hFileHandle = AuxHandle = IoCompletionPort = INVALID_HANDLE_VALUE;
     memset(EthernetAddress,0,6);
+    MaxFrameSize = MAX_STANDARD_FRAME_SIZE;
     bInitialized = FALSE;
 }
 
@@ -1983,6 +2197,14 @@ public:
         return Packet;
     }
 
+    //
+    // Anything on the list?
+    //
+    BOOL IsEmpty(void)
+    {
+        return mHead == NULL;
+    }
+
     //
     // Length of the list
     //
@@ -2030,11 +2252,18 @@ public:
                             IN BOOL bForReceiving);
 
     virtual HRESULT PostReceivePacket(IN PACKET *Packet);
+    virtual HRESULT PostReceivePackets(IN PACKET **Packets,
+                                       IN UINT32   nPackets);
     virtual HRESULT PostTransmitPacket(IN PACKET *Packet);
+    virtual HRESULT PostTransmitPackets(IN PACKET **Packets,
+                                        IN UINT32   nPackets);
     virtual PACKET_MODE GetNextCompletedPacket(OUT PACKET ** pPacket,
                                                IN  UINT32 TimeOutInMsec
                                                );
     virtual PACKET *GetNextReceivedPacket(IN UINT32 TimeOutInMsec);
+    virtual UINT32 GetNextReceivedPackets(OUT PACKET **Packets,
+                                          IN  UINT32   MaxPackets,
+                                          IN  UINT32   TimeOutInMsec);
     virtual HRESULT SetFilter(IN UINT32 Filter)
     {
         return SetDriverFilter(hFileHandle,Filter);
@@ -2050,6 +2279,15 @@ public:
         return TRUE;
     }
 
+    //
+    // The shared ring buffers have fixed size entries, no jumbo frames here.
+    //
+    virtual BOOL GetMaxFrameSize(OUT UINT32 *FrameSize)
+    {
+        *FrameSize = MAX_STANDARD_FRAME_SIZE;
+        return TRUE;
+    }
+
     virtual BOOL GetSymbolicName(IN const wchar_t * AdapterName,
                                  OUT wchar_t      * SymbolicName);
 
@@ -2057,6 +2295,14 @@ private:
     //
     // Our private methods
     //
+    BOOL SpinForReceive(IN UINT32 TimeOutInMsec,
+                        IN OUT LONGLONG *SpinDeadline,
+                        IN OUT LONGLONG *WaitDeadline);
+
+    void QueueTransmitPacket(IN PACKET *Packet);
+    void AddTransmitPending(IN LONG nPackets);
+    void KickTransmit(void);
+
     void InitializePacketBuffer(
          IN VPCNetSvPacketBufferDescPtr    PacketBufferDesc,
          IN BOOL fForReceive);
@@ -2084,6 +2330,12 @@ private:
         return PacketBufferSteal(PacketBufferDesc,PacketQueueHead,ListCount,true);
     }
 
+    void PacketBufferEnqueueList(
+         IN VPCNetSvPacketBufferDescPtr    PacketBufferDesc,
+         IN VPCNetSvPacketEntryQueueHead * PacketQueueHead,
+         IN VPCNetSvPacketEntry *          FirstEntry,
+         IN VPCNetSvPacketEntry *          LastEntry);
+
     void PacketBufferMoveList(
          IN VPCNetSvPacketBufferDescPtr    PacketBufferDesc,
          IN VPCNetSvPacketEntryQueueHead * PacketQueueHead,
@@ -2542,6 +2794,51 @@ VirtualPcDriver3::PacketBufferEnqueue(
     }
 }
 
+//=============================================================================
+//    Method: VirtualPcDriver3::PacketBufferEnqueueList().
+//
+//    Description: Add a list of packets to the given queue, in one go.
+//                 The list is already linked through fNextPacketOffset,
+//                 from FirstEntry to LastEntry.
+//=============================================================================
+
+void
+VirtualPcDriver3::PacketBufferEnqueueList(
+    IN VPCNetSvPacketBufferDescPtr       PacketBufferDesc,
+    IN VPCNetSvPacketEntryQueueHead *    PacketQueueHead,
+    IN VPCNetSvPacketEntry *             FirstEntry,
+    IN VPCNetSvPacketEntry *             LastEntry)
+{
+    UINT32 entryOffset = GetPacketEntryOffsetFromPointer(PacketBufferDesc, FirstEntry);
+
+    //
+    // Lock-free operation, same as PacketBufferEnqueue.
+    //
+    for (;;)
+    {
+        volatile UINT32 head            = PacketQueueHead->fHead;
+        volatile UINT32 modCount        = PacketQueueHead->fModificationCount;
+        volatile UINT32 newModCount     = modCount + 1;
+
+        //
+        // Queue is a LIFO queue
+        //
+        LastEntry->fNextPacketOffset    = head;
+
+        volatile __int64 comparand = ((UINT64)head | ((UINT64)modCount << 32));
+        volatile __int64 exchange  = ((UINT64)entryOffset | ((UINT64)newModCount << 32));
+        volatile __int64 *dest     = (__int64 *)PacketQueueHead;
+
+        //
+        // Try to do the assignment now.
+        //
+        if (MyInterlockedCompareExchange64(dest, exchange, comparand) == comparand)
+        {
+            break;
+        }
+    }
+}
+
 //=============================================================================
 //    Method: VirtualPcDriver3::PacketBufferMoveList().
 //
@@ -2942,18 +3239,78 @@ VirtualPcDriver3::PostReceivePacket(
 }
 
 //=============================================================================
-//    Method: VirtualPcDriver3::PostTransmitPacket().
+//    Method: VirtualPcDriver3::PostReceivePackets().
 //
-//    Description: Posts a packet for transmitting.
+//    Description: Posts several packets for receiving, linked up first so
+//                 they go on the free queue with a single exchange.
 //=============================================================================
 
 HRESULT
-VirtualPcDriver3::PostTransmitPacket( 
+VirtualPcDriver3::PostReceivePackets( 
+    IN PACKET ** Packets,
+    IN UINT32    nPackets
+    )
+{
+    VPCNetSvPacketEntryPtr firstEntry = NULL, lastEntry = NULL;
+    HRESULT Result = ERROR_IO_PENDING;
+
+    for (UINT32 i = 0; i < nPackets; i++) {
+        VPCNetSvPacketEntryPtr packetEntry = (VPCNetSvPacketEntryPtr)Packets[i]->DriverState;
+        UINT32 entryOffset = GetPacketEntryOffsetFromPointer(&mRxBuffer, packetEntry);
+
+        //
+        // Not one of ours, post the rest but tell the caller.
+        //
+        if (!IsValidPacketEntryOffset(&mRxBuffer, entryOffset)) {
+            Result = E_FAIL;
+            continue;
+        }
+
+        LogIt("pkt::rp %p",(UINT_PTR)packetEntry);
+
+        //
+        // JIC, refresh size; then link it in.
+        //
+        packetEntry->fPacketLength = (Packets[i]->Length > kVPCNetSvMaximumPacketLength) ?
+            kVPCNetSvMaximumPacketLength : Packets[i]->Length;
+        Packets[i]->KernelOwned = TRUE;
+
+        if (lastEntry != NULL)
+            lastEntry->fNextPacketOffset = entryOffset;
+        else
+            firstEntry = packetEntry;
+        lastEntry = packetEntry;
+    }
+
+    if (firstEntry != NULL)
+        PacketBufferEnqueueList(&mRxBuffer,
+                                &mRxBuffer.fPacketBuffer->fFreeBufferQueue,
+                                firstEntry,
+                                lastEntry);
+
+    return Result;
+}
+
+//=============================================================================
+//    Method: VirtualPcDriver3::QueueTransmitPacket().
+//
+//    Description: Puts a packet on the transmit ring. The driver does not
+//                 know about it until AddTransmitPending.
+//=============================================================================
+
+void
+VirtualPcDriver3::QueueTransmitPacket( 
     IN PACKET * Packet
     )
 {
     VPCNetSvPacketEntryPtr packetEntry = (VPCNetSvPacketEntryPtr)Packet->DriverState;
 
+    //
+    // The packet buffer is the shared packet entry, this is the one copy
+    // into memory the driver can see.
+    //
+    Packet->Flatten();
+
     LogIt("pkt::xp %p %u",(UINT_PTR)packetEntry,Packet->nBytesAvail);
 
     //
@@ -2963,65 +3320,128 @@ VirtualPcDriver3::PostTransmitPacket(
         kVPCNetSvMaximumPacketLength : Packet->nBytesAvail;
     Packet->KernelOwned = TRUE;
     PostTransmitPacketEntry(packetEntry);
+}
 
-    //
-    // Bump the count of in-flight xmit packets
-    //
+//=============================================================================
+//    Method: VirtualPcDriver3::AddTransmitPending().
+//
+//    Description: Bump the count of in-flight xmit packets.
+//=============================================================================
+
+void
+VirtualPcDriver3::AddTransmitPending( 
+    IN LONG nPackets
+    )
+{
     LONG oldCount, newCount;
     for (;;) {
         oldCount = mTxBuffer.fPacketBuffer->fPendingCount;
-        newCount = oldCount + 1;
+        newCount = oldCount + nPackets;
         if (InterlockedCompareExchange(
                  (volatile LONG *)&mTxBuffer.fPacketBuffer->fPendingCount,
                  newCount,
                  oldCount) == oldCount)
                 break;
     }
+}
 
-    //
-    // Wakeup the driver if it was (possibly) idle.
-    //
-    if (/*(newCount == 1) || */Packet->Flush) {
-        DWORD length = 0;
-        if (DeviceIoControl(this->hFileHandle,
-                            (DWORD) IOCTL_PROCESS_TRANSMIT_BUFFERS,
-                            NULL,
-                            0,
-                            NULL,
-                            0,
-                            &length,
-                            NULL) == FALSE)
-        {
-            //
-            // Not much we can do about it.
-            //
-            WARN(("Warning: Failed to wakeup xmit path (le=%u)",
-                   GetLastError()));
-        }
+//=============================================================================
+//    Method: VirtualPcDriver3::KickTransmit().
+//
+//    Description: Wakeup the driver if it was (possibly) idle.
+//=============================================================================
+
+void
+VirtualPcDriver3::KickTransmit(void)
+{
+    DWORD length = 0;
+    if (DeviceIoControl(this->hFileHandle,
+                        (DWORD) IOCTL_PROCESS_TRANSMIT_BUFFERS,
+                        NULL,
+                        0,
+                        NULL,
+                        0,
+                        &length,
+                        NULL) == FALSE)
+    {
+        //
+        // Not much we can do about it.
+        //
+        WARN(("Warning: Failed to wakeup xmit path (le=%u)",
+               GetLastError()));
     }
+}
+
+//=============================================================================
+//    Method: VirtualPcDriver3::PostTransmitPacket().
+//
+//    Description: Posts a packet for transmitting.
+//=============================================================================
+
+HRESULT
+VirtualPcDriver3::PostTransmitPacket( 
+    IN PACKET * Packet
+    )
+{
+    QueueTransmitPacket(Packet);
+    AddTransmitPending(1);
+
+    if (Packet->Flush)
+        KickTransmit();
 
     return ERROR_IO_PENDING;
 }
 
 //=============================================================================
-//  Method: VirtualPcDriver3::GetNextReceivedPacket().
+//    Method: VirtualPcDriver3::PostTransmitPackets().
 //
-//  Description: Dequeues the next packet from the receive queue.
-//               The xmit queue is ignored.
+//    Description: Posts several packets for transmitting, with one update
+//                 of the in-flight count and (at most) one wakeup.
 //=============================================================================
 
-PACKET *
-VirtualPcDriver3::GetNextReceivedPacket(
-    IN UINT32 TimeOutInMsec
-)
+HRESULT
+VirtualPcDriver3::PostTransmitPackets( 
+    IN PACKET ** Packets,
+    IN UINT32    nPackets
+    )
 {
-    VPCNetSvPacketEntry * packetEntry;
-    UINT32 nDequeued = 1;
-    PACKET_MODE Mode = PacketModeInvalid;
+    BOOL bFlush = FALSE;
 
-    NOISE(("VirtualPcDriver3::GetNextReceivedPacket(%u)..",TimeOutInMsec));
+    if (nPackets == 0)
+        return S_OK;
 
-    packetEntry = ReceiveCompleted.Pop();
+    for (UINT32 i = 0; i < nPackets; i++) {
+        QueueTransmitPacket(Packets[i]);
+        bFlush = bFlush || Packets[i]->Flush;
+    }
+    AddTransmitPending((LONG)nPackets);
+
+    if (bFlush)
+        KickTransmit();
+
+    return ERROR_IO_PENDING;
+}
+
+//=============================================================================
+//  Method: VirtualPcDriver3::GetNextReceivedPacket().
+//
+//  Description: Dequeues the next packet from the receive queue.
+//               The xmit queue is ignored.
+//=============================================================================
+
+PACKET *
+VirtualPcDriver3::GetNextReceivedPacket(
+    IN UINT32 TimeOutInMsec
+)
+{
+    VPCNetSvPacketEntry * packetEntry;
+    UINT32 nDequeued = 1;
+    PACKET_MODE Mode = PacketModeInvalid;
+    LONGLONG SpinDeadline = 0, WaitDeadline = 0;
+
+    NOISE(("VirtualPcDriver3::GetNextReceivedPacket(%u)..",TimeOutInMsec));
+
+    packetEntry = ReceiveCompleted.Pop();
     if (packetEntry != NULL)
         goto HaveReceived;
 
@@ -3051,8 +3471,19 @@ VirtualPcDriver3::GetNextReceivedPacket(
                    GetLastError()));
         }
 
+        //
+        // In low-latency mode, poll a little while before going to sleep.
+        // If the kernel signalled in the meantime the wait below comes back
+        // right away later on, and we just recheck.
+        // The spin comes out of the timeout, and a recheck only spins
+        // whatever is left of the budget.
+        //
+        if (SpinForReceive(TimeOutInMsec, &SpinDeadline, &WaitDeadline))
+            goto ReCheck;
+
         //DPRINTF(("WFSO.."));
-        DWORD EventIndex = WaitForSingleObject(hEvents[iRecvEvent],TimeOutInMsec);
+        DWORD EventIndex = WaitForSingleObject(hEvents[iRecvEvent],
+                                               RemainingWait(TimeOutInMsec, WaitDeadline));
 
         if (EventIndex != WAIT_OBJECT_0) {
             LogIt("pkt::grp.timeout");
@@ -3127,6 +3558,84 @@ VirtualPcDriver3::GetNextReceivedPacket(
     return newPacket;
 }
 
+//=============================================================================
+//  Method: VirtualPcDriver3::GetNextReceivedPackets().
+//
+//  Description: Dequeues the next few packets from the receive queue.
+//               Only the first one might wait, after that we take what
+//               is on the ring already and stop short of calling the driver.
+//=============================================================================
+
+UINT32
+VirtualPcDriver3::GetNextReceivedPackets(
+    OUT PACKET ** Packets,
+    IN  UINT32    MaxPackets,
+    IN  UINT32    TimeOutInMsec
+)
+{
+    UINT32 nPackets = 0;
+    PACKET *Packet;
+
+    if (MaxPackets == 0)
+        return 0;
+
+    Packet = GetNextReceivedPacket(TimeOutInMsec);
+    while (Packet != NULL) {
+        Packets[nPackets++] = Packet;
+        if (nPackets == MaxPackets)
+            break;
+        if (ReceiveCompleted.IsEmpty() &&
+            (mRxBuffer.fPacketBuffer->fPendingCount == 0))
+            break;
+        Packet = GetNextReceivedPacket(0);
+    }
+    return nPackets;
+}
+
+//=============================================================================
+//  Method: VirtualPcDriver3::SpinForReceive().
+//
+//  Description: Poll the receive ring for up to the spin budget (or the
+//               timeout, if shorter). Returns TRUE if something showed up.
+//               The first call of a GetNextReceivedPacket sets both
+//               deadlines (zero until then), so that later calls only
+//               spin what is left and the wait only gets what is left.
+//=============================================================================
+
+BOOL
+VirtualPcDriver3::SpinForReceive(
+    IN UINT32 TimeOutInMsec,
+    IN OUT LONGLONG *SpinDeadline,
+    IN OUT LONGLONG *WaitDeadline
+)
+{
+    LARGE_INTEGER Now;
+    LONGLONG Ticks = ReceiveSpinTicks;
+
+    if ((Ticks == 0) || (TimeOutInMsec == 0))
+        return FALSE;
+
+    QueryPerformanceCounter(&Now);
+    if (*SpinDeadline == 0) {
+        if (TimeOutInMsec != INFINITE) {
+            LONGLONG TimeOut = (LONGLONG)TimeOutInMsec * CounterFrequency / 1000;
+            if (Ticks > TimeOut)
+                Ticks = TimeOut;
+            *WaitDeadline = Now.QuadPart + TimeOut;
+        }
+        *SpinDeadline = Now.QuadPart + Ticks;
+    }
+
+    while (Now.QuadPart < *SpinDeadline) {
+        if (*(volatile LONG *)&mRxBuffer.fPacketBuffer->fPendingCount != 0)
+            return TRUE;
+        YieldProcessor();
+        QueryPerformanceCounter(&Now);
+    }
+
+    return FALSE;
+}
+
 //=============================================================================
 //    Method: VirtualPcDriver3::GetNextCompletedPacket().
 //
@@ -3612,116 +4121,1543 @@ NdisPacketFilter::GetSymbolicName(
 #endif // defined(OLD_DRIVER_SUPPORTED)
 
 //=============================================================================
-//    Function: OpenPacketDriver().
+//    SubSection: LOOPBACK_DRIVER::
 //
-//    Description: Create the proper interface to the packet driver.
+//    Description: A stand-in for the NIC, to test and measure without one.
+//    Two drivers opened on LOOPBACK_NIC_NAME in the same process are the two
+//    ends of a wire: a frame transmitted on one end is copied into the
+//    oldest receive posted on the other end, or dropped if there is none
+//    (or it is too small), same as a NIC would.
+//    Transmits complete right away. They are only reported by
+//    GetNextCompletedPacket, and only once the user has called it: users
+//    that free their own transmits (the SIRC client) never see them.
 //=============================================================================
 
-PACKET_DRIVER * 
-OpenPacketDriver(
-    IN const wchar_t *PreferredNicName,
-    IN UINT           PreferredPacketDriverVersion,
-    IN BOOL           bQuiet
-    )
-{
-    PACKET_DRIVER *Interface = NULL;
+//
+// Largest frame the wire takes
+//
+#define LOOPBACK_FRAME_SIZE    MAX_JUMBO_FRAME_SIZE
 
-    LogIt("pkt::OpenPacketDriver(%d,%d)",PreferredPacketDriverVersion,bQuiet);
+//
+// A FIFO of packets, linked through PACKET::Next
+//
+class PacketFifo {
+public:
+    void Put(IN PACKET *Packet)
+    {
+        Packet->Next = NULL;
+        if (mTail != NULL)
+            mTail->Next = Packet;
+        else
+            mHead = Packet;
+        mTail = Packet;
+    }
 
-    //
-    // Ack user preferences (once)
-    //
-    if (!bQuiet)
+    PACKET *Take(void)
     {
-        if (PreferredPacketDriverVersion)
-            printf("Wants PacketDriverVersion %u exclusively\n",
-                   PreferredPacketDriverVersion);
-        if (PreferredNicName)
-            printf("Wants NIC '%ls' exclusively\n",
-                   PreferredNicName);
+        PACKET *Packet = mHead;
+        if (Packet != NULL) {
+            mHead = Packet->Next;
+            if (mHead == NULL)
+                mTail = NULL;
+            Packet->Next = NULL;
+        }
+        return Packet;
     }
 
-#if 1
-#else
-    //SUPPORT_V3_ON_S2 Not quite the default yet, because of completion issues.
-    if (PreferredPacketDriverVersion == 0)
-        PreferredPacketDriverVersion = 2;
-#endif
+    PacketFifo(void)
+    {
+        mHead = mTail = NULL;
+    }
 
-    switch (PreferredPacketDriverVersion)
+private:
+    PACKET *mHead;
+    PACKET *mTail;
+};
+
+class LOOPBACK_DRIVER;
+
+//
+// The wire, shared by both ends. Lock covers both ends' queues.
+//
+struct LOOPBACK_WIRE {
+    CRITICAL_SECTION   Lock;
+    LOOPBACK_DRIVER   *Ends[2];
+};
+
+class LOOPBACK_DRIVER : public PACKET_DRIVER {
+public:
+    LOOPBACK_DRIVER(void);
+    virtual ~LOOPBACK_DRIVER(void);
+
+    virtual BOOL Open(IN const wchar_t *AdapterName);
+
+    virtual BOOL Flush(void)
     {
-    case 0:
-        //
-        // Try all the things we know, in turn.
-        //
+        return TRUE;
+    }
 
-    case 3:
-        //
-        // Try the shared-memory based VPC interface
-        //
-        Interface = new VirtualPcDriver3(DEBUG_LEVEL,bQuiet);
-        if (Interface->Open(PreferredNicName))
-        {
-            if (!bQuiet)
-                printf("Using PacketDriverVersion 3.\n");
-            return Interface;
-        }
-        else
-            delete Interface;
-        if (PreferredPacketDriverVersion != 0)
-            goto NoDice;
-        // else fall-through
+    virtual PACKET * AllocatePacket(IN BYTE *Buffer,
+                                    IN UINT Length,
+                                    IN BOOL bForReceive
+                                    );
+    virtual void FreePacket(IN PACKET *Packet,
+                            IN BOOL bForReceiving);
 
-    case 2:
-        //
-        // Try the FILE I/O based VPC interface
-        //
-        Interface = new VirtualPcDriver2(DEBUG_LEVEL,bQuiet);
-        if (Interface->Open(PreferredNicName))
-        {
-            if (!bQuiet)
-                printf("Using PacketDriverVersion 2.\n");
-            return Interface;
-        }
-        else
-            delete Interface;
-        if (PreferredPacketDriverVersion != 0)
-            goto NoDice;
+    virtual HRESULT PostReceivePacket(IN PACKET *Packet);
 
-    case 1:
-        //
-        // Try the NDIS packet filter interface
-        //
-#if defined(OLD_DRIVER_SUPPORTED)
-        Interface = new NdisPacketFilter(DEBUG_LEVEL,bQuiet);
-        if (Interface->Open(PreferredNicName))
-        {
-            if (!bQuiet)
-                printf("Using PacketDriverVersion 1.\n");
-            return Interface;
-        }
-        else
-            delete Interface;
-#endif
-        // else fall-through
+    virtual HRESULT PostTransmitPacket(IN PACKET *Packet);
 
-    NoDice:
-        //
-        // That did not work.
-        //
-        if (PreferredPacketDriverVersion != 0) {
-            WARN(("No suitable NIC."));
-        }
-        // else warned already.
-        return NULL;
+    virtual PACKET_MODE GetNextCompletedPacket(OUT PACKET ** pPacket,
+                                               IN  UINT32 TimeOutInMsec
+                                               );
 
-    default:
+    virtual PACKET *GetNextReceivedPacket(IN  UINT32 TimeOutInMsec);
+
+    virtual BOOL GetMacAddress( OUT UINT8 *MacAddress)
+    {
+        memcpy(MacAddress, this->MacAddress, 6);
+        return TRUE;
+    }
+
+    virtual BOOL ChangeMacAddress( IN UINT8 *MacAddress)
+    {
+        memcpy(this->MacAddress, MacAddress, 6);
+        return TRUE;
+    }
+
+    virtual HRESULT SetFilter(IN UINT32 Filter)
+    {
+        UnusedParameter(Filter);
+        return S_OK;
+    }
+
+    virtual BOOL GetMaxOutstanding(OUT UINT32 *NumReads,
+                                   OUT UINT32 *NumWrites)
+    {
         //
-        // Not a version we can support
+        // No limits
         //
-        WARN(("Preferred DriverVersion is not supported."));
-        break;
+        *NumReads = 0;
+        *NumWrites = 0;
+        return TRUE;
     }
 
-    return NULL;
+    virtual BOOL GetMaxFrameSize(OUT UINT32 *FrameSize)
+    {
+        *FrameSize = LOOPBACK_FRAME_SIZE;
+        return TRUE;
+    }
+
+private:
+    PACKET *TakeCompleted(IN BOOL bTransmitsToo);
+
+    LOOPBACK_WIRE     *Wire;
+    UINT               End;
+    UINT8              MacAddress[6];
+    HANDLE             hWakeup;
+    //
+    // Set once the user asks for transmit completions
+    //
+    BOOL               bReportTransmits;
+    //
+    // All of these are under Wire->Lock
+    //
+    PacketFifo         Posted;
+    PacketFifo         Received;
+    PacketFifo         Transmitted;
+};
+
+//
+// The wire waiting for its second end, and a lock for pairing them up
+//
+static LOOPBACK_WIRE *LoopbackWire = NULL;
+static volatile LONG LoopbackWireLock = 0;
+
+//=============================================================================
+//    Method: LOOPBACK_DRIVER::LOOPBACK_DRIVER().
+//
+//    Description: Constructor.
+//=============================================================================
+
+LOOPBACK_DRIVER::LOOPBACK_DRIVER(void)
+{
+    this->Wire = NULL;
+    this->End = 0;
+    memset(this->MacAddress, 0, sizeof(this->MacAddress));
+    this->hWakeup = CreateEvent(NULL, FALSE, FALSE, NULL);
+    this->bReportTransmits = FALSE;
+}
+
+//=============================================================================
+//    Method: LOOPBACK_DRIVER::~LOOPBACK_DRIVER().
+//
+//    Description: Unplug from the wire, free what is still queued here.
+//                 The wire goes away with its last end.
+//=============================================================================
+
+LOOPBACK_DRIVER::~LOOPBACK_DRIVER(void)
+{
+    PACKET *Packet;
+    BOOL bLast = FALSE;
+
+    if (Wire != NULL) {
+        while (InterlockedExchange(&LoopbackWireLock, 1) != 0)
+            Sleep(0);
+        EnterCriticalSection(&Wire->Lock);
+        Wire->Ends[End] = NULL;
+        bLast = (Wire->Ends[1 - End] == NULL);
+        if (bLast && LoopbackWire == Wire)
+            LoopbackWire = NULL;
+        LeaveCriticalSection(&Wire->Lock);
+        InterlockedExchange(&LoopbackWireLock, 0);
+
+        if (bLast) {
+            DeleteCriticalSection(&Wire->Lock);
+            delete Wire;
+        }
+    }
+
+    //
+    // Nobody delivers to us anymore
+    //
+    while ((Packet = Posted.Take()) != NULL)
+        FreePacket(Packet, TRUE);
+    while ((Packet = Received.Take()) != NULL)
+        FreePacket(Packet, TRUE);
+    while ((Packet = Transmitted.Take()) != NULL)
+        FreePacket(Packet, FALSE);
+
+    if (hWakeup != NULL)
+        CloseHandle(hWakeup);
+}
+
+//=============================================================================
+//    Method: LOOPBACK_DRIVER::Open().
+//
+//    Description: Plug into the wire that is waiting for its second end,
+//                 or put up a new one. The first end gets MAC address
+//                 02:00:00:00:00:01, the second 02:00:00:00:00:02.
+//=============================================================================
+
+BOOL
+LOOPBACK_DRIVER::Open(
+    IN const wchar_t *AdapterName
+    )
+{
+    UnusedParameter(AdapterName);
+
+    if (hWakeup == NULL)
+        return FALSE;
+
+    while (InterlockedExchange(&LoopbackWireLock, 1) != 0)
+        Sleep(0);
+
+    if (LoopbackWire == NULL) {
+        LoopbackWire = new LOOPBACK_WIRE;
+        if (LoopbackWire == NULL) {
+            InterlockedExchange(&LoopbackWireLock, 0);
+            return FALSE;
+        }
+        InitializeCriticalSection(&LoopbackWire->Lock);
+        LoopbackWire->Ends[0] = LoopbackWire->Ends[1] = NULL;
+    }
+
+    Wire = LoopbackWire;
+    EnterCriticalSection(&Wire->Lock);
+    End = (Wire->Ends[0] == NULL) ? 0 : 1;
+    Wire->Ends[End] = this;
+    //
+    // Full, the next one opened gets a wire of its own
+    //
+    if (Wire->Ends[1 - End] != NULL)
+        LoopbackWire = NULL;
+    LeaveCriticalSection(&Wire->Lock);
+
+    InterlockedExchange(&LoopbackWireLock, 0);
+
+    //
+    // Locally administered, unicast
+    //
+    MacAddress[0] = 0x02;
+    MacAddress[5] = (UINT8)(End + 1);
+    return TRUE;
+}
+
+//=============================================================================
+//    Method: LOOPBACK_DRIVER::AllocatePacket().
+//
+//    Description: Packets and buffers come straight from the heap.
+//=============================================================================
+
+PACKET *
+LOOPBACK_DRIVER::AllocatePacket(
+    IN BYTE *Buffer,
+    IN UINT Length,
+    IN BOOL bForReceive
+    )
+{
+    PACKET *Packet;
+
+    UnusedParameter(Buffer);
+
+    Packet = new PACKET;
+    if (Packet == NULL)
+        return NULL;
+    memset(Packet, 0, sizeof *Packet);
+
+    Buffer = new BYTE[Length];
+    if (Buffer == NULL) {
+        delete Packet;
+        return NULL;
+    }
+
+    Packet->Init(Buffer, Length);
+    Packet->DriverState = this;
+    Packet->Mode = (bForReceive) ? PacketModeReceiving : PacketModeTransmitting;
+    return Packet;
+}
+
+//=============================================================================
+//    Method: LOOPBACK_DRIVER::FreePacket().
+//=============================================================================
+
+void
+LOOPBACK_DRIVER::FreePacket(
+    IN PACKET * Packet,
+    IN BOOL bForReceiving
+    )
+{
+    UnusedParameter(bForReceiving);
+
+    delete [] Packet->Buffer;
+    delete Packet;
+}
+
+//=============================================================================
+//    Method: LOOPBACK_DRIVER::PostReceivePacket().
+//=============================================================================
+
+HRESULT
+LOOPBACK_DRIVER::PostReceivePacket(
+    IN PACKET * Packet
+    )
+{
+    EnterCriticalSection(&Wire->Lock);
+    Packet->KernelOwned = TRUE;
+    Posted.Put(Packet);
+    LeaveCriticalSection(&Wire->Lock);
+    return ERROR_IO_PENDING;
+}
+
+//=============================================================================
+//    Method: LOOPBACK_DRIVER::PostTransmitPacket().
+//
+//    Description: Copy the frame over to the other end, and complete the
+//                 transmit right away. The gather segment is copied
+//                 straight from where it is, the packet is never flattened.
+//=============================================================================
+
+HRESULT
+LOOPBACK_DRIVER::PostTransmitPacket(
+    IN PACKET * Packet
+    )
+{
+    LOOPBACK_DRIVER *Peer;
+    PACKET *Receive;
+    UINT32 FrameLength = Packet->nBytesAvail + Packet->GatherLength;
+
+    Packet->Result = S_OK;
+
+    EnterCriticalSection(&Wire->Lock);
+
+    Peer = Wire->Ends[1 - End];
+    if (Peer != NULL && FrameLength <= LOOPBACK_FRAME_SIZE) {
+        Receive = Peer->Posted.Take();
+        if (Receive != NULL) {
+            if (FrameLength <= Receive->Length) {
+                memcpy(Receive->Buffer, Packet->Buffer, Packet->nBytesAvail);
+                if (Packet->Gather != NULL)
+                    memcpy(Receive->Buffer + Packet->nBytesAvail, Packet->Gather, Packet->GatherLength);
+                Receive->nBytesAvail = FrameLength;
+                Receive->Result = S_OK;
+                Receive->KernelOwned = FALSE;
+                Peer->Received.Put(Receive);
+                SetEvent(Peer->hWakeup);
+            }
+            else
+                Peer->Posted.Put(Receive);
+        }
+    }
+
+    //
+    // A packet reposted before its completion was taken is only queued once
+    //
+    if (bReportTransmits && !Packet->KernelOwned) {
+        Packet->KernelOwned = TRUE;
+        Transmitted.Put(Packet);
+        SetEvent(hWakeup);
+    }
+
+    LeaveCriticalSection(&Wire->Lock);
+    return S_OK;
+}
+
+//=============================================================================
+//    Method: LOOPBACK_DRIVER::TakeCompleted().
+//
+//    Description: Oldest transmit completion (if asked to), else the
+//                 oldest receive.
+//=============================================================================
+
+PACKET *
+LOOPBACK_DRIVER::TakeCompleted(
+    IN BOOL bTransmitsToo
+    )
+{
+    PACKET *Packet = NULL;
+
+    EnterCriticalSection(&Wire->Lock);
+    if (bTransmitsToo)
+        Packet = Transmitted.Take();
+    if (Packet == NULL)
+        Packet = Received.Take();
+    if (Packet != NULL)
+        Packet->KernelOwned = FALSE;
+    LeaveCriticalSection(&Wire->Lock);
+    return Packet;
+}
+
+//=============================================================================
+//    Method: LOOPBACK_DRIVER::GetNextReceivedPacket().
+//
+//    Description: Next frame from the other end, waiting for it up to
+//                 TimeOutInMsec.
+//=============================================================================
+
+PACKET *
+LOOPBACK_DRIVER::GetNextReceivedPacket(
+    IN UINT32 TimeOutInMsec
+    )
+{
+    UINT32 StartTime = GetTickCount();
+    UINT32 Elapsed;
+    PACKET *Packet;
+
+    for (;;) {
+        Packet = TakeCompleted(FALSE);
+        if (Packet != NULL)
+            return Packet;
+
+        Elapsed = GetTickCount() - StartTime;
+        if (TimeOutInMsec != INFINITE && Elapsed >= TimeOutInMsec)
+            return NULL;
+
+        WaitForSingleObject(hWakeup,
+                            (TimeOutInMsec == INFINITE) ? INFINITE : TimeOutInMsec - Elapsed);
+    }
+}
+
+//=============================================================================
+//    Method: LOOPBACK_DRIVER::GetNextCompletedPacket().
+//
+//    Description: Same, but transmit completions are reported too (from
+//                 now on).
+//=============================================================================
+
+PACKET_MODE
+LOOPBACK_DRIVER::GetNextCompletedPacket(
+    OUT PACKET ** pPacket,
+    IN  UINT32    TimeOutInMsec
+    )
+{
+    UINT32 StartTime = GetTickCount();
+    UINT32 Elapsed;
+    PACKET *Packet;
+
+    bReportTransmits = TRUE;
+
+    for (;;) {
+        Packet = TakeCompleted(TRUE);
+        if (Packet != NULL) {
+            *pPacket = Packet;
+            return Packet->Mode;
+        }
+
+        Elapsed = GetTickCount() - StartTime;
+        if (TimeOutInMsec != INFINITE && Elapsed >= TimeOutInMsec) {
+            *pPacket = NULL;
+            return PacketModeInvalid;
+        }
+
+        WaitForSingleObject(hWakeup,
+                            (TimeOutInMsec == INFINITE) ? INFINITE : TimeOutInMsec - Elapsed);
+    }
+}
+
+//=============================================================================
+//    Function: OpenPacketDriver().
+//
+//    Description: Create the proper interface to the packet driver.
+//=============================================================================
+
+PACKET_DRIVER * 
+OpenPacketDriver(
+    IN const wchar_t *PreferredNicName,
+    IN UINT           PreferredPacketDriverVersion,
+    IN BOOL           bQuiet
+    )
+{
+    PACKET_DRIVER *Interface = NULL;
+
+    LogIt("pkt::OpenPacketDriver(%d,%d)",PreferredPacketDriverVersion,bQuiet);
+
+    //
+    // The in-process stand-in is only ever used when asked for by name
+    //
+    if (PreferredNicName && wcscmp(PreferredNicName, LOOPBACK_NIC_NAME) == 0)
+    {
+        Interface = new LOOPBACK_DRIVER();
+        if (Interface != NULL && Interface->Open(PreferredNicName))
+        {
+            if (!bQuiet)
+                printf("Using the loopback stand-in.\n");
+            return Interface;
+        }
+        delete Interface;
+        return NULL;
+    }
+
+    //
+    // Ack user preferences (once)
+    //
+    if (!bQuiet)
+    {
+        if (PreferredPacketDriverVersion)
+            printf("Wants PacketDriverVersion %u exclusively\n",
+                   PreferredPacketDriverVersion);
+        if (PreferredNicName)
+            printf("Wants NIC '%ls' exclusively\n",
+                   PreferredNicName);
+    }
+
+#if 1
+#else
+    //SUPPORT_V3_ON_S2 Not quite the default yet, because of completion issues.
+    if (PreferredPacketDriverVersion == 0)
+        PreferredPacketDriverVersion = 2;
+#endif
+
+    switch (PreferredPacketDriverVersion)
+    {
+    case 0:
+        //
+        // Try all the things we know, in turn.
+        //
+
+    case 3:
+        //
+        // Try the shared-memory based VPC interface
+        //
+        Interface = new VirtualPcDriver3(DEBUG_LEVEL,bQuiet);
+        if (Interface->Open(PreferredNicName))
+        {
+            if (!bQuiet)
+                printf("Using PacketDriverVersion 3.\n");
+            return Interface;
+        }
+        else
+            delete Interface;
+        if (PreferredPacketDriverVersion != 0)
+            goto NoDice;
+        // else fall-through
+
+    case 2:
+        //
+        // Try the FILE I/O based VPC interface
+        //
+        Interface = new VirtualPcDriver2(DEBUG_LEVEL,bQuiet);
+        if (Interface->Open(PreferredNicName))
+        {
+            if (!bQuiet)
+                printf("Using PacketDriverVersion 2.\n");
+            return Interface;
+        }
+        else
+            delete Interface;
+        if (PreferredPacketDriverVersion != 0)
+            goto NoDice;
+
+    case 1:
+        //
+        // Try the NDIS packet filter interface
+        //
+#if defined(OLD_DRIVER_SUPPORTED)
+        Interface = new NdisPacketFilter(DEBUG_LEVEL,bQuiet);
+        if (Interface->Open(PreferredNicName))
+        {
+            if (!bQuiet)
+                printf("Using PacketDriverVersion 1.\n");
+            return Interface;
+        }
+        else
+            delete Interface;
+#endif
+        // else fall-through
+
+    NoDice:
+        //
+        // That did not work.
+        //
+        if (PreferredPacketDriverVersion != 0) {
+            WARN(("No suitable NIC."));
+        }
+        // else warned already.
+        return NULL;
+
+    default:
+        //
+        // Not a version we can support
+        //
+        WARN(("Preferred DriverVersion is not supported."));
+        break;
+    }
+
+    return NULL;
+}
+
+//=============================================================================
+//    SubSection: NIC_DEMUX::, DEMUX_PORT::
+//
+//    Description: One NIC shared by many FPGAs.
+//    A NIC_DEMUX owns the packet driver for one NIC and the one set of
+//    receives posted to it. Each user gets a DEMUX_PORT, which looks like a
+//    packet driver of its own but only ever receives the frames that come
+//    from its FPGA. Frames are steered by source MAC address into a lock-free
+//    queue per port, by whichever port happens to be waiting on the NIC at
+//    the time (the pump). Frames from nobody we know are reposted right away.
+//    Transmits go straight through to the driver.
+//    NB: This assumes the drivers keep the receive and transmit paths apart,
+//    one thread may wait for receives while others transmit.
+//=============================================================================
+
+//
+// Most ports (FPGAs) on one NIC
+//
+#define MAX_DEMUX_PORTS        64
+
+//
+// Receives we post on the NIC, unless the driver has a limit of its own
+//
+#define DEMUX_RECEIVES         400
+
+//
+// Longest the pump waits on the NIC before it gives the others a chance
+// to take over. Also bounds how long closing a port can take.
+//
+#define DEMUX_PUMP_SLICE       50
+
+class DEMUX_PORT;
+
+class NIC_DEMUX {
+public:
+    NIC_DEMUX(IN PACKET_DRIVER  *Driver,
+              IN const wchar_t  *NicName,
+              IN UINT            DriverVersion);
+    ~NIC_DEMUX(void);
+
+    BOOL PostReceives(void);
+    BOOL Matches(IN const wchar_t *NicName,
+                 IN UINT           DriverVersion);
+    BOOL AddPort(IN DEMUX_PORT *Port);
+    BOOL RemovePort(IN DEMUX_PORT *Port);
+    PACKET *Pump(IN DEMUX_PORT *Port,
+                 IN UINT32      TimeOutInMsec);
+    void WakePorts(IN DEMUX_PORT *Except);
+    void Repost(IN PACKET *Packet);
+
+    static UINT64 MacKey(IN const UINT8 *MacAddress)
+    {
+        UINT64 Key = 0;
+        for (int i = 0; i < 6; i++)
+            Key = (Key << 8) | MacAddress[i];
+        return Key;
+    }
+
+    PACKET_DRIVER     *Driver;
+    NIC_DEMUX         *Next;
+    //
+    // Serializes everything but receive waits on Driver
+    //
+    CRITICAL_SECTION   DriverLock;
+    //
+    // Held by the port that is waiting on the NIC (the pump)
+    //
+    CRITICAL_SECTION   PumpLock;
+    //
+    // Ports in the middle of WakePorts, which runs outside PumpLock
+    //
+    volatile LONG      nWaking;
+    DEMUX_PORT * volatile Ports[MAX_DEMUX_PORTS];
+    UINT32             nPorts;
+    UINT32             FrameSize;
+    UINT32             nReceives;
+    UINT               DriverVersion;
+    wchar_t            NicName[MAX_LINK_NAME_LENGTH];
+};
+
+class DEMUX_PORT : public PACKET_DRIVER {
+public:
+    DEMUX_PORT(IN NIC_DEMUX   *Demux,
+               IN const UINT8 *FpgaMacAddress);
+    virtual ~DEMUX_PORT(void);
+
+    virtual BOOL Open(IN const wchar_t *AdapterName)
+    {
+        return TRUE;
+    }
+
+    virtual BOOL Flush(void);
+
+    virtual PACKET * AllocatePacket(IN BYTE *Buffer,
+                                    IN UINT Length,
+                                    IN BOOL bForReceive
+                                    );
+    virtual void FreePacket(IN PACKET *Packet,
+                            IN BOOL bForReceiving);
+
+    virtual HRESULT PostReceivePacket(IN PACKET *Packet);
+
+    virtual HRESULT PostTransmitPacket(IN PACKET *Packet);
+
+    virtual HRESULT PostTransmitPackets(IN PACKET **Packets,
+                                        IN UINT32   nPackets);
+
+    virtual PACKET_MODE GetNextCompletedPacket(OUT PACKET ** pPacket,
+                                               IN  UINT32 TimeOutInMsec
+                                               );
+
+    virtual PACKET *GetNextReceivedPacket(IN  UINT32 TimeOutInMsec);
+
+    virtual UINT32 GetNextReceivedPackets(OUT PACKET **Packets,
+                                          IN  UINT32   MaxPackets,
+                                          IN  UINT32   TimeOutInMsec);
+
+    virtual HRESULT PostReceivePackets(IN PACKET **Packets,
+                                       IN UINT32   nPackets);
+
+    virtual BOOL GetMacAddress( OUT UINT8 *MacAddress);
+
+    virtual BOOL ChangeMacAddress( IN UINT8 *MacAddress);
+
+    virtual HRESULT SetFilter(IN UINT32 Filter);
+
+    virtual BOOL GetMaxOutstanding(OUT UINT32 *NumReads,
+                                   OUT UINT32 *NumWrites);
+
+    virtual BOOL GetMaxFrameSize(OUT UINT32 *FrameSize);
+
+    virtual BOOL SetReceiveSpin(IN UINT32 Microseconds);
+
+    void Deliver(IN PACKET *Packet);
+    PACKET *TakeArrived(void);
+
+    NIC_DEMUX         *Demux;
+    UINT64             Key;
+    HANDLE             hWakeup;
+    //
+    // Pushed by the pump, newest first.
+    //
+    PACKET * volatile  Arrived;
+    //
+    // Taken from Arrived and put back in order, only the owner touches it.
+    //
+    PACKET            *Ready;
+};
+
+//
+// All the shared NICs, and a lock for opening and closing them
+//
+static NIC_DEMUX *DemuxList = NULL;
+static volatile LONG DemuxListLock = 0;
+
+static void LockDemuxList(void)
+{
+    while (InterlockedExchange(&DemuxListLock, 1) != 0)
+        Sleep(0);
+}
+
+static void UnlockDemuxList(void)
+{
+    InterlockedExchange(&DemuxListLock, 0);
+}
+
+//=============================================================================
+//    Method: NIC_DEMUX::NIC_DEMUX().
+//
+//    Description: Take over an open packet driver.
+//=============================================================================
+
+NIC_DEMUX::NIC_DEMUX(
+    IN PACKET_DRIVER  *Driver,
+    IN const wchar_t  *NicName,
+    IN UINT            DriverVersion
+    )
+{
+    UINT32 nWrites;
+
+    this->Driver = Driver;
+    this->Next = NULL;
+    this->DriverVersion = DriverVersion;
+    this->nPorts = 0;
+    this->nWaking = 0;
+    memset((void *)Ports, 0, sizeof(Ports));
+
+    if (NicName)
+        wcsncpy(this->NicName, NicName, MAX_LINK_NAME_LENGTH - 1);
+    else
+        this->NicName[0] = 0;
+    this->NicName[MAX_LINK_NAME_LENGTH - 1] = 0;
+
+    if (!Driver->GetMaxFrameSize(&FrameSize))
+        FrameSize = MAX_STANDARD_FRAME_SIZE;
+    if (!Driver->GetMaxOutstanding(&nReceives, &nWrites) || nReceives == 0)
+        nReceives = DEMUX_RECEIVES;
+
+    InitializeCriticalSection(&DriverLock);
+    InitializeCriticalSection(&PumpLock);
+}
+
+//=============================================================================
+//    Method: NIC_DEMUX::~NIC_DEMUX().
+//
+//    Description: Last port is gone, close the driver.
+//=============================================================================
+
+NIC_DEMUX::~NIC_DEMUX(void)
+{
+    delete Driver;
+    DeleteCriticalSection(&PumpLock);
+    DeleteCriticalSection(&DriverLock);
+}
+
+//=============================================================================
+//    Method: NIC_DEMUX::PostReceives().
+//
+//    Description: Post the one set of receives all ports share.
+//=============================================================================
+
+BOOL
+NIC_DEMUX::PostReceives(void)
+{
+    for (UINT32 i = 0; i < nReceives; i++) {
+        PACKET *Packet = Driver->AllocatePacket(NULL, FrameSize, TRUE);
+        if (Packet == NULL)
+            return FALSE;
+        Driver->PostReceivePacket(Packet);
+    }
+    return TRUE;
+}
+
+//=============================================================================
+//    Method: NIC_DEMUX::Matches().
+//
+//    Description: Is this the NIC the caller asks for?
+//=============================================================================
+
+BOOL
+NIC_DEMUX::Matches(
+    IN const wchar_t *NicName,
+    IN UINT           DriverVersion
+    )
+{
+    if (DriverVersion != this->DriverVersion)
+        return FALSE;
+    if (NicName == NULL)
+        return this->NicName[0] == 0;
+    return wcsncmp(NicName, this->NicName, MAX_LINK_NAME_LENGTH - 1) == 0;
+}
+
+//=============================================================================
+//    Method: NIC_DEMUX::AddPort().
+//
+//    Description: Start steering the frames from this port's FPGA to it.
+//                 Fails if somebody already has that FPGA, or we are full.
+//                 Called with the demux list locked.
+//=============================================================================
+
+BOOL
+NIC_DEMUX::AddPort(
+    IN DEMUX_PORT *Port
+    )
+{
+    int Free = -1;
+
+    for (int i = 0; i < MAX_DEMUX_PORTS; i++) {
+        if (Ports[i] == NULL) {
+            if (Free < 0)
+                Free = i;
+            continue;
+        }
+        if (Ports[i]->Key == Port->Key) {
+            WARN(("FPGA already has a port on this NIC."));
+            return FALSE;
+        }
+    }
+    if (Free < 0) {
+        WARN(("Too many FPGAs on this NIC."));
+        return FALSE;
+    }
+
+    Ports[Free] = Port;
+    nPorts++;
+    return TRUE;
+}
+
+//=============================================================================
+//    Method: NIC_DEMUX::RemovePort().
+//
+//    Description: Stop steering frames to this port.
+//                 Returns TRUE if that was the last one.
+//                 Called with the demux list locked.
+//=============================================================================
+
+BOOL
+NIC_DEMUX::RemovePort(
+    IN DEMUX_PORT *Port
+    )
+{
+    for (int i = 0; i < MAX_DEMUX_PORTS; i++) {
+        if (Ports[i] == Port) {
+            InterlockedExchangePointer((void * volatile *)&Ports[i], NULL);
+            nPorts--;
+            break;
+        }
+    }
+
+    //
+    // The pump might be holding on to the port still. Wait for it to finish
+    // its slice, after that it cannot find the port anymore.
+    //
+    EnterCriticalSection(&PumpLock);
+    LeaveCriticalSection(&PumpLock);
+
+    //
+    // Same for a port that just let go of the pump and is waking the others.
+    //
+    while (nWaking != 0)
+        Sleep(0);
+
+    return nPorts == 0;
+}
+
+//=============================================================================
+//    Method: NIC_DEMUX::Pump().
+//
+//    Description: Wait on the NIC for a frame for Port, steering all other
+//                 frames to whoever they are for. Called with PumpLock held.
+//=============================================================================
+
+PACKET *
+NIC_DEMUX::Pump(
+    IN DEMUX_PORT *Port,
+    IN UINT32      TimeOutInMsec
+    )
+{
+    UINT32 StartTime = GetTickCount();
+    UINT32 Elapsed;
+
+    for (;;) {
+        PACKET *Packet = Driver->GetNextReceivedPacket(TimeOutInMsec);
+        if (Packet == NULL)
+            return NULL;
+
+        //
+        // Who is this from?
+        //
+        UINT64 Key = MacKey(Packet->Buffer + 6);
+        DEMUX_PORT *Owner = NULL;
+        for (int i = 0; i < MAX_DEMUX_PORTS; i++) {
+            DEMUX_PORT *Candidate = Ports[i];
+            if (Candidate != NULL && Candidate->Key == Key) {
+                Owner = Candidate;
+                break;
+            }
+        }
+
+        if (Owner == Port)
+            return Packet;
+        if (Owner != NULL)
+            Owner->Deliver(Packet);
+        else
+            Repost(Packet);
+
+        //
+        // Keep waiting for whatever is left
+        //
+        Elapsed = GetTickCount() - StartTime;
+        TimeOutInMsec = (Elapsed < TimeOutInMsec) ? TimeOutInMsec - Elapsed : 0;
+        StartTime += Elapsed;
+    }
+}
+
+//=============================================================================
+//    Method: NIC_DEMUX::WakePorts().
+//
+//    Description: The pump is free, let the waiting ports have a go at it.
+//                 This runs after PumpLock is released, so the ports can
+//                 take it right away. RemovePort waits for nWaking to drop,
+//                 so a port we find here stays around until we are done.
+//=============================================================================
+
+void
+NIC_DEMUX::WakePorts(
+    IN DEMUX_PORT *Except
+    )
+{
+    InterlockedIncrement(&nWaking);
+    for (int i = 0; i < MAX_DEMUX_PORTS; i++) {
+        DEMUX_PORT *Port = Ports[i];
+        if (Port != NULL && Port != Except)
+            SetEvent(Port->hWakeup);
+    }
+    InterlockedDecrement(&nWaking);
+}
+
+//=============================================================================
+//    Method: NIC_DEMUX::Repost().
+//
+//    Description: Give a receive packet back to the NIC.
+//=============================================================================
+
+void
+NIC_DEMUX::Repost(
+    IN PACKET *Packet
+    )
+{
+    Packet->Length = FrameSize;
+    EnterCriticalSection(&DriverLock);
+    Driver->PostReceivePacket(Packet);
+    LeaveCriticalSection(&DriverLock);
+}
+
+//=============================================================================
+//    Method: DEMUX_PORT::DEMUX_PORT().
+//
+//    Description: Constructor.
+//=============================================================================
+
+DEMUX_PORT::DEMUX_PORT(
+    IN NIC_DEMUX   *Demux,
+    IN const UINT8 *FpgaMacAddress
+    )
+{
+    this->Demux = Demux;
+    this->Key = NIC_DEMUX::MacKey(FpgaMacAddress);
+    this->Arrived = NULL;
+    this->Ready = NULL;
+    this->hWakeup = CreateEvent(NULL, FALSE, FALSE, NULL);
+}
+
+//=============================================================================
+//    Method: DEMUX_PORT::~DEMUX_PORT().
+//
+//    Description: Give back what was steered to us, close the NIC if we
+//                 were the last one on it.
+//=============================================================================
+
+DEMUX_PORT::~DEMUX_PORT(void)
+{
+    PACKET *Packet;
+    NIC_DEMUX **pDemux;
+    BOOL bLast;
+
+    LockDemuxList();
+    bLast = Demux->RemovePort(this);
+    if (bLast) {
+        for (pDemux = &DemuxList; *pDemux != NULL; pDemux = &(*pDemux)->Next) {
+            if (*pDemux == Demux) {
+                *pDemux = Demux->Next;
+                break;
+            }
+        }
+    }
+    UnlockDemuxList();
+
+    while ((Packet = TakeArrived()) != NULL)
+        Demux->Repost(Packet);
+
+    if (hWakeup != NULL)
+        CloseHandle(hWakeup);
+
+    if (bLast)
+        delete Demux;
+}
+
+//=============================================================================
+//    Method: DEMUX_PORT::Deliver().
+//
+//    Description: The pump found a frame for us. Queue it, lock-free, and
+//                 wake us up.
+//=============================================================================
+
+void
+DEMUX_PORT::Deliver(
+    IN PACKET *Packet
+    )
+{
+    PACKET *Next;
+
+    do {
+        Next = Arrived;
+        Packet->Next = Next;
+    } while (InterlockedCompareExchangePointer((void * volatile *)&Arrived, Packet, Next) != Next);
+
+    SetEvent(hWakeup);
+}
+
+//=============================================================================
+//    Method: DEMUX_PORT::TakeArrived().
+//
+//    Description: Oldest frame steered to us, if any.
+//=============================================================================
+
+PACKET *
+DEMUX_PORT::TakeArrived(void)
+{
+    PACKET *Packet, *List;
+
+    if (Ready == NULL) {
+        //
+        // Take everything that arrived, it comes newest first
+        //
+        List = (PACKET *)InterlockedExchangePointer((void * volatile *)&Arrived, NULL);
+        while (List != NULL) {
+            Packet = List;
+            List = Packet->Next;
+            Packet->Next = Ready;
+            Ready = Packet;
+        }
+    }
+
+    Packet = Ready;
+    if (Packet != NULL) {
+        Ready = Packet->Next;
+        Packet->Next = NULL;
+    }
+    return Packet;
+}
+
+//=============================================================================
+//    Method: DEMUX_PORT::GetNextReceivedPacket().
+//
+//    Description: Next frame from our FPGA. If nobody else is waiting on
+//                 the NIC we do, otherwise we wait for the pump to steer
+//                 something our way (or to let go of the NIC).
+//=============================================================================
+
+PACKET *
+DEMUX_PORT::GetNextReceivedPacket(
+    IN UINT32 TimeOutInMsec
+    )
+{
+    UINT32 StartTime = GetTickCount();
+    UINT32 Elapsed, TimeLeft;
+    PACKET *Packet;
+
+    for (;;) {
+        Packet = TakeArrived();
+        if (Packet != NULL)
+            return Packet;
+
+        Elapsed = GetTickCount() - StartTime;
+        TimeLeft = (TimeOutInMsec == INFINITE) ? INFINITE :
+            ((Elapsed < TimeOutInMsec) ? TimeOutInMsec - Elapsed : 0);
+        if (TimeLeft > DEMUX_PUMP_SLICE)
+            TimeLeft = DEMUX_PUMP_SLICE;
+
+        if (TryEnterCriticalSection(&Demux->PumpLock)) {
+            Packet = Demux->Pump(this, TimeLeft);
+            LeaveCriticalSection(&Demux->PumpLock);
+            Demux->WakePorts(this);
+            if (Packet != NULL)
+                return Packet;
+        }
+        else
+            WaitForSingleObject(hWakeup, TimeLeft);
+
+        if (TimeOutInMsec != INFINITE && GetTickCount() - StartTime >= TimeOutInMsec)
+            return TakeArrived();
+    }
+}
+
+//=============================================================================
+//    Method: DEMUX_PORT::GetNextReceivedPackets().
+//
+//    Description: Same, plus whatever else has been steered to us already.
+//=============================================================================
+
+UINT32
+DEMUX_PORT::GetNextReceivedPackets(
+    OUT PACKET ** Packets,
+    IN  UINT32    MaxPackets,
+    IN  UINT32    TimeOutInMsec
+    )
+{
+    UINT32 nPackets = 0;
+    PACKET *Packet;
+
+    if (MaxPackets == 0)
+        return 0;
+
+    Packet = GetNextReceivedPacket(TimeOutInMsec);
+    while (Packet != NULL) {
+        Packets[nPackets++] = Packet;
+        if (nPackets == MaxPackets)
+            break;
+        Packet = TakeArrived();
+    }
+    return nPackets;
+}
+
+//=============================================================================
+//    Method: DEMUX_PORT::GetNextCompletedPacket().
+//
+//    Description: Transmit completions are not reported, only receives.
+//=============================================================================
+
+PACKET_MODE
+DEMUX_PORT::GetNextCompletedPacket(
+    OUT PACKET ** pPacket,
+    IN  UINT32    TimeOutInMsec
+    )
+{
+    *pPacket = GetNextReceivedPacket(TimeOutInMsec);
+    return (*pPacket != NULL) ? PacketModeReceiving : PacketModeInvalid;
+}
+
+//=============================================================================
+//    Method: DEMUX_PORT::AllocatePacket().
+//
+//    Description: Transmit packets come from the driver. The receives are
+//                 the demux's, so a receive packet is just a stand-in that
+//                 PostReceivePacket throws away.
+//=============================================================================
+
+PACKET *
+DEMUX_PORT::AllocatePacket(
+    IN BYTE *Buffer,
+    IN UINT Length,
+    IN BOOL bForReceive
+    )
+{
+    PACKET *Packet;
+
+    if (bForReceive) {
+        Packet = new PACKET;
+        if (Packet == NULL)
+            return NULL;
+        Packet->Init(NULL, Length);
+        Packet->DriverState = this;
+        Packet->Mode = PacketModeReceiving;
+        return Packet;
+    }
+
+    EnterCriticalSection(&Demux->DriverLock);
+    Packet = Demux->Driver->AllocatePacket(Buffer, Length, bForReceive);
+    LeaveCriticalSection(&Demux->DriverLock);
+    return Packet;
+}
+
+//=============================================================================
+//    Method: DEMUX_PORT::FreePacket().
+//=============================================================================
+
+void
+DEMUX_PORT::FreePacket(
+    IN PACKET * Packet,
+    IN BOOL bForReceiving
+    )
+{
+    if (Packet->DriverState == this) {
+        delete Packet;
+        return;
+    }
+
+    EnterCriticalSection(&Demux->DriverLock);
+    Demux->Driver->FreePacket(Packet, bForReceiving);
+    LeaveCriticalSection(&Demux->DriverLock);
+}
+
+//=============================================================================
+//    Method: DEMUX_PORT::PostReceivePacket().
+//
+//    Description: Frames we received go back to the NIC, stand-ins go away.
+//=============================================================================
+
+HRESULT
+DEMUX_PORT::PostReceivePacket(
+    IN PACKET * Packet
+    )
+{
+    if (Packet->DriverState == this) {
+        delete Packet;
+        return S_OK;
+    }
+
+    Demux->Repost(Packet);
+    return ERROR_IO_PENDING;
+}
+
+//=============================================================================
+//    Method: DEMUX_PORT::PostReceivePackets().
+//
+//    Description: Same, handing the frames back to the NIC in one go.
+//=============================================================================
+
+HRESULT
+DEMUX_PORT::PostReceivePackets(
+    IN PACKET ** Packets,
+    IN UINT32    nPackets
+    )
+{
+    PACKET *Batch[32];
+    UINT32 nBatch = 0;
+    HRESULT Result = ERROR_IO_PENDING;
+    HRESULT Result1;
+
+    EnterCriticalSection(&Demux->DriverLock);
+    for (UINT32 i = 0; i < nPackets; i++) {
+        if (Packets[i]->DriverState == this) {
+            delete Packets[i];
+            continue;
+        }
+        Packets[i]->Length = Demux->FrameSize;
+        Batch[nBatch++] = Packets[i];
+        if (nBatch == sizeof(Batch) / sizeof(Batch[0])) {
+            Result1 = Demux->Driver->PostReceivePackets(Batch, nBatch);
+            if (Result1 != S_OK && Result1 != ERROR_IO_PENDING)
+                Result = Result1;
+            nBatch = 0;
+        }
+    }
+    if (nBatch != 0) {
+        Result1 = Demux->Driver->PostReceivePackets(Batch, nBatch);
+        if (Result1 != S_OK && Result1 != ERROR_IO_PENDING)
+            Result = Result1;
+    }
+    LeaveCriticalSection(&Demux->DriverLock);
+
+    return Result;
+}
+
+//=============================================================================
+//    Method: DEMUX_PORT::PostTransmitPacket().
+//=============================================================================
+
+HRESULT
+DEMUX_PORT::PostTransmitPacket(
+    IN PACKET * Packet
+    )
+{
+    HRESULT Result;
+
+    EnterCriticalSection(&Demux->DriverLock);
+    Result = Demux->Driver->PostTransmitPacket(Packet);
+    LeaveCriticalSection(&Demux->DriverLock);
+    return Result;
+}
+
+//=============================================================================
+//    Method: DEMUX_PORT::PostTransmitPackets().
+//=============================================================================
+
+HRESULT
+DEMUX_PORT::PostTransmitPackets(
+    IN PACKET ** Packets,
+    IN UINT32    nPackets
+    )
+{
+    HRESULT Result;
+
+    EnterCriticalSection(&Demux->DriverLock);
+    Result = Demux->Driver->PostTransmitPackets(Packets, nPackets);
+    LeaveCriticalSection(&Demux->DriverLock);
+    return Result;
+}
+
+//=============================================================================
+//    Method: DEMUX_PORT::Flush().
+//=============================================================================
+
+BOOL
+DEMUX_PORT::Flush(void)
+{
+    BOOL Result;
+
+    EnterCriticalSection(&Demux->DriverLock);
+    Result = Demux->Driver->Flush();
+    LeaveCriticalSection(&Demux->DriverLock);
+    return Result;
+}
+
+//=============================================================================
+//    Method: DEMUX_PORT::GetMacAddress().
+//=============================================================================
+
+BOOL
+DEMUX_PORT::GetMacAddress(
+    OUT UINT8 *MacAddress
+    )
+{
+    return Demux->Driver->GetMacAddress(MacAddress);
+}
+
+//=============================================================================
+//    Method: DEMUX_PORT::ChangeMacAddress().
+//
+//    Description: The NIC is not ours alone, so its address stays put.
+//=============================================================================
+
+BOOL
+DEMUX_PORT::ChangeMacAddress(
+    IN UINT8 *MacAddress
+    )
+{
+    UINT8 EthernetAddress[6];
+    GetMacAddress(EthernetAddress);
+    return memcmp(EthernetAddress, MacAddress, 6) == 0;
+}
+
+//=============================================================================
+//    Method: DEMUX_PORT::SetFilter().
+//=============================================================================
+
+HRESULT
+DEMUX_PORT::SetFilter(
+    IN UINT32 Filter
+    )
+{
+    HRESULT Result;
+
+    EnterCriticalSection(&Demux->DriverLock);
+    Result = Demux->Driver->SetFilter(Filter);
+    LeaveCriticalSection(&Demux->DriverLock);
+    return Result;
+}
+
+//=============================================================================
+//    Method: DEMUX_PORT::GetMaxOutstanding().
+//
+//    Description: The receives are shared, each port sees all of them.
+//=============================================================================
+
+BOOL
+DEMUX_PORT::GetMaxOutstanding(
+    OUT UINT32 *NumReads,
+    OUT UINT32 *NumWrites
+    )
+{
+    if (!Demux->Driver->GetMaxOutstanding(NumReads, NumWrites))
+        return FALSE;
+    *NumReads = Demux->nReceives;
+    return TRUE;
+}
+
+//=============================================================================
+//    Method: DEMUX_PORT::GetMaxFrameSize().
+//=============================================================================
+
+BOOL
+DEMUX_PORT::GetMaxFrameSize(
+    OUT UINT32 *FrameSize
+    )
+{
+    *FrameSize = Demux->FrameSize;
+    return TRUE;
+}
+
+//=============================================================================
+//    Method: DEMUX_PORT::SetReceiveSpin().
+//
+//    Description: Whoever is the pump spins, so this is for the whole NIC.
+//=============================================================================
+
+BOOL
+DEMUX_PORT::SetReceiveSpin(
+    IN UINT32 Microseconds
+    )
+{
+    BOOL Result;
+
+    EnterCriticalSection(&Demux->DriverLock);
+    Result = Demux->Driver->SetReceiveSpin(Microseconds);
+    LeaveCriticalSection(&Demux->DriverLock);
+    return Result;
+}
+
+//=============================================================================
+//    Function: OpenSharedPacketDriver().
+//
+//    Description: Get a port on the (shared) NIC, for the frames that come
+//                 from FpgaMacAddress. The NIC is opened by the first port.
+//=============================================================================
+
+PACKET_DRIVER *
+OpenSharedPacketDriver(
+    IN const wchar_t *PreferredNicName,
+    IN UINT           PreferredPacketDriverVersion,
+    IN const UINT8   *FpgaMacAddress,
+    IN BOOL           bQuiet
+    )
+{
+    NIC_DEMUX *Demux;
+    DEMUX_PORT *Port;
+
+    if (FpgaMacAddress == NULL)
+        return NULL;
+
+    LockDemuxList();
+
+    for (Demux = DemuxList; Demux != NULL; Demux = Demux->Next)
+        if (Demux->Matches(PreferredNicName, PreferredPacketDriverVersion))
+            break;
+
+    if (Demux == NULL) {
+        PACKET_DRIVER *Driver = OpenPacketDriver(PreferredNicName,
+                                                 PreferredPacketDriverVersion,
+                                                 bQuiet);
+        if (Driver == NULL) {
+            UnlockDemuxList();
+            return NULL;
+        }
+
+        Demux = new NIC_DEMUX(Driver, PreferredNicName, PreferredPacketDriverVersion);
+        if (Demux == NULL) {
+            delete Driver;
+            UnlockDemuxList();
+            return NULL;
+        }
+        if (!Demux->PostReceives()) {
+            delete Demux;
+            UnlockDemuxList();
+            return NULL;
+        }
+        Demux->Next = DemuxList;
+        DemuxList = Demux;
+    }
+
+    Port = new DEMUX_PORT(Demux, FpgaMacAddress);
+    if (Port == NULL || Port->hWakeup == NULL || !Demux->AddPort(Port)) {
+        UnlockDemuxList();
+        //
+        // Not registered, but closes the NIC if nobody else is using it
+        //
+        if (Port != NULL)
+            delete Port;
+        return NULL;
+    }
+
+    UnlockDemuxList();
+    return Port;
 }
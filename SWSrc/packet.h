@@ -34,6 +34,7 @@ typedef ULONG NDIS_OID, *PNDIS_OID;
 
 #define OID_GEN_LINK_SPEED                      0x00010107
 #define OID_GEN_CURRENT_PACKET_FILTER           0x0001010E
+#define OID_GEN_MAXIMUM_TOTAL_SIZE              0x00010111
 
 //
 // 802.3 Objects (Ethernet)
@@ -54,6 +55,13 @@ typedef ULONG NDIS_OID, *PNDIS_OID;
 
 #define  MAX_LINK_NAME_LENGTH   124
 
+//
+// Ethernet frame sizes, header included and FCS excluded.
+// Jumbo frames are only used if the NIC is configured for them.
+//
+#define  MAX_STANDARD_FRAME_SIZE    1514
+#define  MAX_JUMBO_FRAME_SIZE       9014
+
 typedef struct _PACKET_OID_DATA {
 
     ULONG           Oid;
@@ -103,6 +111,23 @@ class PACKET {
         this->Mode = PacketModeInvalid;
         this->Flush = TRUE;
         this->KernelOwned = FALSE;
+        this->Gather = NULL;
+        this->GatherLength = 0;
+    }
+
+    //
+    // Append the gather segment (if any) to the packet's own buffer.
+    // Drivers that cannot transmit from two segments call this when
+    // the packet is posted. A retransmit then finds it already done.
+    //
+    void Flatten(void)
+    {
+        if (this->Gather == NULL)
+            return;
+        memcpy(this->Buffer + this->nBytesAvail, this->Gather, this->GatherLength);
+        this->nBytesAvail += this->GatherLength;
+        this->Gather = NULL;
+        this->GatherLength = 0;
     }
 
     //
@@ -120,6 +145,13 @@ class PACKET {
     UINT8       *Buffer;
     BOOL         Flush;
     BOOL         KernelOwned;
+    //
+    // Transmit only: GatherLength bytes at Gather are sent right after the
+    // nBytesAvail bytes in Buffer. The memory must stay valid until the
+    // packet is freed. Buffer must be large enough to hold both.
+    //
+    UINT8       *Gather;
+    UINT32       GatherLength;
 };
 
 //
@@ -149,12 +181,75 @@ public:
 
     virtual HRESULT PostTransmitPacket(IN PACKET *Packet) = 0;
 
+    //
+    // Post nPackets packets for transmitting in one go. Drivers that can
+    // hand them all over at once (and kick the hardware once) do so, the
+    // others post them one at a time. Either way a packet with Flush set
+    // gets the batch going by the time this returns.
+    // Stops at the first packet that cannot be posted, and returns its result.
+    //
+    virtual HRESULT PostTransmitPackets(IN PACKET **Packets,
+                                        IN UINT32   nPackets)
+    {
+        HRESULT Result = S_OK;
+
+        for (UINT32 i = 0; i < nPackets; i++) {
+            Result = PostTransmitPacket(Packets[i]);
+            if ((Result != S_OK) && (Result != ERROR_IO_PENDING))
+                break;
+        }
+        return Result;
+    }
+
     virtual PACKET_MODE GetNextCompletedPacket(OUT PACKET ** pPacket,
                                                IN  UINT32 TimeOutInMsec
                                                ) = 0;
 
     virtual PACKET *GetNextReceivedPacket(IN  UINT32 TimeOutInMsec) = 0;
 
+    //
+    // Dequeue up to MaxPackets received packets into Packets, waiting up
+    // to TimeOutInMsec for the first one but not for the others.
+    // Returns how many there were, zero on timeout.
+    //
+    virtual UINT32 GetNextReceivedPackets(OUT PACKET **Packets,
+                                          IN  UINT32   MaxPackets,
+                                          IN  UINT32   TimeOutInMsec)
+    {
+        UINT32 nPackets = 0;
+        PACKET *Packet;
+
+        if (MaxPackets == 0)
+            return 0;
+
+        Packet = GetNextReceivedPacket(TimeOutInMsec);
+        while (Packet != NULL) {
+            Packets[nPackets++] = Packet;
+            if (nPackets == MaxPackets)
+                break;
+            Packet = GetNextReceivedPacket(0);
+        }
+        return nPackets;
+    }
+
+    //
+    // Post nPackets packets for receiving in one go.
+    //
+    virtual HRESULT PostReceivePackets(IN PACKET **Packets,
+                                       IN UINT32   nPackets)
+    {
+        HRESULT Result = S_OK;
+        HRESULT Result1;
+
+        //Post them all regardless, but report the first one that did not go
+        for (UINT32 i = 0; i < nPackets; i++) {
+            Result1 = PostReceivePacket(Packets[i]);
+            if (Result1 != S_OK && Result1 != ERROR_IO_PENDING && Result == S_OK)
+                Result = Result1;
+        }
+        return Result;
+    }
+
     virtual BOOL GetMacAddress( OUT UINT8 *MacAddress) = 0;
 
     virtual BOOL ChangeMacAddress( IN UINT8 *MacAddress) = 0;
@@ -164,11 +259,39 @@ public:
     virtual BOOL GetMaxOutstanding(OUT UINT32 *NumReads,
                                    OUT UINT32 *NumWrites) = 0;
 
+    virtual BOOL GetMaxFrameSize(OUT UINT32 *FrameSize) = 0;
+
+    //
+    // Low-latency receive: when nothing is there, GetNextReceivedPacket
+    // polls the receive queue for up to this many microseconds before it
+    // goes to sleep. Zero (the default) sleeps right away.
+    // Returns FALSE if the driver cannot do that.
+    //
+    virtual BOOL SetReceiveSpin(IN UINT32 Microseconds)
+    {
+        return FALSE;
+    }
+
 };
 
+//
+// NIC name for the in-process stand-in: two drivers opened on it are the
+// two ends of one wire, see LOOPBACK_DRIVER in packet.cpp.
+//
+#define LOOPBACK_NIC_NAME L"loopback"
+
 // Contructor function
 extern PACKET_DRIVER * OpenPacketDriver(const wchar_t *PreferredNicName,
                                         UINT PreferredPacketDriverVersion,
                                         BOOL bQuiet);
 
+//
+// Same, but the NIC can be shared with others. The driver we get back only
+// receives the frames that come from FpgaMacAddress.
+//
+extern PACKET_DRIVER * OpenSharedPacketDriver(const wchar_t *PreferredNicName,
+                                              UINT PreferredPacketDriverVersion,
+                                              const UINT8 *FpgaMacAddress,
+                                              BOOL bQuiet);
+
 #endif
@@ -32,6 +32,9 @@
 //Memory offset of parameter register file
 #define PARAMETER_REG_OFFSET 0xF0000000
 
+//Longest number of milliseconds waitDone sleeps between reads of the run register
+#define MAXDONEPOLLINTERVAL 100
+
 //This is a hack - we should limit the size of the buffer in a smarter way
 //For now, I'm making it 128MB
 //BUGBUG This needs some serious rethinking.
@@ -567,6 +570,7 @@ BOOL PCIE2_SIRC::waitDone(uint32_t maxWaitTimeInMsec)
 
 	uint32_t currTime = GetTickCount();
 	uint32_t endTime = currTime + maxWaitTimeInMsec;
+	uint32_t pollInterval = 0;
 
 	setLastError( 0);
 
@@ -577,6 +581,13 @@ BOOL PCIE2_SIRC::waitDone(uint32_t maxWaitTimeInMsec)
 			return true;
 		}
 		currTime = GetTickCount();
+
+		//Back off exponentially rather than hammering the register, but never sleep past the deadline
+		if(endTime > currTime){
+			Sleep(min(pollInterval, endTime - currTime));
+			pollInterval = (pollInterval) ? min(2 * pollInterval, (uint32_t)MAXDONEPOLLINTERVAL) : 1;
+			currTime = GetTickCount();
+		}
     } while(endTime > currTime);
 
     setLastError( FAILDONE);
@@ -33,6 +33,9 @@
 //Memory offset of parameter register file
 #define PARAMETER_REG_OFFSET 0xF0000000
 
+//Longest number of milliseconds waitDone sleeps between reads of the run register
+#define MAXDONEPOLLINTERVAL 100
+
 //Define which Pico channel we will be using
 #define CHANNEL_NO 10
 
@@ -190,6 +193,7 @@ BOOL PICO_SIRC::waitDone(uint32_t maxWaitTimeInMsec)
 
 	uint32_t currTime = GetTickCount();
 	uint32_t endTime = currTime + maxWaitTimeInMsec;
+	uint32_t pollInterval = 0;
 
 	setLastError( 0);
 
@@ -201,6 +205,13 @@ BOOL PICO_SIRC::waitDone(uint32_t maxWaitTimeInMsec)
 			return true;
 		}
 		currTime = GetTickCount();
+
+		//Back off exponentially rather than hammering the register, but never sleep past the deadline
+		if(endTime > currTime){
+			Sleep(min(pollInterval, endTime - currTime));
+			pollInterval = (pollInterval) ? min(2 * pollInterval, (uint32_t)MAXDONEPOLLINTERVAL) : 1;
+			currTime = GetTickCount();
+		}
     } while(endTime > currTime);
 
     setLastError( FAILDONE);
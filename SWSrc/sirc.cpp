@@ -46,4 +46,98 @@ SIRC_DLL_LINKAGE SIRC * __stdcall openSirc(uint8_t *FPGA_ID, uint32_t driverVers
     return NULL;
 }
 
+//Read into a temporary buffer and hand it over in one piece.
+//For the interfaces that cannot do any better.
+BOOL SIRC::sendReadToSink(uint32_t startAddress, uint32_t length, READ_SINK sink, void *context)
+{
+    if (!sink) {
+        setLastError(INVALIDBUFFER);
+        return false;
+    }
+
+    uint8_t *buffer = (uint8_t *) malloc(length ? length : 1);
+    if (!buffer) {
+        setLastError(FAILMEMALLOC);
+        return false;
+    }
+
+    BOOL ok = sendRead(startAddress, length, buffer);
+    if (ok)
+        sink(context, 0, buffer, length);
+
+    free(buffer);
+    return ok;
+}
+
+//Write the registers one at a time.
+//For the interfaces that cannot do any better.
+BOOL SIRC::sendParamRegisterWriteBatch(uint32_t count, const uint8_t *regNumbers, const uint32_t *values)
+{
+    if (!regNumbers || !values) {
+        setLastError(INVALIDBUFFER);
+        return false;
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        if (!sendParamRegisterWrite(regNumbers[i], values[i]))
+            return false;
+    }
+
+    setLastError(0);
+    return true;
+}
+
+//Read the registers one at a time.
+//For the interfaces that cannot do any better.
+BOOL SIRC::sendParamRegisterReadBatch(uint32_t count, const uint8_t *regNumbers, uint32_t *values)
+{
+    if (!regNumbers || !values) {
+        setLastError(INVALIDBUFFER);
+        return false;
+    }
 
+    for (uint32_t i = 0; i < count; i++) {
+        if (!sendParamRegisterRead(regNumbers[i], &values[i]))
+            return false;
+    }
+
+    setLastError(0);
+    return true;
+}
+
+//Go through the steps of the job one call at a time.
+//For the interfaces that cannot do any better.
+BOOL SIRC::submitJob(const JOB *job)
+{
+    uint32_t i;
+
+    if (!job ||
+        (job->numInputs && !job->inputs) ||
+        (job->numOutputs && !job->outputs)) {
+        setLastError(INVALIDBUFFER);
+        return false;
+    }
+
+    for (i = 0; i < job->numInputs; i++) {
+        if (!sendWrite(job->inputs[i].startAddress, job->inputs[i].length, job->inputs[i].buffer))
+            return false;
+    }
+
+    if (job->numRegisters &&
+        !sendParamRegisterWriteBatch(job->numRegisters, job->regNumbers, job->regValues))
+        return false;
+
+    if (!sendRun())
+        return false;
+
+    if (!waitDone(job->maxWaitTimeInMsec))
+        return false;
+
+    for (i = 0; i < job->numOutputs; i++) {
+        if (!sendRead(job->outputs[i].startAddress, job->outputs[i].length, job->outputs[i].buffer))
+            return false;
+    }
+
+    setLastError(0);
+    return true;
+}
@@ -145,6 +145,73 @@ public:
     //Modify the active set of parameters and limits for this instance
     virtual BOOL __stdcall setParameters(const SIRC::PARAMETERS *inParameters, uint32_t length) = 0;
 
+    //Consumer for sendReadToSink, called with each piece of read data as it comes in
+    // context: as given to sendReadToSink
+    // offset: where this piece goes, relative to the startAddress of the read
+    // data: the piece itself, only valid for the duration of the call
+    // length: # of bytes in this piece
+    typedef void (__stdcall *READ_SINK)(void *context, uint32_t offset, const uint8_t *data, uint32_t length);
+
+	//Read a block of data from the output buffer of the FPGA, handing it to sink as it comes in
+	// rather than collecting it into a buffer first.
+	// startAddress: local address on FPGA output buffer to begin reading from
+	// length: # of bytes to read
+	// sink, context: see above. Pieces can come in any order, and after a
+	//  retransmit a piece might be handed over again.
+	//Interfaces that cannot do any better read into a temporary buffer and hand that over.
+	//Returns true if read is successful.
+	//If read fails for any reason, returns false.
+	// Check error code with getLastError().
+	virtual BOOL __stdcall sendReadToSink(uint32_t startAddress, uint32_t length, READ_SINK sink, void *context);
+
+	//Send several 32-bit values from the PC to the parameter register file on the FPGA
+	// count: # of registers to write
+	// regNumbers: registers to which values should be sent (each between 0 and 254)
+	// values: values to be written, values[i] goes to register regNumbers[i]
+	//Interfaces that cannot do any better write the registers one at a time.
+	//Returns true if all writes are successful.
+	//If any write fails for any reason, returns false.
+	// Check error code with getLastError()
+	virtual BOOL __stdcall sendParamRegisterWriteBatch(uint32_t count, const uint8_t *regNumbers, const uint32_t *values);
+
+	//Read several 32-bit values from the parameter register file on the FPGA back to the PC
+	// count: # of registers to read
+	// regNumbers: registers which should be read (each between 0 and 254)
+	// values: values received from FPGA, values[i] comes from register regNumbers[i]
+	//Interfaces that cannot do any better read the registers one at a time.
+	//Returns true if all reads are successful.
+	//If any read fails for any reason, returns false.
+	// Check error code with getLastError().
+	virtual BOOL __stdcall sendParamRegisterReadBatch(uint32_t count, const uint8_t *regNumbers, uint32_t *values);
+
+    //One block of an input or output buffer on the FPGA
+    typedef struct {
+        uint32_t startAddress;              //Local address on the FPGA buffer
+        uint32_t length;                    //# of bytes
+        uint8_t *buffer;                    //Data to be sent, or room for the data read back
+    } JOB_SEGMENT;
+
+    //Everything needed to run the FPGA once, in the order it happens
+    typedef struct {
+        uint32_t numInputs;                 //Input buffer blocks to write..
+        const JOB_SEGMENT *inputs;
+        uint32_t numRegisters;              //..parameter registers to write (each between 0 and 254)..
+        const uint8_t *regNumbers;
+        const uint32_t *regValues;
+        uint32_t maxWaitTimeInMsec;         //..how long to wait for execution after the run..
+        uint32_t numOutputs;                //..and output buffer blocks to read back when it is done
+        const JOB_SEGMENT *outputs;
+    } JOB;
+
+	//Write the inputs and parameter registers of a job, raise the execution signal, wait for
+	// the execution signal to be lowered, then read back the outputs.
+	// job: see above.  Any of the lists can be empty.
+	//Interfaces that cannot do any better go through the steps one call at a time.
+	//Returns true if entire process is successful.
+	//If function fails for any reason, returns false.
+	// Check error code with getLastError().
+	virtual BOOL __stdcall submitJob(const JOB *job);
+
 	//Retrieve the last error code.  Any value < 0 indicates a problem.
 	// A value === 0 indicates no error.
 	// See function prototype description above for further explanation.
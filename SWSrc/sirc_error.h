@@ -150,6 +150,10 @@
 //The sendSystemACERegisterWrite was not acknowledged
 #define FAILSYSACEWRITEACK -30
 
+//Valid for waitAsync (ETH_SIRC only)
+//The asynchronous request has not completed yet.  The handle is still valid, wait on it again.
+#define FAILASYNCPENDING -31
+
 //******These error codes should not be returned.  If they do, something is wrong in the API code.
 //		Please send me mail with details regarding the conditions under which this occurred.
 #define FAILVMNSCOMPLETION -100
@@ -165,6 +169,9 @@
 #define INVALIDWRITEANDRUNTRANSMIT -110
 #define INVALIDWRITEANDRUNRECIEVE -111
 #define INVALIDERRORTRANSMIT -112
+#define INVALIDFRAMESIZETRANSMIT -113
+#define INVALIDDONETRANSMIT -114
+#define INVALIDTRANSACTIONIDTRANSMIT -115
 
 //******These error codes we expect to be returned from the SIRC server to a client, in an error reply packet.
 //		These occur if the client presents invalid data, if the user's machine is not configured correctly,
@@ -193,6 +200,10 @@
 #define RECEIVE_ERROR_SA_REG_READ_RUNNING 19		// This error occurs when we get a SystemACE reg read command, but the user application is still running
 #define RECEIVE_ERROR_SA_REG_READ_ADDRESS 20		// This error occurs when we get a SystemACE reg read command, but the address is not [0-47]
 #define RECEIVE_ERROR_RESET_LENGTH 21				// This error occurs when we get a soft reset command, but it's not the correct length packet
+#define RECEIVE_ERROR_FRAME_SIZE_LENGTH 22			// This error occurs when we get a frame size command, but it's not the correct length packet
+#define RECEIVE_ERROR_REG32_WRITE_BATCH_LENGTH 23	// This error occurs when we get a reg32 batch write command, but it's not the correct length packet
+#define RECEIVE_ERROR_REG32_READ_BATCH_LENGTH 24	// This error occurs when we get a reg32 batch read command, but it's not the correct length packet
+#define RECEIVE_ERROR_TRANSACTION_LENGTH 25			// This error occurs when we get a transaction ID command, but it's not the correct length packet
 
 #endif //DEFINESIRCERRORH
 
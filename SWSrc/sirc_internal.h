@@ -12,6 +12,7 @@
 #include <assert.h>
 #include <list>
 #include <vector>
+#include <new>
 #include <time.h>
 #include <direct.h>
 
@@ -49,24 +49,32 @@
 //This number should be larger than NUMOUTSTANDINGREADS
 #define NUMOUTSTANDINGWRITES 250
 
+//This is the number of read responses we hand to the NIC driver in one go.
+//Bigger batches cost fewer calls into the driver, but hold on to more transmit packets
+// before any of them goes out.
+#define READRESPONSEBATCH 32
+
 //******
 //******Other (internal) constants.
 //******
 
 //******These are constants that should only be changed if the network protocol changes
-//(ie we want to support jumbo frames and have updated the hardware-side API controller
-//to accomodate that. Recompilation will be required, or new APIs in PacketDriver.
-//This is the maximum packet size (entire packet including header)
-#define MAXPACKETSIZE 1514
+//This is the maximum packet size (entire packet including header) that every host supports.
+//A host can ask for jumbo frames (the 'n' command), after a reset we are back to this.
+#define MAXPACKETSIZE MAX_STANDARD_FRAME_SIZE
 
-//This is the maximum packet payload size (entire packet minus header)
-//Should be between 10 and 1500 for normal packets
-#define MAXPACKETDATASIZE (MAXPACKETSIZE-14)
+//This is the maximum packet payload size (entire packet minus header) for a given frame size
+//Should be between 10 and 1500 for normal packets, up to 9000 for jumbo frames
+#define MAXPACKETDATASIZE(_frame_) ((_frame_)-14)
 
 //This should be the maximum packet data size minus 9 for the write command, start address and length
-#define MAXWRITESIZE (MAXPACKETDATASIZE - 9)
+#define MAXWRITESIZE(_frame_) (MAXPACKETDATASIZE(_frame_) - 9)
 //This should be the maximum packet data size minus 5 for the read command and start address
-#define MAXREADSIZE (MAXPACKETDATASIZE - 5)
+#define MAXREADSIZE(_frame_) (MAXPACKETDATASIZE(_frame_) - 5)
+
+//A command can come in a transaction ID envelope: 'T' + 2 byte ID, followed by the command
+// itself.  We send the responses to it back in the same envelope.
+#define TAGLENGTH 3
 
 
 #ifdef DEBUG
@@ -113,6 +121,11 @@ SIRC_DLL_LINKAGE SRV_SIRC::SRV_SIRC(uint32_t **registerFile, uint8_t **inputBuff
     if (maxOutstandingWrites == 0)
         maxOutstandingWrites = NUMOUTSTANDINGWRITES;
 
+    //See how big a frame the NIC can take.
+    //We use standard frames until a host asks for something larger.
+    if (!PacketDriver->GetMaxFrameSize(&nicFrameSize))
+        nicFrameSize = MAXPACKETSIZE;
+
     maxInputDataBytes  = MAXINPUTDATABYTEADDRESS;
     maxOutputDataBytes = MAXOUTPUTDATABYTEADDRESS;
 
@@ -134,6 +147,9 @@ SIRC_DLL_LINKAGE SRV_SIRC::SRV_SIRC(uint32_t **registerFile, uint8_t **inputBuff
 	outputBufP = *outputBuffer;
 
 	memset(WriteAndRunHostMACAddress,0,6);
+	memset(RunHostMACAddress,0,6);
+	notifyDone = false;
+	replyTagLength = 0;
 
 	//Queue up a bunch of receives
 	//We want to keep this full, so every time we read
@@ -218,6 +234,11 @@ BOOL SRV_SIRC::setParameters(const SIRC_SERVER::PARAMETERS *inParameters, uint32
     return true;
 }
 
+//The MAC address hosts talk to us at
+void SRV_SIRC::getMACAddress(uint8_t *MACAddress){
+	memcpy(MACAddress, My_MACAddress, 6);
+}
+
 
 //Process all incoming commands until the execute command is received
 BOOL SRV_SIRC::processCommands(bool *writeAndExecute){
@@ -271,13 +292,43 @@ BOOL SRV_SIRC::processCommands(bool *writeAndExecute){
 }
 
 //Read the addresses from 0 to length back to the host
+//Lower the execution signal.
+//If the run was started with a register write, push a done notification to that host.
+//A write & run does not need one, the readbacks tell the host we are done.
+void SRV_SIRC::resetRunRegister(){
+	regFileP[255] = 0;
+
+	if(notifyDone){
+		notifyDone = false;
+		(void) sendDoneNotification();
+	}
+}
+
+//Send an unsolicited done notification to the host that started the run.
+//It is only a hint, the host still reads the run register to make sure.
+BOOL SRV_SIRC::sendDoneNotification(void){
+
+	//The packet will be 1 byte long
+	if (!allocateAndFillPacket(RunHostMACAddress, 1))
+        return false;
+
+	currentBuffer[0] = 'd';
+
+	if(addTransmit(currentPacket))
+        return true;
+    PRINTF(("Done notification not sent!\n"));
+    setLastError(INVALIDDONETRANSMIT);
+    return false;
+}
+
 BOOL SRV_SIRC::sendReadBacks(uint32_t length){
 	uint32_t startAddress = 0;
 	uint32_t currLength;
+	uint32_t maxLength = MAXREADSIZE(frameSizeFor(WriteAndRunHostMACAddress)) - 4;
 
 	while(length > 0){
-		if(length > MAXREADSIZE - 4){
-			currLength = MAXREADSIZE - 4;
+		if(length > maxLength){
+			currLength = maxLength;
 		}
 		else{
 			currLength = length;
@@ -299,10 +350,11 @@ BOOL SRV_SIRC::sendReadBacks(uint32_t length){
 //Return true on success, return false w/error code on failure
 inline BOOL SRV_SIRC::addReceive(PACKET *Packet){
     
+    //Receives are always sized for the largest frame the NIC can take
     if (Packet)
-        Packet->Length = MAXPACKETSIZE;//recycle
+        Packet->Length = nicFrameSize;//recycle
     else
-        Packet = PacketDriver->AllocatePacket(NULL,MAXPACKETSIZE,true);
+        Packet = PacketDriver->AllocatePacket(NULL,nicFrameSize,true);
 
 	if(!Packet){
 		setLastError(FAILMEMALLOC);
@@ -356,6 +408,16 @@ BOOL SRV_SIRC::processPacket(PACKET* Packet, bool *execute, bool *writeAndExecut
 				return false;
 			}
 			break;
+		case 'Y':
+			if(!checkRegReadBatchPacket(message)){
+				return false;
+			}
+			break;
+		case 'K':
+			if(!checkRegWriteBatchPacket(message, execute)){
+				return false;
+			}
+			break;
 		case 'g':
 			if(!checkWriteAndRunPacket(message, execute, writeAndExecute)){
 				return false;
@@ -366,6 +428,21 @@ BOOL SRV_SIRC::processPacket(PACKET* Packet, bool *execute, bool *writeAndExecut
 				return false;
 			}
 			break;
+		case 'n':
+			if(!checkFrameSizePacket(message)){
+				return false;
+			}
+			break;
+		case 't':
+			if(!checkTransactionIdPacket(message)){
+				return false;
+			}
+			break;
+		case 'T':
+			if(!checkTaggedPacket(Packet, execute, writeAndExecute)){
+				return false;
+			}
+			break;
 		default:
 			//if(!sendErrorMessage(RECEIVE_ERROR_COMMAND, message)){
 				//return false;
@@ -394,8 +471,10 @@ BOOL SRV_SIRC::sendErrorMessage(int8_t errorNumber, uint8_t *sourceMessage){
 }
 
 BOOL SRV_SIRC::allocateAndFillPacket(uint8_t *sourceMAC, uint16_t length){
+	uint32_t frameSize = frameSizeFor(sourceMAC);
+
 	//Get a packet to put this message in.
-	currentPacket = PacketDriver->AllocatePacket(NULL,MAXPACKETSIZE,false);
+	currentPacket = PacketDriver->AllocatePacket(NULL,frameSize,false);
 	if(!currentPacket){
 		setLastError(FAILMEMALLOC);
 		return false;
@@ -406,7 +485,14 @@ BOOL SRV_SIRC::allocateAndFillPacket(uint8_t *sourceMAC, uint16_t length){
 	//Get the beginning of the packet payload (header is 14 bytes)
 	currentBuffer = &(currentPacket->Buffer[14]);
 
-	assert(length <= MAXPACKETDATASIZE);
+	//Responses to a command with a transaction ID go back in the same envelope
+	if(replyTagLength){
+		memcpy(currentBuffer, replyTag, replyTagLength);
+		currentBuffer += replyTagLength;
+		length += replyTagLength;
+	}
+
+	assert(length <= MAXPACKETDATASIZE(frameSize));
 
 	//The length of the frame will be the length of the payload plus 6 + 6 + 2 (dest MAC,
 	//  source MAC, and payload length)
@@ -446,6 +532,25 @@ inline BOOL SRV_SIRC::addTransmit(PACKET* Packet){
 	return true;
 }
 
+//Same as addTransmit, for several packets at once.
+inline BOOL SRV_SIRC::addTransmits(PACKET** Packets, uint32_t count){
+	HRESULT Result;
+
+	if(count == 0)
+		return true;
+
+	BIGDEBUG_ONLY(for(uint32_t i = 0; i < count; i++)
+		printf("***********Transmitting packet @ %p  [%p]\n", Packets[i], Packets[i]->Buffer));
+
+    Result = PacketDriver->PostTransmitPackets(Packets, count);
+
+	if(Result != S_OK && Result != ERROR_IO_PENDING){
+		PRINTF(("Bad transmission packet!\n"));
+		return false;
+	}
+	return true;
+}
+
 BOOL SRV_SIRC::checkResetPacket(uint8_t *sourceMessage){
 	assert(sourceMessage != NULL);
 
@@ -454,6 +559,10 @@ BOOL SRV_SIRC::checkResetPacket(uint8_t *sourceMessage){
 	length = sourceMessage[12] * 256 + sourceMessage[13];
 	//Is this reset command the right length?
 	if(length == 1){
+        //A reset puts this host back to standard frames, it will ask again if it wants more.
+        //Do this first, the host might not be able to take the ack otherwise.
+        setFrameSizeFor(sourceMessage + 6, MAXPACKETSIZE);
+
         //Send the appropriate read values back
         return sendResetAck(sourceMessage);
     }
@@ -477,6 +586,143 @@ BOOL SRV_SIRC::sendResetAck(uint8_t *sourceMessage){
     return false;
 }
 
+BOOL SRV_SIRC::checkFrameSizePacket(uint8_t *sourceMessage){
+	assert(sourceMessage != NULL);
+
+	uint16_t length;
+
+	length = sourceMessage[12] * 256 + sourceMessage[13];
+	//Is this frame size command the right length?
+	if(length == 5){
+        //Settle on a frame size and send it back
+        return sendFrameSizeAck(sourceMessage);
+    }
+
+    return sendErrorMessage(RECEIVE_ERROR_FRAME_SIZE_LENGTH, sourceMessage);
+}
+
+BOOL SRV_SIRC::sendFrameSizeAck(uint8_t *sourceMessage){
+
+	uint32_t frameSize = ((uint32_t) sourceMessage[15] << 24) + ((uint32_t) sourceMessage[16] << 16)+
+		((uint32_t) sourceMessage[17] << 8) + ((uint32_t) sourceMessage[18]);
+
+	//The host tells us the largest frame it can take, we use no more than what our NIC can take.
+	//This only applies to the host that asked.
+	if(frameSize > nicFrameSize)
+		frameSize = nicFrameSize;
+	if(frameSize < MAXPACKETSIZE)
+		frameSize = MAXPACKETSIZE;
+
+	//The packet will be 5 bytes long.
+	//Send it before switching over, so the ack itself is always a standard frame.
+	if (!allocateAndFillPacket(sourceMessage + 6, 5))
+        return false;
+
+	currentBuffer[0] = 'n';
+#if defined(_MSC_VER) //other compilers might not
+    *(uint32_t*)(currentBuffer+1) = _byteswap_ulong(frameSize);
+#else
+	currentBuffer[1] = (frameSize >> 24) % 256;
+	currentBuffer[2] = (frameSize >> 16) % 256;
+	currentBuffer[3] = (frameSize >> 8) % 256;
+	currentBuffer[4] = (frameSize) % 256;
+#endif
+
+	if(!addTransmit(currentPacket)){
+        PRINTF(("Frame size Ack not sent!\n"));
+        setLastError(INVALIDFRAMESIZETRANSMIT);
+        return false;
+    }
+
+	setFrameSizeFor(sourceMessage + 6, frameSize);
+	PRINTF(("Using %u byte frames with %02x:%02x:%02x:%02x:%02x:%02x\n", frameSize,
+			sourceMessage[6], sourceMessage[7], sourceMessage[8],
+			sourceMessage[9], sourceMessage[10], sourceMessage[11]));
+    return true;
+}
+
+//Frame size we agreed on with this host, standard frames unless it asked for more
+uint32_t SRV_SIRC::frameSizeFor(const uint8_t *hostMAC){
+	for(uint32_t i = 0; i < hostFrameSizes.size(); i++){
+		if(memcmp(hostFrameSizes[i].MACAddress, hostMAC, 6) == 0)
+			return hostFrameSizes[i].frameSize;
+	}
+	return MAXPACKETSIZE;
+}
+
+//Remember the frame size for this host.  Hosts on standard frames are not kept.
+void SRV_SIRC::setFrameSizeFor(const uint8_t *hostMAC, uint32_t frameSize){
+	HOST_FRAME_SIZE host;
+
+	for(uint32_t i = 0; i < hostFrameSizes.size(); i++){
+		if(memcmp(hostFrameSizes[i].MACAddress, hostMAC, 6) != 0)
+			continue;
+		if(frameSize == MAXPACKETSIZE)
+			hostFrameSizes.erase(hostFrameSizes.begin() + i);
+		else
+			hostFrameSizes[i].frameSize = frameSize;
+		return;
+	}
+
+	if(frameSize == MAXPACKETSIZE)
+		return;
+	memcpy(host.MACAddress, hostMAC, 6);
+	host.frameSize = frameSize;
+	hostFrameSizes.push_back(host);
+}
+
+BOOL SRV_SIRC::checkTransactionIdPacket(uint8_t *sourceMessage){
+	assert(sourceMessage != NULL);
+
+	uint16_t length;
+
+	length = sourceMessage[12] * 256 + sourceMessage[13];
+	//Is this transaction ID command the right length?
+	if(length != 1){
+		return sendErrorMessage(RECEIVE_ERROR_TRANSACTION_LENGTH, sourceMessage);
+	}
+
+	//The host wants to know if we understand transaction IDs, we do.
+	//The packet will be 1 byte long
+	if (!allocateAndFillPacket(sourceMessage + 6, 1))
+        return false;
+
+	currentBuffer[0] = 't';
+
+	if(addTransmit(currentPacket))
+        return true;
+    PRINTF(("Transaction ID Ack not sent!\n"));
+    setLastError(INVALIDTRANSACTIONIDTRANSMIT);
+    return false;
+}
+
+//Take the command out of its transaction ID envelope and handle it like any other,
+// remembering the envelope for the responses.
+BOOL SRV_SIRC::checkTaggedPacket(PACKET* Packet, bool *execute, bool *writeAndExecute){
+	uint8_t *message = Packet->Buffer;
+	uint16_t length;
+	BOOL result;
+
+	length = message[12] * 256 + message[13];
+	//There has to be a command in there, and just the one envelope
+	if(length <= TAGLENGTH || message[14 + TAGLENGTH] == 'T'){
+		return sendErrorMessage(RECEIVE_ERROR_TRANSACTION_LENGTH, message);
+	}
+
+	memcpy(replyTag, message + 14, TAGLENGTH);
+
+	//Unwrap it in place, the receive packet gets recycled anyways
+	length -= TAGLENGTH;
+	memmove(message + 14, message + 14 + TAGLENGTH, length);
+	message[12] = length >> 8;
+	message[13] = length % 256;
+
+	replyTagLength = TAGLENGTH;
+	result = processPacket(Packet, execute, writeAndExecute);
+	replyTagLength = 0;
+	return result;
+}
+
 BOOL SRV_SIRC::checkRegWritePacket(uint8_t *sourceMessage, bool *execute){
 	assert(sourceMessage != NULL);
 
@@ -492,6 +738,19 @@ BOOL SRV_SIRC::checkRegWritePacket(uint8_t *sourceMessage, bool *execute){
     return sendErrorMessage(RECEIVE_ERROR_REG32_WRITE_LENGTH, sourceMessage);
 }
 
+//Write one parameter register.  Writing a 1 to register 255 starts execution.
+inline void SRV_SIRC::writeRegister(uint8_t regAddress, uint32_t value, uint8_t *hostMAC, bool *execute){
+	regFileP[regAddress] = value;
+
+	if(regAddress == 255 && value == 1){
+		*execute = true;
+
+		//Let this host know when we are done, so it does not have to keep asking
+		memcpy(RunHostMACAddress, hostMAC, 6);
+		notifyDone = true;
+	}
+}
+
 BOOL SRV_SIRC::sendRegWriteAck(uint8_t *sourceMessage, bool *execute){
 
 	uint8_t regAddress = sourceMessage[15];
@@ -499,11 +758,7 @@ BOOL SRV_SIRC::sendRegWriteAck(uint8_t *sourceMessage, bool *execute){
 	uint32_t value = ((uint32_t) sourceMessage[16] << 24) + ((uint32_t) sourceMessage[17] << 16)+
 		((uint32_t) sourceMessage[18] << 8) + ((uint32_t) sourceMessage[19]);
 		
-	regFileP[regAddress] = value;
-
-	if(regAddress == 255 && value == 1){
-		*execute = true;
-	}
+	writeRegister(regAddress, value, sourceMessage + 6, execute);
 
 	//The packet will be 6 bytes long
 	if (!allocateAndFillPacket(sourceMessage + 6, 6))
@@ -518,6 +773,79 @@ BOOL SRV_SIRC::sendRegWriteAck(uint8_t *sourceMessage, bool *execute){
     return false;
 }
 
+//Batch register write: 'K', count, then count (address, value) pairs.
+//The ack is an echo of the whole command.
+BOOL SRV_SIRC::checkRegWriteBatchPacket(uint8_t *sourceMessage, bool *execute){
+	assert(sourceMessage != NULL);
+
+	uint16_t length;
+	uint32_t count;
+
+	length = sourceMessage[12] * 256 + sourceMessage[13];
+	count = (length > 1) ? sourceMessage[15] : 0;
+	//Is this batch write command the right length?
+	if(count == 0 || length != 2 + 5 * count){
+		return sendErrorMessage(RECEIVE_ERROR_REG32_WRITE_BATCH_LENGTH, sourceMessage);
+	}
+
+	//Perform the writes
+	for(uint32_t i = 0; i < count; i++){
+		uint8_t *pair = sourceMessage + 16 + 5 * i;
+		uint32_t value = ((uint32_t) pair[1] << 24) + ((uint32_t) pair[2] << 16)+
+			((uint32_t) pair[3] << 8) + ((uint32_t) pair[4]);
+
+		writeRegister(pair[0], value, sourceMessage + 6, execute);
+	}
+
+	if (!allocateAndFillPacket(sourceMessage + 6, length))
+        return false;
+
+	memcpy(currentBuffer, &(sourceMessage[14]), length);
+
+	if(addTransmit(currentPacket))
+        return true;
+    PRINTF(("Batch Write Ack not sent!\n"));
+    setLastError(INVALIDPARAMWRITETRANSMIT);
+    return false;
+}
+
+//Batch register read: 'Y', count, then count addresses.
+//The response repeats the command, followed by the count values.
+BOOL SRV_SIRC::checkRegReadBatchPacket(uint8_t *sourceMessage){
+	assert(sourceMessage != NULL);
+
+	uint16_t length;
+	uint32_t count;
+
+	length = sourceMessage[12] * 256 + sourceMessage[13];
+	count = (length > 1) ? sourceMessage[15] : 0;
+	//Is this batch read command the right length?
+	if(count == 0 || length != 2 + count){
+		return sendErrorMessage(RECEIVE_ERROR_REG32_READ_BATCH_LENGTH, sourceMessage);
+	}
+
+	if (!allocateAndFillPacket(sourceMessage + 6, 2 + 5 * count))
+        return false;
+
+	memcpy(currentBuffer, &(sourceMessage[14]), length);
+
+	for(uint32_t i = 0; i < count; i++){
+		uint8_t *valueP = currentBuffer + length + 4 * i;
+		uint32_t regValue = regFileP[sourceMessage[16 + i]];
+
+		valueP[0] = (regValue >> 24) % 256;
+		valueP[1] = (regValue >> 16) % 256;
+		valueP[2] = (regValue >> 8) % 256;
+		valueP[3] = (regValue) % 256;
+	}
+
+	if(addTransmit(currentPacket))
+        return true;
+    PRINTF(("Batch Read Ack not sent!\n"));
+    setLastError(INVALIDPARAMREADTRANSMIT);
+    return false;
+}
+
 BOOL SRV_SIRC::checkWritePacket(uint8_t *sourceMessage){
 	assert(sourceMessage != NULL);
 
@@ -684,18 +1012,35 @@ BOOL SRV_SIRC::checkReadPacket(uint8_t *sourceMessage){
 
 BOOL SRV_SIRC::sendReadAcks(uint8_t *sourceMessage, uint32_t startAddress, uint32_t readLength){
 	uint32_t currLength;
+	PACKET *batch[READRESPONSEBATCH];
+	uint32_t batchCount = 0;
+
+	uint32_t maxLength = MAXREADSIZE(frameSizeFor(sourceMessage + 6)) - replyTagLength;
 
 	while(readLength > 0){
-		if(readLength > MAXREADSIZE){
-			currLength = MAXREADSIZE;
+		if(readLength > maxLength){
+			currLength = maxLength;
 		}
 		else{
 			currLength = readLength;
 		}	
 	
-		if(!createReadPacketAndTransmit(sourceMessage, startAddress, currLength)){
+		if(!createReadPacket(sourceMessage, startAddress, currLength)){
+			//What we have so far is good, send it anyways
+			(void) addTransmits(batch, batchCount);
 			return false;
 		}
+
+		//The responses go out READRESPONSEBATCH at a time
+		batch[batchCount++] = currentPacket;
+		if(batchCount == READRESPONSEBATCH || currLength == readLength){
+			if(!addTransmits(batch, batchCount)){
+				PRINTF(("Read Ack not sent!\n"));
+				setLastError(INVALIDREADTRANSMIT);
+				return false;
+			}
+			batchCount = 0;
+		}
 	
 		startAddress += currLength;
 		readLength -= currLength;
@@ -703,7 +1048,8 @@ BOOL SRV_SIRC::sendReadAcks(uint8_t *sourceMessage, uint32_t startAddress, uint3
 	return true;
 }
 
-BOOL SRV_SIRC::createReadPacketAndTransmit(uint8_t *sourceMessage, uint32_t startAddress, uint32_t readLength){
+//Build a read response in currentPacket, for the caller to transmit.
+BOOL SRV_SIRC::createReadPacket(uint8_t *sourceMessage, uint32_t startAddress, uint32_t readLength){
 
 	//The packet will be readLength + 5 bytes long
 	if (!allocateAndFillPacket(sourceMessage + 6, readLength + 5))
@@ -720,12 +1066,7 @@ BOOL SRV_SIRC::createReadPacketAndTransmit(uint8_t *sourceMessage, uint32_t star
 #endif
 
 	memcpy(currentBuffer + 5, outputBufP + startAddress, readLength);
-
-	if(addTransmit(currentPacket))
-        return true;
-    PRINTF(("Reset Ack not sent!\n"));
-    setLastError(INVALIDREADTRANSMIT);
-    return false;
+	return true;
 }
 
 BOOL SRV_SIRC::createReadBackPacketAndTransmit(uint32_t startAddress, uint32_t readLength, uint32_t remainingLength){
@@ -43,9 +43,8 @@ public:
 	//Send the contents of the output buffer back to the host
 	BOOL __stdcall sendReadBacks(uint32_t length);
 
-	void __stdcall resetRunRegister(){
-		regFileP[255] = 0;
-	}
+	//Lower the execution signal, and tell the host that started it (if any)
+	void __stdcall resetRunRegister();
 
     //Retrieve the active set of parameters and limits for this instance
     BOOL __stdcall getParameters(SIRC_SERVER::PARAMETERS *outParameters, uint32_t maxOutLength);
@@ -53,6 +52,9 @@ public:
     //Modify the active set of parameters and limits for this instance
     BOOL __stdcall setParameters(const SIRC_SERVER::PARAMETERS *inParameters, uint32_t inLength);
 
+	//The MAC address hosts talk to us at, as the packet driver gave it to us
+	void __stdcall getMACAddress(uint8_t *MACAddress);
+
 private:
 	uint32_t *regFileP;
 	uint8_t *inputBufP;
@@ -62,13 +64,36 @@ private:
 
 	uint8_t WriteAndRunHostMACAddress[6];
     uint8_t My_MACAddress[6];
+
+	//Host that raised the execution signal with a register write, it gets a done
+	// notification when the signal is lowered.
+	uint8_t RunHostMACAddress[6];
+	bool notifyDone;
 	
     // Used while composing packets (locals in disguise)
     PACKET *currentPacket;
 	uint8_t *currentBuffer;
 
+	//While handling a command that came with a transaction ID, every response to it
+	// goes out in the same envelope.  replyTagLength is zero otherwise.
+	uint8_t replyTag[3];
+	uint16_t replyTagLength;
+
 	std::list <PACKET *>::iterator packetIter;
 
+    //Largest frame the NIC can take, includes the 14 byte header.
+    uint32_t nicFrameSize;
+
+    //Frame sizes the hosts asked for, by MAC address.  Hosts that are not in here get standard
+    // frames, so one host's reset or frame size command does not change what the others get.
+    typedef struct {
+        uint8_t MACAddress[6];
+        uint32_t frameSize;
+    } HOST_FRAME_SIZE;
+    std::vector <HOST_FRAME_SIZE> hostFrameSizes;
+    uint32_t frameSizeFor(const uint8_t *hostMAC);
+    void setFrameSizeFor(const uint8_t *hostMAC, uint32_t frameSize);
+
     //How many can we have anyways?
     uint32_t maxOutstandingReads;
     uint32_t maxOutstandingWrites;
@@ -77,6 +102,7 @@ private:
 
 	inline BOOL addReceive(PACKET *Packet = NULL);
 	inline BOOL addTransmit(PACKET* Packet);
+	inline BOOL addTransmits(PACKET** Packets, uint32_t count);
 
 	BOOL processPacket(PACKET* Packet, bool *execute, bool *writeAndExecute);
 
@@ -87,9 +113,22 @@ private:
 	BOOL checkResetPacket(uint8_t *sourceMessage);
 	BOOL sendResetAck(uint8_t *sourceMessage);
 
+	BOOL checkFrameSizePacket(uint8_t *sourceMessage);
+	BOOL sendFrameSizeAck(uint8_t *sourceMessage);
+
+	BOOL checkTransactionIdPacket(uint8_t *sourceMessage);
+	BOOL checkTaggedPacket(PACKET* Packet, bool *execute, bool *writeAndExecute);
+
 	BOOL checkRegWritePacket(uint8_t *sourceMessage, bool *execute);
 	BOOL sendRegWriteAck(uint8_t *sourceMessage, bool *execute);
 
+	inline void writeRegister(uint8_t regAddress, uint32_t value, uint8_t *hostMAC, bool *execute);
+
+	BOOL checkRegWriteBatchPacket(uint8_t *sourceMessage, bool *execute);
+	BOOL checkRegReadBatchPacket(uint8_t *sourceMessage);
+
+	BOOL sendDoneNotification(void);
+
 	BOOL checkWritePacket(uint8_t *sourceMessage);
 	BOOL sendWriteAck(uint8_t *sourceMessage);
 
@@ -100,7 +139,7 @@ private:
 
 	BOOL checkReadPacket(uint8_t *sourceMessage);
 	BOOL sendReadAcks(uint8_t *sourceMessage, uint32_t startAddress, uint32_t readLength);
-	BOOL createReadPacketAndTransmit(uint8_t *sourceMessage, uint32_t startAddress, uint32_t readLength);
+	BOOL createReadPacket(uint8_t *sourceMessage, uint32_t startAddress, uint32_t readLength);
 
 	BOOL createReadBackPacketAndTransmit(uint32_t startAddress, uint32_t readLength, uint32_t remainingLength);
 
@@ -20,30 +20,12 @@ void error(string inErr){
 	exit(-1);
 }
 
-int main(int argc, char* argv[])
+//Take commands from the host, run, answer.  Only returns if something goes wrong.
+static void serve(SRV_SIRC *srv, uint32_t *registerFile, uint8_t *inputBuffer, uint8_t *outputBuffer)
 {
-    SRV_SIRC *srv;
-	uint32_t *registerFile;
-	uint8_t *inputBuffer;
-	uint8_t *outputBuffer;
 	bool writeAndExecute;
 	uint32_t expectedOutputBytes;
 
-    /* args? */
-    uint32_t driverVersion = 0;
-    if ((argc > 1) && (argv[1][0] == '-'))
-        driverVersion = atoi(argv[1]+1);
-    //BUGBUG add NIC name option
-
-	std::ostringstream tempStream;
-
-    srv = new SRV_SIRC(&registerFile, &inputBuffer, &outputBuffer, driverVersion);
-	//Make sure that the constructor didn't run into trouble
-	if(srv->getLastError() != 0){
-		tempStream << "Constructor failed with code " << srv->getLastError();
-		error(tempStream.str());
-	}
-
     expectedOutputBytes = 66; //uhu?
 
 
@@ -76,7 +58,145 @@ int main(int argc, char* argv[])
 			}
 		}
 	}
+}
+
+//Loopback benchmark.
+//The server runs on a thread of its own, on one end of the in-process stand-in for the
+// NIC (see LOOPBACK_NIC_NAME), and we talk to it through ETH_SIRC on the other end.
+//Nothing goes over a real wire, so this measures the protocol and the code, not the network.
+#define BENCHMARK_ROUNDS 256
+
+typedef struct {
+    SRV_SIRC *srv;
+    uint32_t *registerFile;
+    uint8_t *inputBuffer;
+    uint8_t *outputBuffer;
+    HANDLE started;
+} SERVER_ARGS;
+
+static DWORD WINAPI serverThread(void *context)
+{
+    SERVER_ARGS args = *(SERVER_ARGS *)context;
+
+    //The server posted its receives in its constructor, so whatever the client sends
+    // from now on waits there until processCommands gets to it.
+    SetEvent(args.started);
+    serve(args.srv, args.registerFile, args.inputBuffer, args.outputBuffer);
+    return 0;
+}
+
+static void report(const char *what, uint32_t bytes, LARGE_INTEGER start, LARGE_INTEGER end,
+                   LARGE_INTEGER frequency)
+{
+    double seconds = (double)(end.QuadPart - start.QuadPart) / (double)frequency.QuadPart;
+
+    printf("%s: %u rounds of %u bytes in %.3f sec, %.1f MB/s\n", what, BENCHMARK_ROUNDS, bytes,
+           seconds, (double)bytes * BENCHMARK_ROUNDS / seconds / (1024 * 1024));
+}
+
+static void loopbackBenchmark(void)
+{
+    SERVER_ARGS args;
+    ETH_SIRC *eth;
+    SIRC::PARAMETERS params;
+    uint8_t *buffer;
+    LARGE_INTEGER frequency, start, end;
+    wchar_t nicName[] = LOOPBACK_NIC_NAME;
+    uint8_t serverMAC[6];
+
+	std::ostringstream tempStream;
+
+    args.registerFile = NULL;
+    args.inputBuffer = NULL;
+    args.outputBuffer = NULL;
+    args.srv = new SRV_SIRC(&args.registerFile, &args.inputBuffer, &args.outputBuffer, 0, nicName);
+	if(args.srv->getLastError() != 0){
+		tempStream << "Server constructor failed with code " << (int) args.srv->getLastError();
+		error(tempStream.str());
+	}
+    args.srv->getMACAddress(serverMAC);
+
+    //Do not let the client reset the server before the server is up
+    args.started = CreateEvent(NULL, TRUE, FALSE, NULL);
+    if(!args.started || !CreateThread(NULL, 0, serverThread, &args, 0, NULL))
+		error("Cannot start the server thread");
+    WaitForSingleObject(args.started, INFINITE);
+    CloseHandle(args.started);
+
+    eth = new ETH_SIRC(serverMAC, 0, nicName);
+	if(eth->getLastError() != 0){
+		tempStream << "Client constructor failed with code " << (int) eth->getLastError();
+		error(tempStream.str());
+	}
+    if(!eth->getParameters(&params, sizeof(params))){
+		tempStream << "Cannot getParameters, code " << (int) eth->getLastError();
+		error(tempStream.str());
+	}
+
+    buffer = (uint8_t *) malloc(max(params.maxInputDataBytes, params.maxOutputDataBytes));
+    if(!buffer)
+		error("Out of memory");
+    for(uint32_t i = 0; i < params.maxInputDataBytes; i++)
+        buffer[i] = (uint8_t) i;
+
+    QueryPerformanceFrequency(&frequency);
+
+    //Fill the input buffer, over and over
+    QueryPerformanceCounter(&start);
+    for(int i = 0; i < BENCHMARK_ROUNDS; i++){
+        if(!eth->sendWrite(0, params.maxInputDataBytes, buffer)){
+			tempStream << "sendWrite failed with code " << (int) eth->getLastError();
+			error(tempStream.str());
+		}
+    }
+    QueryPerformanceCounter(&end);
+    report("Write", params.maxInputDataBytes, start, end, frequency);
+
+    //Same for reading the output buffer
+    QueryPerformanceCounter(&start);
+    for(int i = 0; i < BENCHMARK_ROUNDS; i++){
+        if(!eth->sendRead(0, params.maxOutputDataBytes, buffer)){
+			tempStream << "sendRead failed with code " << (int) eth->getLastError();
+			error(tempStream.str());
+		}
+    }
+    QueryPerformanceCounter(&end);
+    report("Read", params.maxOutputDataBytes, start, end, frequency);
+
+    //The server thread never returns, it goes away with the process
+    delete eth;
+    free(buffer);
+    PrintZeLog();
+}
+
+int main(int argc, char* argv[])
+{
+    SRV_SIRC *srv;
+	uint32_t *registerFile;
+	uint8_t *inputBuffer;
+	uint8_t *outputBuffer;
+
+    /* args? */
+    //-loopback runs the benchmark above, -<n> asks for packet driver version n
+    if ((argc > 1) && (strcmp(argv[1], "-loopback") == 0)) {
+        loopbackBenchmark();
+        return 0;
+    }
+    uint32_t driverVersion = 0;
+    if ((argc > 1) && (argv[1][0] == '-'))
+        driverVersion = atoi(argv[1]+1);
+    //BUGBUG add NIC name option
+
+	std::ostringstream tempStream;
+
+    srv = new SRV_SIRC(&registerFile, &inputBuffer, &outputBuffer, driverVersion);
+	//Make sure that the constructor didn't run into trouble
+	if(srv->getLastError() != 0){
+		tempStream << "Constructor failed with code " << srv->getLastError();
+		error(tempStream.str());
+	}
 
+    serve(srv, registerFile, inputBuffer, outputBuffer);
 
     delete srv;
 
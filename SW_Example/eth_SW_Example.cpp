@@ -435,13 +435,10 @@ int main(int argc, char* argv[]){
 
 		if(isChallengeGood(A,B)){
 
-			//Set parameter register 0 to the operand A
-			if(!SIRC_P->sendParamRegisterWrite(0, A)){
-				tempStream << "Parameter register write failed with code " << (int) SIRC_P->getLastError();
-				error(tempStream.str());
-			}
-			//Set parameter register 1 to the operand B
-			if(!SIRC_P->sendParamRegisterWrite(1, B)){
+			//Set parameter registers 0 and 1 to the operands A and B, in one round trip
+			uint8_t operandRegs[2] = {0, 1};
+			uint32_t operands[2] = {A, B};
+			if(!SIRC_P->sendParamRegisterWriteBatch(2, operandRegs, operands)){
 				tempStream << "Parameter register write failed with code " << (int) SIRC_P->getLastError();
 				error(tempStream.str());
 			}